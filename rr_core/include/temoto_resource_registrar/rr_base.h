@@ -17,24 +17,38 @@
 #ifndef TEMOTO_RESOURCE_REGISTRAR__RR_BASE_H
 #define TEMOTO_RESOURCE_REGISTRAR__RR_BASE_H
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <fstream>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <map>
 #include <mutex>
+#include <set>
 #include <stdio.h>
 #include <thread>
+#include <typeindex>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "rr_catalog.h"
 #include "rr_client_base.h"
 #include "rr_configuration.h"
 #include "rr_exceptions.h"
+#include "rr_execution_policy.h"
 #include "rr_id_utils.h"
+#include "rr_lease.h"
 #include "rr_query_base.h"
+#include "rr_query_context.h"
 #include "rr_server_base.h"
 #include "rr_status.h"
+#include "rr_thread_pool.h"
+#include "rr_transport.h"
+#include "rr_watchdog.h"
 
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
@@ -43,96 +57,210 @@
 
 namespace temoto_resource_registrar
 {
+  /**
+   * @brief Registry of servers or clients. Elements are stored in a dense slot array and addressed by
+   * integer handles which stay valid until the element is removed. Handles are not reused. The
+   * id-to-handle map is only needed for resolving elements by name.
+   */
   template <class ContentClass>
   class MapContainer
   {
   public:
+    typedef std::size_t Handle;
+    static constexpr Handle INVALID_HANDLE = static_cast<Handle>(-1);
+
+    /**
+     * @brief Stores \p content.
+     *
+     * @return handle of the element or INVALID_HANDLE if an element with the same id already exists.
+     */
+    Handle insert(std::unique_ptr<ContentClass> content)
+    {
+      Handle handle = slots_.size();
+      auto ret = handles_.insert(std::make_pair(content->id(), handle));
+      if (!ret.second)
+      {
+        return INVALID_HANDLE;
+      }
+
+      types_.push_back(std::type_index(typeid(*content)));
+      slots_.push_back(std::move(content));
+      count_++;
+      return handle;
+    }
+
     bool add(std::unique_ptr<ContentClass> content)
     {
-      auto ret = rr_contents_.insert(std::make_pair(content->id(), std::move(content)));
-      return ret.second;
+      return insert(std::move(content)) != INVALID_HANDLE;
     }
 
     bool remove(const std::string &id)
     {
-      return rr_contents_.erase(id) > 0;
+      auto it = handles_.find(id);
+      if (it == handles_.end())
+      {
+        return false;
+      }
+
+      slots_[it->second].reset();
+      handles_.erase(it);
+      count_--;
+      return true;
     }
 
     bool exists(const std::string &id)
     {
-      auto it = rr_contents_.find(id);
-      if (it != rr_contents_.end())
+      return handles_.count(id) > 0;
+    }
+
+    bool exists(Handle handle) const
+    {
+      return handle < slots_.size() && slots_[handle];
+    }
+
+    Handle handle(const std::string &id) const
+    {
+      auto it = handles_.find(id);
+      if (it != handles_.end())
       {
-        return true;
+        return it->second;
       }
-      return false;
+      return INVALID_HANDLE;
+    }
+
+    std::size_t size() const
+    {
+      return count_;
     }
 
     std::vector<std::string> getIds()
     {
       std::vector<std::string> ids;
-      for (auto it = rr_contents_.begin(); it != rr_contents_.end(); ++it)
+      ids.reserve(count_);
+      for (const auto &slot : slots_)
       {
-        ids.push_back(it->first);
+        if (slot)
+        {
+          ids.push_back(slot->id());
+        }
       }
       return ids;
     }
 
+    ContentClass *getElementPtr(Handle handle)
+    {
+      if (exists(handle))
+      {
+        return slots_[handle].get();
+      }
+      std::string error = "element with handle '" + std::to_string(handle) + "' not found";
+      throw ElementNotFoundException(error.c_str());
+    }
+
     ContentClass *getElementPtr(const std::string &key)
     {
-      auto it = rr_contents_.find(key);
-      if (it != rr_contents_.end())
+      Handle element_handle = handle(key);
+      if (element_handle != INVALID_HANDLE)
       {
-        return (it->second.get());
+        return slots_[element_handle].get();
       }
       std::string error = "element '" + key + "' not found";
       throw ElementNotFoundException(error.c_str());
     }
 
+    /**
+     * @brief Returns the element as \p Derived without copying it. The dynamic type of the element is
+     * recorded when it is stored, so a matching request is resolved with a static downcast.
+     *
+     * @throws std::bad_cast if the element is not a \p Derived.
+     */
+    template <class Derived>
+    Derived &getTyped(Handle handle)
+    {
+      ContentClass *element = getElementPtr(handle);
+      if (types_[handle] == typeid(Derived))
+      {
+        return *static_cast<Derived *>(element);
+      }
+      return dynamic_cast<Derived &>(*element);
+    }
+
+    template <class Derived>
+    Derived &getTyped(const std::string &key)
+    {
+      return getTyped<Derived>(handle(key));
+    }
+
+    const ContentClass &getElement(Handle handle)
+    {
+      return *getElementPtr(handle);
+    }
+
+    /**
+     * @brief Shares the ownership of the element, which keeps it alive after it is removed.
+     */
+    std::shared_ptr<ContentClass> share(Handle handle)
+    {
+      getElementPtr(handle);
+      return slots_[handle];
+    }
+
     const ContentClass &getElement(const std::string &key)
     {
-      auto it = rr_contents_.find(key);
-      if (it != rr_contents_.end())
+      return *getElementPtr(key);
+    }
+
+    const bool unload(Handle handle, const std::string &id)
+    {
+      if (exists(handle))
       {
-        return *(it->second.get());
+        return slots_[handle]->unloadMessage(id);
       }
-      std::string error = "element '" + key + "' not found";
-      throw ElementNotFoundException(error.c_str());
+      return false;
     }
 
     const bool unload(const std::string &key, const std::string &id)
     {
-      auto it = rr_contents_.find(key);
-      if (it != rr_contents_.end())
+      return unload(handle(key), id);
+    }
+
+    const bool hasCallback(Handle handle, const std::string &queryId)
+    {
+      if (exists(handle))
       {
-        return (it->second.get())->unloadMessage(id);
+        return slots_[handle]->hasRegisteredCb(queryId);
       }
       return false;
     }
 
     const bool hasCallback(const std::string &key, const std::string &queryId)
     {
-      auto it = rr_contents_.find(key);
-      if (it != rr_contents_.end())
+      return hasCallback(handle(key), queryId);
+    }
+
+    const void runCallback(Handle handle, const std::string &queryId, const Status &statusInfo)
+    {
+      if (exists(handle))
       {
-        return (it->second.get())->hasRegisteredCb(queryId);
+        slots_[handle]->internalStatusCallback(queryId, statusInfo);
       }
-      return false;
     }
 
     const void runCallback(const std::string &key, const std::string &queryId, const Status &statusInfo)
     {
-      auto it = rr_contents_.find(key);
-      if (it != rr_contents_.end())
-      {
-        (it->second.get())->internalStatusCallback(queryId, statusInfo);
-      }
+      runCallback(handle(key), queryId, statusInfo);
     }
 
   protected:
-    std::unordered_map<std::string, std::unique_ptr<ContentClass>> rr_contents_;
+    std::vector<std::shared_ptr<ContentClass>> slots_;
+    std::vector<std::type_index> types_;
+    std::unordered_map<std::string, Handle> handles_;
+    std::size_t count_ = 0;
   };
 
+  template <class ContentClass>
+  constexpr typename MapContainer<ContentClass>::Handle MapContainer<ContentClass>::INVALID_HANDLE;
+
   class RrServers : public MapContainer<RrServerBase>
   {
   };
@@ -141,6 +269,33 @@ namespace temoto_resource_registrar
   {
   };
 
+  struct UnloadFailure
+  {
+    std::string rr_;
+    std::string id_;
+    std::string message_;
+  };
+
+  /**
+   * @brief Outcome of a cascading unload. unloaded_ tells whether all the requested queries were
+   * unloaded, failures_ lists the resources of the dependency tree that could not be unloaded.
+   */
+  struct UnloadReport
+  {
+    bool unloaded_ = true;
+    std::vector<UnloadFailure> failures_;
+  };
+
+  /**
+   * @brief Bounded part of the result of a data fetch. Passing next_cursor_ to the next fetch continues
+   * where this page ended, an empty next_cursor_ marks the last page.
+   */
+  struct DataFetchPage
+  {
+    std::vector<std::pair<UUID, std::pair<std::string, std::string>>> entries_;
+    std::string next_cursor_;
+  };
+
   /**
  * @brief 
  * 
@@ -148,6 +303,9 @@ namespace temoto_resource_registrar
   class RrBase
   {
   public:
+    typedef RrServers::Handle ServerHandle;
+    typedef RrClients::Handle ClientHandle;
+
     RrBase(const Configuration &config) : RrBase(config.name())
     {
       updateConfiguration(config);
@@ -167,6 +325,16 @@ namespace temoto_resource_registrar
  */
     virtual ~RrBase()
     {
+      if (transport_)
+      {
+        transport_->serve(NULL);
+      }
+
+      // loads abandoned at their hard time limit may return later on, they no longer reach this RR
+      lifetime_->end();
+      stopLeaseReaper();
+      releaseWarmPool();
+
       ////TEMOTO_INFO_(("Destroying rr '" + name_ + "'").c_str());
       if (configuration_.eraseOnDestruct())
       {
@@ -219,6 +387,16 @@ namespace temoto_resource_registrar
       call<CallClientClass>(&rr, NULL, server, query);
     }
 
+    /**
+     * @brief Calls \p server of the RR \p rr through a client of type CallClientClass, e.g. a TransportClient
+     * when \p rr lives in another process.
+     */
+    template <class CallClientClass, class QueryType>
+    void call(const std::string &rr, const std::string &server, QueryType &query)
+    {
+      privateCall<CallClientClass, RrServerBase, QueryType, void *>(&rr, NULL, server, query, NULL);
+    }
+
     template <class ServType, class QueryType, class StatusCallType>
     void call(RrBase &target,
               const std::string &server,
@@ -236,180 +414,692 @@ namespace temoto_resource_registrar
       privateCall<RrClientBase, ServType, QueryType, void *>(NULL, &(target), server, query, NULL);
     }
 
-    size_t serverCount() { return servers_.getIds().size(); }
-    size_t clientCount() { return clients_.getIds().size(); }
+    /**
+     * @brief Executes \p calls in parallel on the shared thread pool and waits until all of them have finished.
+     * Meant for load callbacks that load several independent sub-resources via nested RrBase::call. Every
+     * successful call is registered as a dependency of the query that is being loaded. If any of the calls
+     * fails, the ones that succeeded are unloaded via localUnload and the first error is rethrown.
+     *
+     * @param calls 
+     */
+    void callAll(const std::vector<std::function<void()>> &calls)
+    {
+      QueryContext::Ptr parent_context = QueryContext::current();
+      bool own_group = false;
+
+      // Called outside of a load callback of this RR. The calls are grouped under a temporary
+      // query, so that they can be rolled back together.
+      if (!parent_context || parent_context->rr() != name_)
+      {
+        RrQueryBase group_query;
+        group_query.setId(boost::uuids::to_string(boost::uuids::random_generator()()));
+        parent_context = std::make_shared<const QueryContext>(name_, group_query, parent_context);
+        own_group = true;
+      }
+
+      const std::string group_id = parent_context->query().id();
+
+      // the calls share a token, so that the first failure cancels the calls that are still running
+      RrQueryBase group_query = parent_context->query();
+      CancellationToken::Ptr group_token = std::make_shared<CancellationToken>();
+      if (group_query.cancellationToken())
+      {
+        group_query.cancellationToken()->link(group_token);
+      }
+      group_query.setCancellationToken(group_token);
+
+      QueryContext::Ptr call_context = std::make_shared<const QueryContext>(name_,
+                                                                            group_query,
+                                                                            parent_context->parent(),
+                                                                            true);
+
+      TaskGroup group(ThreadPool::shared());
+      for (const auto &call : calls)
+      {
+        group.run(temoto_logging::bindSpanContext([call_context, call, group_token]() {
+          QueryContext::Scope scope(call_context);
+          try
+          {
+            call();
+          }
+          catch (...)
+          {
+            group_token->cancel("a parallel call failed");
+            throw;
+          }
+        }));
+      }
+
+      try
+      {
+        group.wait();
+      }
+      catch (...)
+      {
+        //TEMOTO_DEBUG_("parallel call failed. unloading the calls that succeeded");
+        localUnload(group_id);
+        throw;
+      }
+
+      if (own_group)
+      {
+        for (const auto &dependency : rr_catalog_->getDependencies(group_id))
+        {
+          rr_catalog_->unloadDependency(group_id, dependency.first);
+        }
+      }
+    }
+
+    /**
+     * @brief Same as call(RrBase &, const std::string &, QueryType &) but addresses the server with the handle
+     * returned by its registration, which avoids resolving the server by name.
+     */
+    template <class ServType, class QueryType>
+    void call(RrBase &target,
+              ServerHandle server,
+              QueryType &query)
+    {
+      privateCall<RrClientBase, ServType, QueryType, void *>(NULL, &(target), target.servers_.getElement(server).name(), query, NULL, server);
+    }
+
+    size_t serverCount() { return servers_.size(); }
+    size_t clientCount() { return clients_.size(); }
+
+    /**
+     * @brief Resolves the handle of a server registered in this RR.
+     *
+     * @param server name of the server, without the RR prefix
+     * @return ServerHandle or RrServers::INVALID_HANDLE if no such server exists
+     */
+    ServerHandle serverHandle(const std::string &server) const
+    {
+      return servers_.handle(IDUtils::generateServerName(name_, server));
+    }
 
     virtual bool unload(const std::string &rr, const std::string &id)
     {
+      if (transport_)
+      {
+        return remoteUnload(rr, {id});
+      }
       throw NotImplementedException("'unload' is not implemented in the base class");
     }
 
     bool unload(RrBase &target, const std::string &id)
     {
+      target.cancel(id, "unloaded by the requester");
       return target.localUnload(id);
     }
 
-    bool localUnload(const std::string &id)
+    /**
+     * @brief Unloads several queries of the RR \p rr. The base implementation unloads them one by one,
+     * RRs that can pass a whole batch to the remote side should override it.
+     */
+    virtual bool unloadBatch(const std::string &rr, const std::vector<std::string> &ids)
     {
-      //TEMOTO_DEBUG_("localUnload id: %s", id.c_str());
+      if (transport_)
+      {
+        return remoteUnload(rr, ids);
+      }
 
-      std::string serverId = rr_catalog_->getIdServer(id);
+      bool unloaded = true;
+      for (const auto &id : ids)
+      {
+        unloaded &= unload(rr, id);
+      }
+      return unloaded;
+    }
 
-      //TEMOTO_DEBUG_("serverId id: %s", serverId.c_str());
+    /**
+     * @brief Unloads \p ids in \p target with a single cascadeUnload, so the catalog is persisted once
+     * and resources on the same level of the dependency trees are released in parallel.
+     */
+    bool unloadBatch(RrBase &target, const std::vector<std::string> &ids)
+    {
+      for (const auto &id : ids)
+      {
+        target.cancel(id, "unloaded by the requester");
+        target.releaseLease(id);
+      }
+      return target.cascadeUnload(ids).unloaded_;
+    }
 
-      auto dependency_map = rr_catalog_->getDependencies(id);
-      if (dependency_map.size() > 0)
+    /**
+     * @brief Cancels the query \p id if its load callback is still running. The cancellation is passed on
+     * to the queries the callback depends on. Whatever the callback loaded before it gave up is unloaded
+     * once it returns.
+     *
+     * @return false if no such query is in flight.
+     */
+    bool cancel(const std::string &id, const std::string &reason = "cancelled")
+    {
+      CancellationToken::Ptr token;
       {
-        //TEMOTO_DEBUG_("dependencyMap.size() > 0");
-        for (auto const &dependency : dependency_map)
+        std::lock_guard<std::mutex> lock(in_flight_mutex_);
+        auto it = in_flight_.find(id);
+        if (it == in_flight_.end())
         {
-          unloadResource(id, dependency);
+          return false;
         }
+        token = it->second;
       }
-      bool res = unloadByServerAndQuery(serverId, id);
-      autoSaveCatalog();
-      return res;
+
+      token->cancel(reason);
+      return true;
     }
 
-    void registerServer(std::unique_ptr<RrServerBase> server_ptr)
+    /**
+     * @brief Grants or extends leases on query ids served by this RR. Leasing is optional, but a leased id
+     * that is not renewed within \p ttl is considered orphaned (e.g. its requester died) and is unloaded.
+     *
+     * @return the ids that are not loaded anymore and were not leased
+     */
+    std::vector<std::string> renewLeases(const std::vector<std::string> &ids, std::chrono::milliseconds ttl)
     {
-      //TEMOTO_INFO_("registering server");
-      server_ptr->registerTransactionCb(std::bind(&RrBase::processTransactionCallback, this, std::placeholders::_1));
-      server_ptr->initializeServer(name(), rr_catalog_);
+      std::vector<std::string> unknown_ids;
+      {
+        std::lock_guard<std::mutex> lock(lease_mutex_);
+        auto now = LeaseWheel::Clock::now();
+        for (const auto &id : ids)
+        {
+          if (rr_catalog_->getIdServer(id).empty())
+          {
+            unknown_ids.push_back(id);
+            continue;
+          }
+          leases_.renew(id, ttl, now);
+        }
 
-      //TEMOTO_INFO_("registration complete %s", (server_ptr->id()).c_str());
-      servers_.add(std::move(server_ptr));
+        if (!lease_reaper_.joinable() && !lease_stopping_ && leases_.size() > 0)
+        {
+          lease_reaper_ = std::thread(&RrBase::runLeaseReaper, this);
+        }
+      }
+      lease_cv_.notify_all();
+      return unknown_ids;
     }
 
-    template <class ServType, class QueryType>
-    void handleInternalCall(const std::string &server, QueryType &query)
+    std::vector<std::string> renewLeases(RrBase &target, const std::vector<std::string> &ids, std::chrono::milliseconds ttl)
     {
-      //TEMOTO_DEBUG_("\t executing internal call to server: %s", server.c_str());
-      auto &server_ref = servers_.getElement(server);
-
-      auto dynamic_ref = dynamic_cast<const ServType &>(server_ref);
-
-      dynamic_ref.processQuery(query);
+      return target.renewLeases(ids, ttl);
     }
 
-    void printCatalog() { rr_catalog_->print(); }
-
-    std::string name() { return name_; }
-
-    void setRrReferences(const std::unordered_map<std::string, RrBase *> &references) { rr_references_ = references; }
-
-    std::string resolveQueryServerId(const std::string &id) { return rr_catalog_->getIdServer(id); }
-
-    bool unloadByServerAndQuery(const std::string &server, const std::string &id) { return servers_.unload(server, id); }
-
-    void sendStatus(const std::string &quiery_id, Status status_data)
+    /**
+     * @brief Removes the lease of \p id without unloading it.
+     */
+    bool releaseLease(const std::string &id)
     {
-      ////TEMOTO_DEBUG_("core sendStatus %s", status_data.id_);
-
-      std::unordered_map<std::string, std::string> notify_ids = rr_catalog_->getAllQueryIds(status_data.id_);
-      for (auto const &not_id : notify_ids)
-      {
-        ////TEMOTO_DEBUG_("\t callStatusClient for rr %s", not_id.second.c_str());
+      std::lock_guard<std::mutex> lock(lease_mutex_);
+      return leases_.remove(id);
+    }
 
-        bool status_result = callStatusClient(not_id.second, quiery_id, status_data);
+    std::size_t leaseCount()
+    {
+      std::lock_guard<std::mutex> lock(lease_mutex_);
+      return leases_.size();
+    }
 
-        ////TEMOTO_DEBUG_("\t call result: %i", status_result);
-      }
+    bool localUnload(const std::string &id)
+    {
+      //TEMOTO_DEBUG_("localUnload id: %s", id.c_str());
+      releaseLease(id);
+      return cascadeUnload({id}).unloaded_;
     }
 
-    virtual void handleStatus(const std::string &request_id, Status status_data)
+    /**
+     * @brief Unloads \p ids together with the dependency trees of the resources that get released. The
+     * whole tree is resolved up front (also across the RRs reachable via rr_references_) and unloaded
+     * level by level, starting from the leaves. Resources on the same level are unloaded in parallel.
+     * Modified catalogs are persisted once at the end.
+     *
+     * @param ids query ids served by this RR
+     * @return UnloadReport
+     */
+    UnloadReport cascadeUnload(const std::vector<std::string> &ids)
     {
-      TEMOTO_DEBUG_("entered handleStatus %s - %s - %s", name().c_str(), request_id.c_str(), status_data.id_.c_str());
+      std::vector<UnloadNode> nodes = planUnload(ids);
 
-      std::string original_id = rr_catalog_->getOriginQueryId(status_data.id_);
-      std::string client_name = rr_catalog_->getIdClient(status_data.id_);
-      TEMOTO_DEBUG_("query id %s", original_id.c_str());
+      // height of a node is its distance to the furthest leaf below it. Children are always
+      // planned after their parents
+      std::size_t max_height = 0;
+      for (std::size_t i = nodes.size(); i-- > 0;)
+      {
+        const UnloadNode &node = nodes[i];
+        if (node.parent_ != UnloadNode::ROOT)
+        {
+          nodes[node.parent_].height_ = std::max(nodes[node.parent_].height_, node.height_ + 1);
+        }
+        max_height = std::max(max_height, node.height_);
+      }
 
-      if (clients_.exists(client_name))
+      std::vector<std::vector<std::size_t>> levels(max_height + 1);
+      for (std::size_t i = 0; i < nodes.size(); i++)
       {
-        TEMOTO_DEBUG_("calling callback of client %s", client_name.c_str());
-        clients_.runCallback(client_name, request_id, status_data);
+        levels[nodes[i].height_].push_back(i);
       }
 
-      if (original_id.size())
+      for (const auto &level : levels)
       {
-        status_data.id_ = original_id;
+        if (level.size() == 1)
+        {
+          executeUnloadNode(nodes[level.front()]);
+          continue;
+        }
 
-        TEMOTO_DEBUG_("handleStatus");
-        auto container = rr_catalog_->findOriginalContainer(status_data.id_);
-        if (!container.empty_)
+        TaskGroup group(ThreadPool::shared());
+        for (std::size_t index : level)
         {
-          TEMOTO_DEBUG_("!container.empty_");
-          status_data.serialised_request_ = container.raw_request_;
-          status_data.serialised_response_ = container.raw_query_;
+          UnloadNode *node = &nodes[index];
+          group.run(temoto_logging::bindSpanContext([this, node]() { executeUnloadNode(*node); }));
         }
-        else
+        group.wait();
+      }
+
+      UnloadReport report;
+      std::set<RrBase *> modified_rrs = {this};
+      for (std::size_t i = 0; i < nodes.size(); i++)
+      {
+        const UnloadNode &node = nodes[i];
+        if (node.rr_ != NULL)
         {
-          TEMOTO_DEBUG_("container.empty_");
+          modified_rrs.insert(node.rr_);
+        }
+        if (node.owner_ != NULL)
+        {
+          modified_rrs.insert(node.owner_);
         }
 
-        TEMOTO_DEBUG_("sendStatus to target %s", status_data.id_.c_str());
+        if (node.parent_ == UnloadNode::ROOT)
+        {
+          report.unloaded_ &= node.unloaded_;
+        }
+        if (!node.error_.empty())
+        {
+          report.failures_.push_back({node.rr_name_, node.id_, node.error_});
+        }
+      }
 
-        std::async(&RrBase::sendStatus, this, original_id, status_data);
+      for (RrBase *rr : modified_rrs)
+      {
+        rr->autoSaveCatalog();
+        // resources evicted from the warm pool are unloaded by the sweeper
+        rr->wakeLingerSweeper();
       }
 
-      TEMOTO_DEBUG_("-----exited handleStatus %s", status_data.id_.c_str());
+      return report;
     }
 
-    std::map<std::string, std::pair<std::string, std::string>> getChildQueries(const std::string &id, const std::string &server_name)
+    ServerHandle registerServer(std::unique_ptr<RrServerBase> server_ptr)
     {
-      std::map<std::string, std::pair<std::string, std::string>> res;
-
-      QueryContainer<std::string> q_container = rr_catalog_->findOriginalContainer(id);
-
-      std::string client_name;
+      //TEMOTO_INFO_("registering server");
+      // the callback of an abandoned load may end after this RR
+      std::shared_ptr<Lifetime> lifetime = lifetime_;
+      server_ptr->registerTransactionCb([this, lifetime](const TransactionInfo &info) {
+        Lifetime::Use use(*lifetime);
+        if (use.alive())
+        {
+          processTransactionCallback(info);
+        }
+      });
+      server_ptr->initializeServer(name(), rr_catalog_);
 
-      if (q_container.empty_)
+      std::unique_ptr<ServerState> state = std::make_unique<ServerState>();
+      if (server_ptr->executionPolicy().mode() != ExecutionPolicy::Mode::INLINE)
       {
-        //TEMOTO_DEBUG_("Could not find base container. Maybe is pure client Rr. They can not have multiple dependencies since call executes a single query");
-        return res;
+        state->gate_ = std::make_unique<AdmissionGate>(server_ptr->executionPolicy().concurrency());
       }
-      else
+      state->timeouts_ = server_ptr->loadTimeouts();
+
+      rr_catalog_->setServerFailureBackoff(server_ptr->id(), server_ptr->failureBackoff());
+      if (server_ptr->linger().count() > 0)
       {
+        rr_catalog_->setServerLinger(server_ptr->id(), server_ptr->linger());
+        startLingerSweeper();
       }
-      // UUID - servingRR
-      std::unordered_map<std::string, std::string> dependencies = rr_catalog_->getDependencies(q_container.q_.id());
 
-      //TEMOTO_DEBUG_("Dependencies:");
-      for (const auto &dep : dependencies)
+      //TEMOTO_INFO_("registration complete %s", (server_ptr->id()).c_str());
+      ServerHandle handle = servers_.insert(std::move(server_ptr));
+      if (handle != RrServers::INVALID_HANDLE)
       {
-        //TEMOTO_DEBUG_("%s - %s", dep.first.c_str(), dep.second.c_str());
-
-        //leia client mis seda resurssi haldas
-        client_name = rr_catalog_->getIdClient(dep.first);
-
-        if (IDUtils::generateServerName(dep.second, server_name) == client_name)
-        {
-          //TEMOTO_DEBUG_("client name %s matched. Fetching queries", client_name.c_str());
-          res = getServerRrQueries(client_name, name());
-        }
+        server_states_.resize(std::max(server_states_.size(), handle + 1));
+        server_states_[handle] = std::move(state);
       }
-
-      return res;
+      return handle;
     }
 
-    std::map<UUID, std::pair<std::string, std::string>> handleDataFetch(const std::string &origin_rr, const std::string &server_name)
+    /**
+     * @brief Queueing statistics of a server with a STRAND or BOUNDED execution policy. Servers that run
+     * inline are not tracked and report empty metrics.
+     */
+    QueueMetrics serverQueueMetrics(const std::string &server) const
     {
-      //TEMOTO_DEBUG_("fetching query data for server name: %s", server_name.c_str());
+      ServerHandle handle = serverHandle(server);
+      if (handle == RrServers::INVALID_HANDLE)
+      {
+        throw ElementNotFoundException(("server '" + server + "' not found").c_str());
+      }
 
-      std::map<UUID, std::pair<std::string, std::string>> ret;
+      if (server_states_[handle]->gate_)
+      {
+        return server_states_[handle]->gate_->metrics();
+      }
+      return QueueMetrics();
+    }
+
+    void setWarmPoolLimits(const WarmPoolLimits &limits)
+    {
+      rr_catalog_->setWarmPoolLimits(limits);
+    }
+
+    void setTombstoneLimit(std::size_t limit)
+    {
+      rr_catalog_->setTombstoneLimit(limit);
+    }
+
+    /**
+     * @brief Push based alternative to rescanning the catalog, see RrCatalog::subscribe.
+     */
+    CatalogSubscription subscribeCatalog()
+    {
+      return rr_catalog_->subscribe();
+    }
+
+    /**
+     * @brief Resources that are kept loaded after their last requester released them, see
+     * RrServerBase::setLinger.
+     */
+    WarmPoolStatistics warmPoolStatistics() const
+    {
+      return rr_catalog_->warmPoolStatistics();
+    }
+
+    /**
+     * @brief Stops the linger sweeper and unloads every resource in the warm pool. Called by the
+     * destructor; RRs that override unloadResource should call it from their own destructor, since the
+     * sweeper may otherwise still be running while the derived object is destroyed.
+     */
+    void releaseWarmPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(linger_mutex_);
+        linger_stopping_ = true;
+      }
+      linger_cv_.notify_all();
+      if (linger_sweeper_.joinable())
+      {
+        linger_sweeper_.join();
+      }
+      releaseLingering(true);
+    }
+
+    /**
+     * @brief Execution time histogram of the queries of a server, together with the number of times the
+     * load callbacks exceeded their time limits.
+     */
+    LoadStatistics serverLoadStatistics(const std::string &server) const
+    {
+      ServerHandle handle = serverHandle(server);
+      if (handle == RrServers::INVALID_HANDLE)
+      {
+        throw ElementNotFoundException(("server '" + server + "' not found").c_str());
+      }
+
+      std::lock_guard<std::mutex> lock(server_states_[handle]->stats_mutex_);
+      return server_states_[handle]->stats_;
+    }
+
+    template <class ServType, class QueryType>
+    void handleInternalCall(const std::string &server, QueryType &query)
+    {
+      handleInternalCall<ServType, QueryType>(servers_.handle(server), query);
+    }
+
+    template <class ServType, class QueryType>
+    void handleInternalCall(ServerHandle server, QueryType &query)
+    {
+      //TEMOTO_DEBUG_("\t executing internal call to server: %s", server.c_str());
+      const ServType &typed_server = servers_.getTyped<ServType>(server);
+      const RequestMetadata &metadata = query.requestMetadata();
+
+      if (!query.cancellationToken())
+      {
+        query.setCancellationToken(std::make_shared<CancellationToken>());
+      }
+      if (query.cancelled())
+      {
+        rejectQuery(typed_server.id(), query, "was cancelled before it was executed");
+        return;
+      }
+
+      if (metadata.deadlineExpired())
+      {
+        rejectExpiredQuery(typed_server.id(), query);
+        return;
+      }
+
+      AdmissionGate::Admission admission(admissionGate(server), metadata.priority(), metadata.deadline());
+      if (!admission.admitted())
+      {
+        rejectExpiredQuery(typed_server.id(), query);
+        return;
+      }
+
+      ServerState &state = *server_states_[server];
+      Watchdog::TimerId soft_limit = scheduleSoftLimit(typed_server.id(), state);
+      Watchdog::ScopedTimer soft_timer(soft_limit != 0 ? &Watchdog::shared() : NULL, soft_limit);
+
+      auto start = std::chrono::steady_clock::now();
+      if (state.timeouts_.hard_.count() > 0)
+      {
+        processWithHardLimit<ServType>(server, state, query);
+      }
+      else
+      {
+        typed_server.processQuery(query);
+      }
+      auto duration = std::chrono::steady_clock::now() - start;
+
+      std::lock_guard<std::mutex> lock(state.stats_mutex_);
+      state.stats_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(duration));
+    }
+
+    void printCatalog() { rr_catalog_->print(); }
+
+    std::string name() { return name_; }
+
+    void setRrReferences(const std::unordered_map<std::string, RrBase *> &references) { rr_references_ = references; }
+
+    /**
+     * @brief Reaches the RRs that are not in rr_references_ through \p transport, whose endpoint has to be
+     * named after this RR. Requests of other RRs arriving over it are served by this RR. Has to be set
+     * before the first call to another RR.
+     */
+    void setTransport(const std::shared_ptr<Transport> &transport)
+    {
+      if (transport_)
+      {
+        transport_->serve(NULL);
+      }
+
+      transport_ = transport;
+      if (transport_)
+      {
+        transport_->serve([this](TransportMessage type, const std::string &payload) {
+          return handleTransportRequest(type, payload);
+        });
+      }
+    }
+
+    /**
+     * @brief Makes \p server reachable for TransportClient calls of other RRs. The queries arriving over the
+     * transport are executed like in-process calls.
+     */
+    template <class ServType, class QueryType>
+    void serveRemote(const std::string &server)
+    {
+      ServerHandle handle = serverHandle(server);
+      if (handle == RrServers::INVALID_HANDLE)
+      {
+        throw ElementNotFoundException(("server '" + server + "' not found").c_str());
+      }
+
+      std::lock_guard<std::mutex> lock(remote_servers_mutex_);
+      remote_servers_[IDUtils::generateServerName(name_, server)] = [this, handle](const std::string &base_data,
+                                                                                  const std::string &typed_data) {
+        QueryType query = Serializer::deserialize<QueryType>(typed_data);
+        static_cast<RrQueryBase &>(query) = Serializer::deserialize<RrQueryBase>(base_data);
+
+        handleInternalCall<ServType, QueryType>(handle, query);
+
+        return PayloadWriter()
+            .put(Serializer::serialize<RrQueryBase>(query))
+            .put(Serializer::serialize<QueryType>(query))
+            .str();
+      };
+    }
+
+    std::string resolveQueryServerId(const std::string &id) { return rr_catalog_->getIdServer(id); }
+
+    bool unloadByServerAndQuery(const std::string &server, const std::string &id) { return servers_.unload(server, id); }
+
+    /**
+     * @brief Sends a status to every query that is subscribed to the resource of \p status_data.id_.
+     * Subscribers are grouped by the RR they originate from, so the resource lookup and the payload
+     * are prepared once and each subscribing RR is notified with a single batched call.
+     */
+    void sendStatus(const std::string &quiery_id, Status status_data)
+    {
+      ////TEMOTO_DEBUG_("core sendStatus %s", status_data.id_);
+
+      std::unordered_map<std::string, std::string> notify_ids = rr_catalog_->getAllQueryIds(status_data.id_);
+      if (notify_ids.empty())
+      {
+        return;
+      }
+
+      // RR name - subscribed query ids
+      std::unordered_map<std::string, std::vector<std::string>> rr_subscribers;
+      for (auto const &not_id : notify_ids)
+      {
+        rr_subscribers[not_id.second].push_back(not_id.first);
+      }
+
+      auto container = rr_catalog_->findOriginalContainer(status_data.id_);
+      if (!container.empty_)
+      {
+        status_data.serialised_request_ = container.raw_request_;
+        status_data.serialised_response_ = container.raw_query_;
+      }
+
+      for (auto const &subscribers : rr_subscribers)
+      {
+        ////TEMOTO_DEBUG_("\t callStatusClient for rr %s", subscribers.first.c_str());
+
+        bool status_result = callStatusClient(subscribers.first, quiery_id, subscribers.second, status_data);
+
+        ////TEMOTO_DEBUG_("\t call result: %i", status_result);
+      }
+    }
+
+    virtual void handleStatus(const std::string &request_id, Status status_data)
+    {
+      processStatus(request_id, status_data);
+    }
+
+    /**
+     * @brief Batched counterpart of handleStatus(const std::string &, Status). Delivers one status
+     * payload to all \p subscriber_ids of this RR.
+     */
+    virtual void handleStatus(const std::string &request_id,
+                              const std::vector<std::string> &subscriber_ids,
+                              const Status &status_data)
+    {
+      Status subscriber_status = status_data;
+      for (const auto &subscriber_id : subscriber_ids)
+      {
+        subscriber_status.id_ = subscriber_id;
+        processStatus(request_id, subscriber_status);
+      }
+    }
+
+    std::map<std::string, std::pair<std::string, std::string>> getChildQueries(const std::string &id, const std::string &server_name)
+    {
+      std::map<std::string, std::pair<std::string, std::string>> res;
+
+      std::string client_name = findChildClient(id, server_name);
+      if (!client_name.empty())
+      {
+        res = getServerRrQueries(client_name, name());
+      }
 
-      //TEMOTO_DEBUG_("getClientIds");
+      return res;
+    }
 
-      std::set<std::string> ids = rr_catalog_->getServerIds(server_name);
+    /**
+     * @brief Streaming variant of getChildQueries. The queries are fetched in pages of \p page_size and
+     * passed to \p sink one at a time, so only a single page is held in memory.
+     */
+    void getChildQueries(const std::string &id,
+                         const std::string &server_name,
+                         const QuerySink &sink,
+                         std::size_t page_size = 100,
+                         DataProjection projection = DataProjection::REQUEST_AND_RESPONSE)
+    {
+      std::string client_name = findChildClient(id, server_name);
+      if (!client_name.empty())
+      {
+        fetchServerRrQueries(client_name, name(), sink, page_size, projection);
+      }
+    }
 
-      //TEMOTO_DEBUG_("findAndCollectIdQueries");
-      findAndCollectIdQueries(ids, origin_rr, ret);
+    /**
+     * @brief Delta variant of getChildQueries for keeping a copy of the child queries in sync. Pass 0 as
+     * \p since at first, and the generation_ of the previous delta afterwards.
+     */
+    DataDelta getChildQueryChanges(const std::string &id,
+                                   const std::string &server_name,
+                                   std::uint64_t since,
+                                   DataProjection projection = DataProjection::REQUEST_AND_RESPONSE)
+    {
+      std::string client_name = findChildClient(id, server_name);
+      if (client_name.empty())
+      {
+        DataDelta delta;
+        delta.reset_ = true;
+        return delta;
+      }
+      return fetchServerRrChanges(client_name, name(), since, projection);
+    }
 
-      //TEMOTO_DEBUG_("got %i queries ", ret.size());
+    std::map<UUID, std::pair<std::string, std::string>> handleDataFetch(const std::string &origin_rr, const std::string &server_name)
+    {
+      std::map<UUID, std::pair<std::string, std::string>> ret;
+      rr_catalog_->visitServerQueries(server_name, origin_rr, "", 0, DataProjection::REQUEST_AND_RESPONSE,
+                                      [&ret](const UUID &id, const std::string &request, const std::string &response) {
+                                        ret[id] = std::make_pair(request, response);
+                                      });
       return ret;
     }
 
+    /**
+     * @brief Returns at most \p page_size queries of \p server_name that originate from \p origin_rr,
+     * continuing after \p cursor (empty for the first page).
+     */
+    DataFetchPage handleDataFetchPage(const std::string &origin_rr,
+                                      const std::string &server_name,
+                                      const std::string &cursor,
+                                      std::size_t page_size,
+                                      DataProjection projection = DataProjection::REQUEST_AND_RESPONSE)
+    {
+      DataFetchPage page;
+      page.entries_.reserve(page_size);
+      page.next_cursor_ = rr_catalog_->visitServerQueries(server_name, origin_rr, cursor, std::max<std::size_t>(page_size, 1), projection,
+                                                          [&page](const UUID &id, const std::string &request, const std::string &response) {
+                                                            page.entries_.emplace_back(id, std::make_pair(request, response));
+                                                          });
+      return page;
+    }
+
     virtual std::map<std::string,
                      std::pair<std::string, std::string>>
     callDataFetchClient(const std::string &target_rr,
@@ -417,11 +1107,54 @@ namespace temoto_resource_registrar
                         const std::string &server_name)
     {
       //TEMOTO_DEBUG_("target rr for data fetch: %s", target_rr.c_str());
+      if (transport_ && rr_references_.count(target_rr) == 0)
+      {
+        return remoteDataFetch(target_rr, origin_rr, server_name);
+      }
       auto res = rr_references_[target_rr]->handleDataFetch(origin_rr, server_name);
       //TEMOTO_DEBUG_("fetched %i queries", res.size());
       return res;
     }
 
+    /**
+     * @brief Changes of the queries of \p server_name that originate from \p origin_rr since the catalog
+     * generation \p since, see RrCatalog::fetchChanges.
+     */
+    DataDelta handleDataDelta(const std::string &origin_rr,
+                              const std::string &server_name,
+                              std::uint64_t since,
+                              DataProjection projection = DataProjection::REQUEST_AND_RESPONSE)
+    {
+      return rr_catalog_->fetchChanges(server_name, origin_rr, since, projection);
+    }
+
+    virtual DataDelta callDataDeltaClient(const std::string &target_rr,
+                                          const std::string &origin_rr,
+                                          const std::string &server_name,
+                                          std::uint64_t since,
+                                          DataProjection projection)
+    {
+      if (transport_ && rr_references_.count(target_rr) == 0)
+      {
+        return remoteDataDelta(target_rr, origin_rr, server_name, since, projection);
+      }
+      return rr_references_[target_rr]->handleDataDelta(origin_rr, server_name, since, projection);
+    }
+
+    virtual DataFetchPage callDataFetchPageClient(const std::string &target_rr,
+                                                  const std::string &origin_rr,
+                                                  const std::string &server_name,
+                                                  const std::string &cursor,
+                                                  std::size_t page_size,
+                                                  DataProjection projection)
+    {
+      if (transport_ && rr_references_.count(target_rr) == 0)
+      {
+        return remoteDataFetchPage(target_rr, origin_rr, server_name, cursor, page_size, projection);
+      }
+      return rr_references_[target_rr]->handleDataFetchPage(origin_rr, server_name, cursor, page_size, projection);
+    }
+
     std::vector<std::string> callbacks()
     {
       std::vector<std::string> cb_vector;
@@ -460,6 +1193,7 @@ namespace temoto_resource_registrar
         std::unique_ptr<CallClientClass> client = std::make_unique<CallClientClass>(rr, server);
         //TEMOTO_DEBUG_("client created! %s", client_name.c_str());
         client->setCatalog(rr_catalog_);
+        attachTransport(client.get());
         //TEMOTO_DEBUG_("Catalog set.");
         clients_.add(std::move(client));
         //TEMOTO_DEBUG_("Client registered.");
@@ -486,10 +1220,17 @@ namespace temoto_resource_registrar
         std::string target_rr = clients_.getElement(client).rr();
         clients_.remove(client);
 
-        for (const std::string &id : rr_catalog_->getClientIds(client))
+        std::set<std::string> client_ids = rr_catalog_->getClientIds(client);
+        std::vector<std::string> ids(client_ids.begin(), client_ids.end());
+
+        auto target = rr_references_.find(target_rr);
+        if (target != rr_references_.end())
+        {
+          unloadBatch(*target->second, ids);
+        }
+        else
         {
-          //TEMOTO_DEBUG_("\tunloadClient msg id %s", id.c_str());
-          unload(target_rr, id);
+          unloadBatch(target_rr, ids);
         }
       }
       catch (const ElementNotFoundException &e)
@@ -504,8 +1245,17 @@ namespace temoto_resource_registrar
     }
 
   protected:
+    struct ServerState
+    {
+      std::unique_ptr<AdmissionGate> gate_;
+      LoadTimeouts timeouts_;
+      mutable std::mutex stats_mutex_;
+      LoadStatistics stats_;
+    };
+
     RrServers servers_;
     RrClients clients_;
+    std::vector<std::unique_ptr<ServerState>> server_states_;
     RrCatalogPtr rr_catalog_;
 
     Configuration configuration_;
@@ -535,6 +1285,36 @@ namespace temoto_resource_registrar
       return callDataFetchClient(target_rr, query_rr, server_name);
     };
 
+    DataDelta fetchServerRrChanges(const std::string &server_name,
+                                   const std::string &query_rr,
+                                   std::uint64_t since,
+                                   DataProjection projection = DataProjection::REQUEST_AND_RESPONSE)
+    {
+      return callDataDeltaClient(rr_catalog_->getServerRr(server_name), query_rr, server_name, since, projection);
+    }
+
+    /**
+     * @brief Passes the queries of getServerRrQueries to \p sink, fetching them \p page_size at a time.
+     */
+    void fetchServerRrQueries(const std::string &server_name,
+                              const std::string &query_rr,
+                              const QuerySink &sink,
+                              std::size_t page_size = 100,
+                              DataProjection projection = DataProjection::REQUEST_AND_RESPONSE)
+    {
+      std::string target_rr = rr_catalog_->getServerRr(server_name);
+      std::string cursor;
+      do
+      {
+        DataFetchPage page = callDataFetchPageClient(target_rr, query_rr, server_name, cursor, page_size, projection);
+        for (const auto &entry : page.entries_)
+        {
+          sink(entry.first, entry.second.first, entry.second.second);
+        }
+        cursor = std::move(page.next_cursor_);
+      } while (!cursor.empty());
+    }
+
     void updateQuery(const std::string &server,
                      const std::string &request,
                      const std::string &response)
@@ -572,51 +1352,164 @@ namespace temoto_resource_registrar
 
       handleRrServerCb(request_id, status_data);
 
+      if (transport_ && rr_references_.count(target_rr) == 0)
+      {
+        remoteStatus(target_rr, request_id, {status_data.id_}, status_data);
+        return true;
+      }
+
       rr_references_[target_rr]->handleStatus(request_id, status_data);
 
       return true;
     }
 
-    template <class CallClientClass, class QueryClass, class StatusCallType>
-    void handleClientCall(const std::string &rr, const std::string client_name,
-                          QueryClass &query,
-                          const StatusCallType &status_callback)
+    /**
+     * @brief Delivers a status to all \p subscriber_ids that belong to \p target_rr. The payload of
+     * \p status_data is expected to be filled in already. RRs that are not reachable in-process are
+     * served through the per-query callStatusClient(const std::string &, const std::string &, Status).
+     * The status callback of the originating server still fires once per subscriber.
+     */
+    virtual bool callStatusClient(const std::string &target_rr,
+                                  const std::string &request_id,
+                                  const std::vector<std::string> &subscriber_ids,
+                                  const Status &status_data)
     {
-      std::string client_id = createClient<CallClientClass>(rr, client_name);
+      auto target_it = rr_references_.find(target_rr);
+      if ((target_it == rr_references_.end() || target_it->second == NULL) && !transport_)
+      {
+        bool result = true;
+        Status subscriber_status = status_data;
+        for (const auto &subscriber_id : subscriber_ids)
+        {
+          subscriber_status.id_ = subscriber_id;
+          result &= callStatusClient(target_rr, request_id, subscriber_status);
+        }
+        return result;
+      }
 
-      auto client = dynamic_cast<const CallClientClass &>(clients_.getElement(client_id));
-      client.invoke(query);
+      for (std::size_t i = 0; i < subscriber_ids.size(); i++)
+      {
+        handleRrServerCb(request_id, status_data);
+      }
 
-      storeClientQueryStatusCb<CallClientClass, StatusCallType>(client_id, query.id(), status_callback);
+      if (target_it == rr_references_.end() || target_it->second == NULL)
+      {
+        remoteStatus(target_rr, request_id, subscriber_ids, status_data);
+        return true;
+      }
 
-      std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
-      rr_catalog_->storeClientCallRecord(client_id, query.id());
+      target_it->second->handleStatus(request_id, subscriber_ids, status_data);
+
+      return true;
     }
 
+    void processStatus(const std::string &request_id, const Status &status_data)
+    {
+      TEMOTO_DEBUG_("entered handleStatus %s - %s - %s", name().c_str(), request_id.c_str(), status_data.id_.c_str());
 
+      std::string original_id = rr_catalog_->getOriginQueryId(status_data.id_);
+      std::string client_name = rr_catalog_->getIdClient(status_data.id_);
+      TEMOTO_DEBUG_("query id %s", original_id.c_str());
 
-    /**
-     * @brief TODO: requires a proper comment.
-     * Note: If your application has multiple client calls to different services, and each call has its unique status
-     * callback, then make sure that the appropriate callback is provided. Otherwise they get mixed and thats probably
-     * not the intended behavior.
-     * Since the status callback function is common across all client calls, make sure that 
-     * 
-     * @tparam CallClientClass 
-     * @tparam ServType 
-     * @tparam QueryType 
-     * @param rr 
-     * @param target 
-     * @param server 
-     * @param query 
-     * @param status_callback
-     */
-    template <class CallClientClass, class ServType, class QueryType, class StatusCallType>
-    void privateCall(const std::string *rr, RrBase *target, const std::string &server, QueryType &query, const StatusCallType &status_callback)
-    { 
-      START_SPAN
+      if (clients_.exists(client_name))
+      {
+        TEMOTO_DEBUG_("calling callback of client %s", client_name.c_str());
+        clients_.runCallback(client_name, request_id, status_data);
+      }
 
-      std::thread::id work_id = std::this_thread::get_id();
+      if (original_id.size())
+      {
+        Status upstream_status = status_data;
+        upstream_status.id_ = original_id;
+
+        TEMOTO_DEBUG_("handleStatus");
+        auto container = rr_catalog_->findOriginalContainer(upstream_status.id_);
+        if (!container.empty_)
+        {
+          TEMOTO_DEBUG_("!container.empty_");
+          upstream_status.serialised_request_ = container.raw_request_;
+          upstream_status.serialised_response_ = container.raw_query_;
+        }
+        else
+        {
+          TEMOTO_DEBUG_("container.empty_");
+        }
+
+        TEMOTO_DEBUG_("sendStatus to target %s", upstream_status.id_.c_str());
+
+        std::async(&RrBase::sendStatus, this, original_id, upstream_status);
+      }
+
+      TEMOTO_DEBUG_("-----exited handleStatus %s", status_data.id_.c_str());
+    }
+
+    template <class CallClientClass, class QueryClass, class StatusCallType>
+    void handleClientCall(const std::string &rr, const std::string client_name,
+                          QueryClass &query,
+                          const StatusCallType &status_callback)
+    {
+      std::string client_id = createClient<CallClientClass>(rr, client_name);
+
+      const CallClientClass &client = clients_.getTyped<CallClientClass>(client_id);
+      client.invoke(query);
+
+      storeClientQueryStatusCb<CallClientClass, StatusCallType>(client_id, query.id(), status_callback);
+
+      std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+      rr_catalog_->storeClientCallRecord(client_id, query.id());
+    }
+
+
+
+    /**
+     * @brief TODO: requires a proper comment.
+     * Note: If your application has multiple client calls to different services, and each call has its unique status
+     * callback, then make sure that the appropriate callback is provided. Otherwise they get mixed and thats probably
+     * not the intended behavior.
+     * Since the status callback function is common across all client calls, make sure that 
+     * 
+     * @tparam CallClientClass 
+     * @tparam ServType 
+     * @tparam QueryType 
+     * @param rr 
+     * @param target 
+     * @param server 
+     * @param query 
+     * @param status_callback
+     */
+    template <class CallClientClass, class ServType, class QueryType, class StatusCallType>
+    void privateCall(const std::string *rr,
+                     RrBase *target,
+                     const std::string &server,
+                     QueryType &query,
+                     const StatusCallType &status_callback,
+                     ServerHandle server_handle = RrServers::INVALID_HANDLE)
+    {
+      QueryContext::Ptr parent_context = QueryContext::current();
+      if (parent_context && parent_context->rr() != name_)
+      {
+        parent_context.reset();
+      }
+
+      // calls made by a load callback continue the trace (and its sampling decision) of the query being
+      // loaded, also when the callback runs on a thread or RR of its own
+      START_SPAN_CHILD_OF(parent_context ? parent_context->query().requestMetadata().getSpanContext()
+                                         : temoto_logging::SpanContextType())
+
+      if (parent_context)
+      {
+        query.requestMetadata().inherit(parent_context->query().requestMetadata());
+
+        const CancellationToken::Ptr &parent_token = parent_context->query().cancellationToken();
+        if (parent_token)
+        {
+          if (!query.cancellationToken())
+          {
+            query.setCancellationToken(std::make_shared<CancellationToken>());
+          }
+          parent_token->link(query.cancellationToken());
+        }
+      }
 
       //TEMOTO_DEBUG_("in private call");
 
@@ -650,7 +1543,11 @@ namespace temoto_resource_registrar
       {
         //TEMOTO_DEBUG_("executing mem call, also setting rr");
         query.setRr(target_rr_name);
-        target->handleInternalCall<ServType, QueryType>(server_name, query);
+        if (server_handle == RrServers::INVALID_HANDLE)
+        {
+          server_handle = target->servers_.handle(server_name);
+        }
+        target->handleInternalCall<ServType, QueryType>(server_handle, query);
 
         //TEMOTO_DEBUG_("\t storeClientCallRecord to server: %s", server.c_str());
 
@@ -662,20 +1559,20 @@ namespace temoto_resource_registrar
       if (!query.responseMetadata().errorStack().empty())
       {
         //TEMOTO_DEBUG_("query had an error. unloading if dependencies exist");
-        if (running_query_map_.count(work_id))
+        if (parent_context && !parent_context->rollbackDeferred())
         {
           //TEMOTO_DEBUG_("Dependencies might exist. Attempting unload");
-          localUnload(running_query_map_[work_id].id());
+          localUnload(parent_context->query().id());
         }
 
         //TEMOTO_DEBUG_("throwing error upstream");
         throw FWD_TEMOTO_ERRSTACK(query.responseMetadata().errorStack());
       }
 
-      if (running_query_map_.count(work_id))
+      if (parent_context)
       {
         //TEMOTO_DEBUG_("------------------------------------- has a dependency requirement");
-        RrQueryBase bq = running_query_map_[work_id];
+        const RrQueryBase &bq = parent_context->query();
         std::cout << "!!!Query " << query.id() << " is dependency of " << bq.id() << ". Stroring it" << std::endl;
 
         rr_catalog_->storeDependency(bq.id(), query.rr(), query.id());
@@ -687,6 +1584,15 @@ namespace temoto_resource_registrar
     virtual void unloadResource(const std::string &id, const std::pair<const std::string, std::string> &dependency)
     {
       //TEMOTO_DEBUG_("private unloadResource() %s", id.c_str());
+      if (transport_ && rr_references_.count(dependency.second) == 0)
+      {
+        if (remoteUnload(dependency.second, {dependency.first}))
+        {
+          rr_catalog_->unloadDependency(id, dependency.first);
+        }
+        return;
+      }
+
       std::string dependency_server = rr_references_[dependency.second]->resolveQueryServerId(dependency.first);
 
       //TEMOTO_DEBUG_("dependencyServer %s", dependency_server.c_str());
@@ -700,43 +1606,732 @@ namespace temoto_resource_registrar
     }
 
   private:
+    /**
+     * @brief A single resource reference that is released by a cascading unload.
+     */
+    struct UnloadNode
+    {
+      static constexpr std::size_t ROOT = static_cast<std::size_t>(-1);
+
+      // registrar serving the resource. NULL if it is not reachable in-process
+      RrBase *rr_;
+      std::string rr_name_;
+      std::string server_;
+      std::string id_;
+
+      // registrar and query the dependency is recorded under. NULL for the requested queries
+      RrBase *owner_;
+      std::string owner_id_;
+
+      std::size_t parent_;
+      std::size_t height_;
+
+      // outcome
+      bool unloaded_;
+      std::string error_;
+    };
+
+    std::vector<UnloadNode> planUnload(const std::vector<std::string> &ids)
+    {
+      std::vector<UnloadNode> nodes;
+      std::set<std::pair<RrBase *, std::string>> planned_ids;
+      // (RR, original query id) - number of its ids released by the plan
+      std::map<std::pair<RrBase *, std::string>, int> released_id_counts;
+
+      for (const auto &id : ids)
+      {
+        if (planned_ids.insert(std::make_pair(this, id)).second)
+        {
+          nodes.push_back({this, name_, rr_catalog_->getIdServer(id), id, NULL, "", UnloadNode::ROOT, 0, false, ""});
+        }
+      }
+
+      for (std::size_t i = 0; i < nodes.size(); i++)
+      {
+        RrBase *rr = nodes[i].rr_;
+        if (rr == NULL)
+        {
+          continue;
+        }
+
+        // dependencies are released only together with the last reference of the resource, or when it
+        // leaves the warm pool if its server lingers. Queries that were never stored (e.g. failed loads)
+        // and resources leaving the warm pool release their dependencies right away.
+        std::string dependency_key;
+        QueryContainer<std::string> container = rr->rr_catalog_->findOriginalContainer(nodes[i].id_);
+        if (container.empty_)
+        {
+          dependency_key = nodes[i].id_;
+        }
+        else if (++released_id_counts[std::make_pair(rr, container.q_.id())] == container.getIdCount() &&
+                 !rr->rr_catalog_->lingers(container.responsible_server_))
+        {
+          dependency_key = container.q_.id();
+        }
+
+        if (dependency_key.empty())
+        {
+          continue;
+        }
+
+        for (const auto &dependency : rr->rr_catalog_->getDependencies(dependency_key))
+        {
+          RrBase *dependency_rr = NULL;
+          auto reference_it = rr->rr_references_.find(dependency.second);
+          if (reference_it != rr->rr_references_.end())
+          {
+            dependency_rr = reference_it->second;
+          }
+
+          if (!planned_ids.insert(std::make_pair(dependency_rr, dependency.first)).second)
+          {
+            continue;
+          }
+
+          std::string dependency_server;
+          if (dependency_rr != NULL)
+          {
+            dependency_server = dependency_rr->rr_catalog_->getIdServer(dependency.first);
+          }
+
+          nodes.push_back({dependency_rr, dependency.second, dependency_server, dependency.first, rr, dependency_key, i, 0, false, ""});
+        }
+      }
+
+      return nodes;
+    }
+
+    void executeUnloadNode(UnloadNode &node)
+    {
+      try
+      {
+        if (node.owner_ == NULL)
+        {
+          node.unloaded_ = unloadByServerAndQuery(node.server_, node.id_);
+        }
+        else if (node.rr_ != NULL)
+        {
+          node.unloaded_ = node.rr_->unloadByServerAndQuery(node.server_, node.id_);
+          if (node.unloaded_)
+          {
+            node.owner_->rr_catalog_->unloadDependency(node.owner_id_, node.id_);
+          }
+          else
+          {
+            node.error_ = "resource not found in server '" + node.server_ + "'";
+          }
+        }
+        else
+        {
+          node.owner_->unloadResource(node.owner_id_, std::make_pair(node.id_, node.rr_name_));
+          node.unloaded_ = true;
+        }
+      }
+      catch (const std::exception &e)
+      {
+        node.error_ = e.what();
+      }
+      catch (...)
+      {
+        node.error_ = "unknown error";
+      }
+    }
+
+    void rejectQuery(const std::string &server, RrQueryBase &query, const std::string &reason)
+    {
+      query.responseMetadata().errorStack().appendError(
+          resource_registrar::TemotoErrorStack("query to '" + server + "' " + reason, name_));
+    }
+
+    void rejectExpiredQuery(const std::string &server, RrQueryBase &query)
+    {
+      rejectQuery(server, query, "passed its deadline before it was executed");
+    }
+
+    /**
+     * @brief Gate a query to \p server has to pass before it is executed, or NULL if the query can run
+     * right away. Queries that are nested in a query already executing in this RR are never gated, since
+     * waiting for a slot held by their own ancestor would deadlock.
+     */
+    AdmissionGate *admissionGate(ServerHandle server)
+    {
+      if (!server_states_[server]->gate_)
+      {
+        return NULL;
+      }
+
+      for (QueryContext::Ptr context = QueryContext::current(); context; context = context->parent())
+      {
+        if (context->rr() == name_)
+        {
+          return NULL;
+        }
+      }
+
+      return server_states_[server]->gate_.get();
+    }
+
+    Watchdog::TimerId scheduleSoftLimit(const std::string &server, ServerState &state)
+    {
+      if (state.timeouts_.soft_.count() == 0)
+      {
+        return 0;
+      }
+
+      ServerState *state_ptr = &state;
+      return Watchdog::shared().schedule(state.timeouts_.soft_, [server, state_ptr]() {
+        TEMOTO_WARN_("load callback of '%s' exceeded its soft time limit", server.c_str());
+        std::lock_guard<std::mutex> lock(state_ptr->stats_mutex_);
+        state_ptr->stats_.soft_limit_exceeded_++;
+      });
+    }
+
+    /**
+     * @brief Executes the query on LoadExecutor::shared, so that the caller can be completed with an error
+     * when the load callback exceeds the hard time limit. The query is then cancelled, the executor replaces
+     * the thread of the callback and, should the callback succeed later on while this RR still exists, the
+     * resource it loaded is unloaded.
+     */
+    template <class ServType, class QueryType>
+    void processWithHardLimit(ServerHandle handle, ServerState &state, QueryType &query)
+    {
+      struct TimedLoad
+      {
+        explicit TimedLoad(const QueryType &query) : query_(query){};
+
+        std::mutex mutex_;
+        std::condition_variable finished_cv_;
+        bool done_ = false;
+        bool timed_out_ = false;
+        std::exception_ptr error_;
+        QueryType query_;
+      };
+
+      auto load = std::make_shared<TimedLoad>(query);
+      CancellationToken::Ptr token = query.cancellationToken();
+
+      // an abandoned callback keeps running after its server was removed from servers_
+      std::shared_ptr<RrServerBase> server = servers_.share(handle);
+      std::string server_id = server->id();
+      std::shared_ptr<Lifetime> lifetime = lifetime_;
+
+      LoadExecutor::TicketPtr ticket = LoadExecutor::shared().submit(QueryContext::bind([this, server, load, lifetime]() {
+        bool expired;
+        {
+          std::lock_guard<std::mutex> lock(load->mutex_);
+          expired = load->timed_out_;
+        }
+
+        std::exception_ptr error;
+        try
+        {
+          // the limit may have expired while the load waited for a thread
+          if (!expired)
+          {
+            static_cast<const ServType &>(*server).processQuery(load->query_);
+          }
+        }
+        catch (...)
+        {
+          error = std::current_exception();
+        }
+
+        bool abandoned;
+        {
+          std::lock_guard<std::mutex> lock(load->mutex_);
+          load->done_ = true;
+          load->error_ = error;
+          abandoned = load->timed_out_;
+        }
+        load->finished_cv_.notify_all();
+
+        if (abandoned && !expired && !error && load->query_.responseMetadata().errorStack().empty())
+        {
+          Lifetime::Use use(*lifetime);
+          if (use.alive())
+          {
+            localUnload(load->query_.id());
+          }
+        }
+      }));
+
+      Watchdog::ScopedTimer hard_timer(&Watchdog::shared(), Watchdog::shared().schedule(state.timeouts_.hard_, [load, token]() {
+        {
+          std::lock_guard<std::mutex> lock(load->mutex_);
+          if (load->done_)
+          {
+            return;
+          }
+          load->timed_out_ = true;
+        }
+        load->finished_cv_.notify_all();
+        token->cancel("the hard time limit of the load callback was exceeded");
+      }));
+
+      std::unique_lock<std::mutex> lock(load->mutex_);
+      load->finished_cv_.wait(lock, [&load] { return load->done_ || load->timed_out_; });
+
+      // a cancelled callback may finish before this thread wakes up, the query is abandoned regardless
+      if (load->timed_out_)
+      {
+        lock.unlock();
+        LoadExecutor::shared().abandon(ticket);
+        {
+          std::lock_guard<std::mutex> stats_lock(state.stats_mutex_);
+          state.stats_.hard_limit_exceeded_++;
+        }
+        rejectQuery(server_id, query, "exceeded the hard time limit of its load callback");
+        return;
+      }
+
+      if (load->error_)
+      {
+        std::rethrow_exception(load->error_);
+      }
+      query = load->query_;
+    }
+
     std::string name_;
+
     std::unordered_map<std::string, RrBase *> rr_references_;
+
+    std::shared_ptr<Transport> transport_;
+    std::mutex remote_servers_mutex_;
+    std::unordered_map<std::string, std::function<std::string(const std::string &, const std::string &)>> remote_servers_;
+
+    void attachTransport(RrClientBase *) {}
+
+    void attachTransport(TransportClient *client) { client->setTransport(transport_); }
+
+    bool remoteUnload(const std::string &rr, const std::vector<std::string> &ids)
+    {
+      std::uint32_t unloaded;
+      PayloadReader(transport_->request(rr, TransportMessage::UNLOAD, PayloadWriter().put(ids).str())).get(unloaded);
+      return unloaded != 0;
+    }
+
+    void remoteStatus(const std::string &rr,
+                      const std::string &request_id,
+                      const std::vector<std::string> &subscriber_ids,
+                      const Status &status_data)
+    {
+      transport_->request(rr, TransportMessage::STATUS, PayloadWriter().put(request_id).put(subscriber_ids).put(status_data).str());
+    }
+
+    std::map<UUID, std::pair<std::string, std::string>> remoteDataFetch(const std::string &rr,
+                                                                         const std::string &origin_rr,
+                                                                         const std::string &server_name)
+    {
+      PayloadReader reader(transport_->request(rr, TransportMessage::DATA_FETCH, PayloadWriter().put(origin_rr).put(server_name).str()));
+
+      std::map<UUID, std::pair<std::string, std::string>> queries;
+      std::uint32_t count;
+      reader.get(count);
+      for (std::uint32_t i = 0; i < count; i++)
+      {
+        std::string id;
+        std::pair<std::string, std::string> query;
+        reader.get(id).get(query.first).get(query.second);
+        queries[id] = std::move(query);
+      }
+      return queries;
+    }
+
+    DataFetchPage remoteDataFetchPage(const std::string &rr,
+                                      const std::string &origin_rr,
+                                      const std::string &server_name,
+                                      const std::string &cursor,
+                                      std::size_t page_size,
+                                      DataProjection projection)
+    {
+      PayloadReader reader(transport_->request(rr,
+                                               TransportMessage::DATA_FETCH_PAGE,
+                                               PayloadWriter()
+                                                   .put(origin_rr)
+                                                   .put(server_name)
+                                                   .put(cursor)
+                                                   .put(static_cast<std::uint32_t>(page_size))
+                                                   .put(static_cast<std::uint32_t>(projection))
+                                                   .str()));
+
+      DataFetchPage page;
+      std::uint32_t count;
+      reader.get(page.next_cursor_).get(count);
+      page.entries_.resize(count);
+      for (auto &entry : page.entries_)
+      {
+        reader.get(entry.first).get(entry.second.first).get(entry.second.second);
+      }
+      return page;
+    }
+
+    DataDelta remoteDataDelta(const std::string &rr,
+                              const std::string &origin_rr,
+                              const std::string &server_name,
+                              std::uint64_t since,
+                              DataProjection projection)
+    {
+      PayloadReader reader(transport_->request(rr,
+                                               TransportMessage::DATA_DELTA,
+                                               PayloadWriter()
+                                                   .put(origin_rr)
+                                                   .put(server_name)
+                                                   .put(since)
+                                                   .put(static_cast<std::uint32_t>(projection))
+                                                   .str()));
+
+      DataDelta delta;
+      std::uint32_t reset;
+      std::uint32_t count;
+      reader.get(delta.generation_).get(reset).get(delta.removed_).get(count);
+      delta.reset_ = reset != 0;
+      delta.changed_.resize(count);
+      for (auto &entry : delta.changed_)
+      {
+        reader.get(entry.first).get(entry.second.first).get(entry.second.second);
+      }
+      return delta;
+    }
+
+    std::string handleTransportRequest(TransportMessage type, const std::string &payload)
+    {
+      PayloadReader reader(payload);
+      switch (type)
+      {
+      case TransportMessage::CALL:
+      {
+        std::string server;
+        std::string base_data;
+        std::string typed_data;
+        reader.get(server).get(base_data).get(typed_data);
+
+        std::function<std::string(const std::string &, const std::string &)> remote_server;
+        {
+          std::lock_guard<std::mutex> lock(remote_servers_mutex_);
+          auto it = remote_servers_.find(server);
+          if (it == remote_servers_.end())
+          {
+            throw resource_registrar::TemotoErrorStack("server '" + server + "' is not served remotely", name_);
+          }
+          remote_server = it->second;
+        }
+        return remote_server(base_data, typed_data);
+      }
+
+      case TransportMessage::STATUS:
+      {
+        std::string request_id;
+        std::vector<std::string> subscriber_ids;
+        Status status_data;
+        reader.get(request_id).get(subscriber_ids).get(status_data);
+        handleStatus(request_id, subscriber_ids, status_data);
+        return "";
+      }
+
+      case TransportMessage::UNLOAD:
+      {
+        std::vector<std::string> ids;
+        reader.get(ids);
+        bool unloaded = unloadBatch(*this, ids);
+        return PayloadWriter().put(static_cast<std::uint32_t>(unloaded)).str();
+      }
+
+      case TransportMessage::DATA_FETCH:
+      {
+        std::string origin_rr;
+        std::string server_name;
+        reader.get(origin_rr).get(server_name);
+
+        PayloadWriter writer;
+        auto queries = handleDataFetch(origin_rr, server_name);
+        writer.put(static_cast<std::uint32_t>(queries.size()));
+        for (const auto &query : queries)
+        {
+          writer.put(query.first).put(query.second.first).put(query.second.second);
+        }
+        return writer.str();
+      }
+
+      case TransportMessage::DATA_FETCH_PAGE:
+      {
+        std::string origin_rr;
+        std::string server_name;
+        std::string cursor;
+        std::uint32_t page_size;
+        std::uint32_t projection;
+        reader.get(origin_rr).get(server_name).get(cursor).get(page_size).get(projection);
+
+        DataFetchPage page = handleDataFetchPage(origin_rr, server_name, cursor, page_size, static_cast<DataProjection>(projection));
+        PayloadWriter writer;
+        writer.put(page.next_cursor_).put(static_cast<std::uint32_t>(page.entries_.size()));
+        for (const auto &entry : page.entries_)
+        {
+          writer.put(entry.first).put(entry.second.first).put(entry.second.second);
+        }
+        return writer.str();
+      }
+
+      case TransportMessage::DATA_DELTA:
+      {
+        std::string origin_rr;
+        std::string server_name;
+        std::uint64_t since;
+        std::uint32_t projection;
+        reader.get(origin_rr).get(server_name).get(since).get(projection);
+
+        DataDelta delta = handleDataDelta(origin_rr, server_name, since, static_cast<DataProjection>(projection));
+        PayloadWriter writer;
+        writer.put(delta.generation_)
+            .put(static_cast<std::uint32_t>(delta.reset_))
+            .put(delta.removed_)
+            .put(static_cast<std::uint32_t>(delta.changed_.size()));
+        for (const auto &entry : delta.changed_)
+        {
+          writer.put(entry.first).put(entry.second.first).put(entry.second.second);
+        }
+        return writer.str();
+      }
+      }
+
+      throw resource_registrar::TemotoErrorStack("unknown transport message", name_);
+    }
     mutable std::recursive_mutex modify_mutex_;
 
-    // is a map of thread id - query objects. Used for automatic dependency detection
-    std::unordered_map<std::thread::id, RrQueryBase> running_query_map_;
+    std::mutex in_flight_mutex_;
+    std::unordered_map<std::string, CancellationToken::Ptr> in_flight_;
+
+    /**
+     * @brief Tells work that may outlive the RR, like the loads abandoned at their hard time limit, whether
+     * the RR still exists.
+     */
+    class Lifetime
+    {
+    public:
+      /**
+       * @brief Holds off the end of the lifetime while in scope, if it has not ended yet.
+       */
+      class Use
+      {
+      public:
+        explicit Use(Lifetime &lifetime) : lifetime_(lifetime)
+        {
+          std::lock_guard<std::mutex> lock(lifetime_.mutex_);
+          alive_ = lifetime_.alive_;
+          if (alive_)
+          {
+            lifetime_.users_++;
+          }
+        }
+
+        ~Use()
+        {
+          if (alive_)
+          {
+            std::lock_guard<std::mutex> lock(lifetime_.mutex_);
+            if (--lifetime_.users_ == 0)
+            {
+              lifetime_.ended_cv_.notify_all();
+            }
+          }
+        }
+
+        Use(const Use &) = delete;
+        Use &operator=(const Use &) = delete;
+
+        bool alive() const { return alive_; }
 
+      private:
+        Lifetime &lifetime_;
+        bool alive_;
+      };
+
+      /**
+       * @brief Ends the lifetime once the current uses are over.
+       */
+      void end()
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        alive_ = false;
+        ended_cv_.wait(lock, [this] { return users_ == 0; });
+      }
+
+    private:
+      std::mutex mutex_;
+      std::condition_variable ended_cv_;
+      bool alive_ = true;
+      std::size_t users_ = 0;
+    };
+    std::shared_ptr<Lifetime> lifetime_ = std::make_shared<Lifetime>();
+
+    std::mutex lease_mutex_;
+    std::condition_variable lease_cv_;
+    bool lease_stopping_ = false;
+    LeaseWheel leases_;
+    std::thread lease_reaper_;
+
+    // unloads the ids whose lease ran out
+    void runLeaseReaper()
+    {
+      std::unique_lock<std::mutex> lock(lease_mutex_);
+      while (!lease_stopping_)
+      {
+        if (leases_.size() == 0)
+        {
+          lease_cv_.wait(lock);
+        }
+        else
+        {
+          lease_cv_.wait_until(lock, leases_.nextTick());
+        }
+
+        if (lease_stopping_)
+        {
+          return;
+        }
+
+        std::vector<std::string> expired = leases_.advance(LeaseWheel::Clock::now());
+        if (expired.empty())
+        {
+          continue;
+        }
+
+        lock.unlock();
+        for (const auto &id : expired)
+        {
+          TEMOTO_WARN_("lease of '%s' expired, unloading it", id.c_str());
+          localUnload(id);
+        }
+        lock.lock();
+      }
+    }
+
+    void stopLeaseReaper()
+    {
+      {
+        std::lock_guard<std::mutex> lock(lease_mutex_);
+        lease_stopping_ = true;
+      }
+      lease_cv_.notify_all();
+      if (lease_reaper_.joinable())
+      {
+        lease_reaper_.join();
+      }
+    }
+
+    std::mutex linger_mutex_;
+    std::condition_variable linger_cv_;
+    bool linger_stopping_ = false;
+    std::thread linger_sweeper_;
+
+    void startLingerSweeper()
+    {
+      std::lock_guard<std::mutex> lock(linger_mutex_);
+      if (!linger_sweeper_.joinable() && !linger_stopping_)
+      {
+        linger_sweeper_ = std::thread(&RrBase::runLingerSweeper, this);
+      }
+    }
+
+    void wakeLingerSweeper()
+    {
+      {
+        std::lock_guard<std::mutex> lock(linger_mutex_);
+      }
+      linger_cv_.notify_all();
+    }
+
+    // unloads pooled resources as their linger period runs out
+    void runLingerSweeper()
+    {
+      std::unique_lock<std::mutex> lock(linger_mutex_);
+      while (!linger_stopping_)
+      {
+        auto next_expiry = rr_catalog_->nextLingerExpiry();
+        if (next_expiry == std::chrono::steady_clock::time_point::max())
+        {
+          linger_cv_.wait(lock);
+        }
+        else
+        {
+          linger_cv_.wait_until(lock, next_expiry);
+        }
+
+        if (linger_stopping_)
+        {
+          return;
+        }
+
+        lock.unlock();
+        releaseLingering(false);
+        lock.lock();
+      }
+    }
+
+    void releaseLingering(bool all)
+    {
+      std::vector<std::string> ids = rr_catalog_->takeReleasedLingering(all);
+      if (!ids.empty())
+      {
+        cascadeUnload(ids);
+      }
+    }
+
+    // Running queries are tracked with QueryContext, which is used for automatic dependency detection
     void processTransactionCallback(const TransactionInfo &info)
     {
-      std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
-      std::thread::id work_id = std::this_thread::get_id();
-      // query started. Needs to be added to map
+      // query started. Becomes the active context of this thread
       if (info.type_ == 100)
       {
-        running_query_map_[work_id] = info.base_query_;
+        QueryContext::push(name_, info.base_query_);
+
+        if (info.base_query_.cancellationToken())
+        {
+          std::lock_guard<std::mutex> lock(in_flight_mutex_);
+          in_flight_[info.base_query_.id()] = info.base_query_.cancellationToken();
+        }
       }
-      // query ended, needs removing from map
+      // query ended, restoring the previous context
       else if (info.type_ == 200)
       {
-        running_query_map_.erase(work_id);
+        QueryContext::pop(info.base_query_.id());
+
+        {
+          std::lock_guard<std::mutex> lock(in_flight_mutex_);
+          in_flight_.erase(info.base_query_.id());
+        }
+
+        // a failed (e.g. cancelled) load does not get stored, release what it managed to load
+        const RrQueryBase &query = info.base_query_;
+        if (!query.responseMetadata().errorStack().empty() && !rr_catalog_->getDependencies(query.id()).empty())
+        {
+          localUnload(query.id());
+        }
       }
     }
 
-    void findAndCollectIdQueries(const std::set<std::string> &ids, const std::string &origin_rr, std::map<UUID, std::pair<std::string, std::string>> &result_map)
+    /**
+     * @brief Name of the client that served the dependency of \p id on \p server_name, or an empty
+     * string if there is no such dependency.
+     */
+    std::string findChildClient(const std::string &id, const std::string &server_name)
     {
-      //TEMOTO_DEBUG_("findAndCollectIdQueries for %i ids. Origin: %s", ids.size(), origin_rr.c_str());
+      QueryContainer<std::string> q_container = rr_catalog_->findOriginalContainer(id);
+      if (q_container.empty_)
+      {
+        //TEMOTO_DEBUG_("Could not find base container. Maybe is pure client Rr. They can not have multiple dependencies since call executes a single query");
+        return "";
+      }
 
-      for (const auto &id : ids)
+      // UUID - servingRR
+      for (const auto &dep : rr_catalog_->getDependencies(q_container.q_.id()))
       {
-        QueryContainer<std::string> container = rr_catalog_->findOriginalContainer(id);
-        //TEMOTO_DEBUG_("origin of container: %s", container.q_.origin().c_str());
-        if (!container.empty_ && container.q_.origin() == origin_rr)
+        std::string client_name = rr_catalog_->getIdClient(dep.first);
+        if (IDUtils::generateServerName(dep.second, server_name) == client_name)
         {
-          std::pair<std::string, std::string> request_response_pair(container.raw_request_, container.raw_query_);
-          result_map[container.q_.id()] = request_response_pair;
+          return client_name;
         }
       }
+      return "";
     }
   };
 
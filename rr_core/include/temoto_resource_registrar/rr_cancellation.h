@@ -0,0 +1,122 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_CANCELLATION_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_CANCELLATION_H
+
+#include "temoto_error.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Cooperative cancellation flag of a query. Load callbacks poll it (or call throwIfCancelled) to
+   * stop early. Cancelling a token also cancels the tokens linked to it, which is how the queries that a
+   * load callback depends on get cancelled together with it.
+   */
+  class CancellationToken
+  {
+  public:
+    typedef std::shared_ptr<CancellationToken> Ptr;
+
+    CancellationToken() : cancelled_(false){};
+
+    CancellationToken(const CancellationToken &) = delete;
+    CancellationToken &operator=(const CancellationToken &) = delete;
+
+    void cancel(const std::string &reason = "cancelled")
+    {
+      std::vector<std::weak_ptr<CancellationToken>> children;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_)
+        {
+          return;
+        }
+        reason_ = reason;
+        cancelled_ = true;
+        children.swap(children_);
+      }
+
+      for (const auto &child : children)
+      {
+        if (Ptr token = child.lock())
+        {
+          token->cancel(reason);
+        }
+      }
+    }
+
+    bool isCancelled() const
+    {
+      return cancelled_;
+    }
+
+    std::string reason() const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return reason_;
+    }
+
+    /**
+     * @brief Throws a TemotoErrorStack if the token was cancelled. Meant to be called from load callbacks,
+     * the error is returned to the requester like any other load failure.
+     */
+    void throwIfCancelled() const
+    {
+      if (isCancelled())
+      {
+        throw resource_registrar::TemotoErrorStack("query was cancelled: " + reason(), "CancellationToken");
+      }
+    }
+
+    /**
+     * @brief Cancels \p child whenever this token gets cancelled. If this token already is cancelled,
+     * \p child is cancelled right away.
+     */
+    void link(const Ptr &child)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!cancelled_)
+        {
+          children_.erase(std::remove_if(children_.begin(),
+                                         children_.end(),
+                                         [](const std::weak_ptr<CancellationToken> &c) { return c.expired(); }),
+                          children_.end());
+          children_.push_back(child);
+          return;
+        }
+      }
+      child->cancel(reason());
+    }
+
+  private:
+    std::atomic<bool> cancelled_;
+    mutable std::mutex mutex_;
+    std::string reason_;
+    std::vector<std::weak_ptr<CancellationToken>> children_;
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -17,17 +17,22 @@
 #ifndef TEMOTO_RESOURCE_REGISTRAR__RR_CATALOG_H
 #define TEMOTO_RESOURCE_REGISTRAR__RR_CATALOG_H
 
+#include "rr_catalog_feed.h"
 #include "rr_configuration.h"
 #include "rr_exceptions.h"
 #include "rr_query_base.h"
 #include "rr_query_container.h"
+#include "temoto_error.h"
 
 #include <algorithm>
 #include <boost/serialization/access.hpp>
 #include <boost/serialization/set.hpp>
 #include <boost/serialization/unordered_map.hpp>
 #include <fstream>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -60,6 +65,15 @@ namespace temoto_resource_registrar
 
     void removeDependency(const std::string &id) { id_rr_map_.erase(id); }
 
+    /**
+     * @brief RR of the dependency \p id, or NULL if there is no such dependency.
+     */
+    const std::string *findDependency(const std::string &id) const
+    {
+      auto dependency = id_rr_map_.find(id);
+      return dependency != id_rr_map_.end() ? &dependency->second : NULL;
+    }
+
     int count() { return id_rr_map_.size(); }
 
     void print() const
@@ -88,6 +102,68 @@ namespace temoto_resource_registrar
     std::unordered_map<std::string, std::string> id_rr_map_;
   };
 
+  /**
+   * @brief Bounds of the pool of released resources that are kept loaded for their server's linger
+   * period. When a bound is exceeded, the least recently released resources are unloaded first.
+   */
+  struct WarmPoolLimits
+  {
+    std::size_t max_entries_ = 64;
+    std::size_t max_bytes_ = 16 * 1024 * 1024;
+  };
+
+  struct WarmPoolStatistics
+  {
+    std::size_t entries_ = 0;
+    std::size_t bytes_ = 0;
+    std::size_t revived_ = 0;
+    std::size_t expired_ = 0;
+    std::size_t evicted_ = 0;
+  };
+
+  /**
+   * @brief Back-off applied to requests whose load callback failed. A failed request is answered with
+   * the cached error for \p initial_, doubled with every further failure up to \p max_. A request that
+   * has not failed for \p ttl_ is forgotten. A zero \p initial_ disables the cache.
+   */
+  struct FailureBackoff
+  {
+    std::chrono::milliseconds initial_ = std::chrono::milliseconds(0);
+    std::chrono::milliseconds max_ = std::chrono::milliseconds(30000);
+    std::chrono::milliseconds ttl_ = std::chrono::milliseconds(300000);
+  };
+
+  /**
+   * @brief Parts of the stored queries that a data fetch passes on. The part that is left out is passed
+   * on as an empty string.
+   */
+  enum class DataProjection
+  {
+    REQUEST_AND_RESPONSE,
+    REQUEST,
+    RESPONSE
+  };
+
+  /**
+   * @brief Receives the stored queries of a data fetch one at a time: the original query id, the
+   * serialized request and the serialized query.
+   */
+  typedef std::function<void(const UUID &id, const RawData &request, const RawData &response)> QuerySink;
+
+  /**
+   * @brief Changes of the queries of a server since a generation of the catalog. generation_ is the
+   * generation the changes lead up to and is passed as the starting point of the next delta. If reset_
+   * is set, changed_ holds the complete state instead, e.g. because the requested generation is older
+   * than the retained history.
+   */
+  struct DataDelta
+  {
+    std::uint64_t generation_ = 0;
+    bool reset_ = false;
+    std::vector<std::pair<UUID, std::pair<RawData, RawData>>> changed_;
+    std::vector<UUID> removed_;
+  };
+
   class RrCatalog
   {
 
@@ -97,9 +173,79 @@ namespace temoto_resource_registrar
     std::unordered_map<ServerName, std::set<UUID>> server_id_map_;
     std::unordered_map<RawData, QueryContainer<RawData>> id_query_map_;
     std::unordered_map<UUID, DependencyContainer> id_dependency_map_;
+    // query id - key of its container in id_query_map_. Derived from id_query_map_, not serialized
+    std::unordered_map<UUID, RawData> id_request_index_;
+
+    // resources released by all their requesters, most recently released first. Not serialized
+    struct LingeringQuery
+    {
+      QueryContainer<RawData> container_;
+      std::chrono::steady_clock::time_point expires_;
+      std::size_t bytes_;
+    };
+
+    std::unordered_map<ServerName, std::chrono::milliseconds> server_linger_;
+    std::list<LingeringQuery> lingering_;
+    // evicted from the pool, waiting to be claimed by takeReleasedLingering
+    std::vector<QueryContainer<RawData>> evicted_;
+    // claimed by takeReleasedLingering, waiting for their unload callback
+    std::unordered_map<UUID, QueryContainer<RawData>> releasing_;
+    WarmPoolLimits warm_pool_limits_;
+    WarmPoolStatistics warm_pool_statistics_;
+
+    // failed requests keyed by the digest of server and request. Not serialized
+    struct FailedRequest
+    {
+      ServerName server_;
+      RawData raw_request_;
+      std::string serialized_error_;
+      unsigned int failures_;
+      std::chrono::steady_clock::time_point retry_at_;
+      std::chrono::steady_clock::time_point expires_;
+    };
+
+    std::unordered_map<ServerName, FailureBackoff> server_backoff_;
+    std::unordered_map<std::size_t, FailedRequest> failed_requests_;
+
+    // latest change of every resource of a server, keyed by the generation it happened in. Removed
+    // resources are kept as tombstones until the limit is exceeded. Not serialized, a replaced catalog
+    // starts a new history
+    struct ResourceChange
+    {
+      UUID id_;
+      RrName origin_;
+      RawData request_;
+      bool removed_;
+    };
+
+    struct ServerHistory
+    {
+      std::map<std::uint64_t, ResourceChange> changes_;
+      std::unordered_map<UUID, std::uint64_t> latest_;
+      std::set<std::uint64_t> tombstones_;
+      // deltas since older generations miss pruned tombstones
+      std::uint64_t horizon_ = 0;
+    };
+
+    std::uint64_t generation_ = 0;
+    std::uint64_t history_horizon_ = 0;
+    std::unordered_map<ServerName, ServerHistory> histories_;
+    std::size_t tombstone_limit_ = 4096;
+
+    // created by the first subscription. Not serialized
+    std::shared_ptr<CatalogFeed> feed_;
+    std::size_t feed_capacity_ = 1 << 16;
 
     mutable std::recursive_mutex modify_mutex_;
 
+    static std::size_t requestDigest(const ServerName &server, const RawData &request_data);
+
+    void linger(const QueryContainer<RawData> &container, const std::chrono::milliseconds &period);
+    void rebuildIndex();
+    void recordChange(const ServerName &server, QueryContainer<RawData> &container, bool removed);
+    void resetHistory();
+    void publish(CatalogEvent::Type type, const std::string &server, const UUID &id, const UUID &related_id = "");
+
   public:
     RrCatalog() = default;
 
@@ -109,8 +255,59 @@ namespace temoto_resource_registrar
     RawData processExisting(const ServerName &server, const UUID &id, RrQueryBase q);
     UUID getInitialId(const UUID &id);
 
+    /**
+     * @brief Removes the reference \p id of a resource. \p unloadable is set when the resource has no
+     * references left and its unload callback has to be run. Resources of servers with a linger period
+     * are moved to the warm pool instead, where queryExists can revive them.
+     */
     RawData unload(const ServerName &server, const UUID &id, bool &unloadable);
 
+    /**
+     * @brief Keeps the resources of \p server loaded for \p period after their last requester released
+     * them. A zero period unloads them right away.
+     */
+    void setServerLinger(const ServerName &server, const std::chrono::milliseconds &period);
+    bool lingers(const ServerName &server);
+
+    void setWarmPoolLimits(const WarmPoolLimits &limits);
+    WarmPoolStatistics warmPoolStatistics();
+
+    /**
+     * @brief Takes the pooled resources whose linger period is over (or all of them if \p all is set),
+     * together with the ones evicted by the pool limits. Their original query ids can then be unloaded
+     * like any other query id, which runs the unload callback and releases their dependencies.
+     *
+     * @return original query ids
+     */
+    std::vector<UUID> takeReleasedLingering(bool all = false);
+
+    /**
+     * @brief Point in time when the next pooled resource expires, or the maximum time point if the pool
+     * is empty.
+     */
+    std::chrono::steady_clock::time_point nextLingerExpiry();
+
+    void setServerFailureBackoff(const ServerName &server, const FailureBackoff &backoff);
+
+    /**
+     * @brief Checks whether \p request_data failed recently enough to be answered without running the
+     * load callback again.
+     *
+     * @param error set to the cached error stack if true is returned
+     */
+    bool cachedFailure(const ServerName &server, const RawData &request_data, resource_registrar::TemotoErrorStack &error);
+
+    /**
+     * @brief Remembers a failed load of \p request_data and extends its back-off. Ignored for servers
+     * without a FailureBackoff.
+     */
+    void storeFailure(const ServerName &server, const RawData &request_data, const resource_registrar::TemotoErrorStack &error);
+
+    /**
+     * @brief Forgets the failures of \p server, e.g. because the missing hardware came back.
+     */
+    void clearFailures(const ServerName &server);
+
     ServerName getIdServer(const UUID &id);
     std::unordered_map<UUID, std::string> getAllQueryIds(const std::string &id);
 
@@ -129,6 +326,50 @@ namespace temoto_resource_registrar
     std::set<UUID> getClientIds(const ClientName &client);
     std::set<UUID> getServerIds(const ServerName &server);
 
+    /**
+     * @brief Passes the resources of \p server that were requested by \p origin_rr to \p sink, each resource
+     * once, no matter how many ids refer to it. Resources are visited in a stable order starting after
+     * \p cursor, and at most \p limit of them (0 is unlimited). Resources stored while paging may be
+     * missed if they sort before the cursor. \p sink runs with the catalog locked and must not call into it.
+     *
+     * @return cursor to continue from, or an empty string if all resources were visited.
+     * @throws ElementNotFoundException if the server has no resources.
+     */
+    std::string visitServerQueries(const ServerName &server,
+                                   const RrName &origin_rr,
+                                   const std::string &cursor,
+                                   std::size_t limit,
+                                   DataProjection projection,
+                                   const QuerySink &sink);
+
+    /**
+     * @brief Generation of the catalog, bumped by every modification.
+     */
+    std::uint64_t generation();
+
+    /**
+     * @brief Resources of \p server requested by \p origin_rr that were stored, revived or got a new
+     * response, and the ones that were removed, after generation \p since. A zero \p since fetches the
+     * complete state.
+     */
+    DataDelta fetchChanges(const ServerName &server, const RrName &origin_rr, std::uint64_t since, DataProjection projection);
+
+    /**
+     * @brief Number of removed resources per server whose removal is still reported by fetchChanges.
+     * Deltas that would miss a pruned removal are answered with the complete state.
+     */
+    void setTombstoneLimit(std::size_t limit);
+
+    /**
+     * @brief Subscribes to the modifications of the catalog from now on, see CatalogSubscription::poll.
+     */
+    CatalogSubscription subscribe();
+
+    /**
+     * @brief Size of the event ring in bytes. Takes effect if set before the first subscription.
+     */
+    void setFeedCapacity(std::size_t capacity);
+
     void storeServerRr(const ServerName &server, const RrName &rr);
     RrName getServerRr(const ServerName &server);
 
@@ -160,6 +401,7 @@ namespace temoto_resource_registrar
       server_id_map_ = std::move(other.server_id_map_);
       id_query_map_ = std::move(other.id_query_map_);
       id_dependency_map_ = std::move(other.id_dependency_map_);
+      id_request_index_ = std::move(other.id_request_index_);
       server_rr_ = std::move(other.server_rr_);
       //other.value = 0;
     }
@@ -172,6 +414,7 @@ namespace temoto_resource_registrar
       server_id_map_ = other.server_id_map_;
       id_query_map_ = other.id_query_map_;
       id_dependency_map_ = other.id_dependency_map_;
+      id_request_index_ = other.id_request_index_;
       server_rr_ = other.server_rr_;
     }
     // Move assignment
@@ -184,7 +427,9 @@ namespace temoto_resource_registrar
       server_id_map_ = std::move(other.server_id_map_);
       id_query_map_ = std::move(other.id_query_map_);
       id_dependency_map_ = std::move(other.id_dependency_map_);
+      id_request_index_ = std::move(other.id_request_index_);
       server_rr_ = std::move(other.server_rr_);
+      resetHistory();
       return *this;
     }
     // Copy assignment
@@ -197,7 +442,9 @@ namespace temoto_resource_registrar
       server_id_map_ = other.server_id_map_;
       id_query_map_ = other.id_query_map_;
       id_dependency_map_ = other.id_dependency_map_;
+      id_request_index_ = other.id_request_index_;
       server_rr_ = other.server_rr_;
+      resetHistory();
       return *this;
     }
 
@@ -210,6 +457,10 @@ namespace temoto_resource_registrar
     void serialize(Archive &ar, const unsigned int /* version */)
     {
       ar &server_id_map_ &client_id_map_ &id_query_map_ &id_dependency_map_ &server_rr_;
+      if (Archive::is_loading::value)
+      {
+        rebuildIndex();
+      }
     }
 
   private:
@@ -0,0 +1,126 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_CATALOG_FEED_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_CATALOG_FEED_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Modification of an RrCatalog, see RrCatalog::subscribe.
+   */
+  struct CatalogEvent
+  {
+    enum class Type : std::uint8_t
+    {
+      QUERY_STORED,       // a resource was loaded or revived from the warm pool
+      ID_ATTACHED,        // a query id was attached to an already loaded resource
+      RESPONSE_UPDATED,   // the response of a resource changed
+      ID_UNLOADED,        // a query id was released
+      DEPENDENCY_ADDED,   // a query started to depend on a query of another server
+      DEPENDENCY_REMOVED, // a dependency was released
+      CATALOG_REPLACED,   // the whole catalog was replaced, e.g. by updateCatalog
+      EVENTS_LOST         // the subscriber fell behind and missed events
+    };
+
+    Type type_ = Type::EVENTS_LOST;
+    // catalog generation after the modification, 0 for EVENTS_LOST
+    std::uint64_t generation_ = 0;
+    // server of the query, or the RR the dependency lives on for dependency events
+    std::string server_;
+    std::string id_;
+    // original query id of the resource for ID_ATTACHED and ID_UNLOADED, the dependency id for dependency
+    // events
+    std::string related_id_;
+  };
+
+  /**
+   * @brief Bounded broadcast ring of catalog events. There is a single writer at a time (the catalog
+   * publishes with its lock held) that never waits for readers. Readers keep their own cursors and only
+   * load from the ring, a reader that is overtaken by the writer detects it and skips ahead.
+   */
+  class CatalogFeed
+  {
+  public:
+    /**
+     * @param capacity size of the ring in bytes, an event takes roughly 40 bytes plus its strings
+     */
+    explicit CatalogFeed(std::size_t capacity = 1 << 16);
+
+    void publish(const CatalogEvent &event);
+
+    std::uint64_t head() const;
+
+    /**
+     * @brief Decodes the events after \p cursor, at most \p max_events of them (0 is unlimited), and moves
+     * the cursor past them.
+     *
+     * @return false if events after \p cursor were overwritten. The cursor is moved to the head then.
+     */
+    bool read(std::uint64_t &cursor, std::vector<CatalogEvent> &events, std::size_t max_events) const;
+
+  private:
+    std::size_t words_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> ring_;
+    // byte positions, only growing. reserved_ is moved past a record before it is written, head_ after
+    std::atomic<std::uint64_t> reserved_;
+    std::atomic<std::uint64_t> head_;
+    // encoding buffer of the writer
+    std::string record_;
+
+    std::atomic<std::uint64_t> &word(std::uint64_t position) const;
+  };
+
+  /**
+   * @brief Cursor of a single consumer into the event feed of a catalog. Not thread safe, but any number
+   * of subscriptions can be polled in parallel.
+   */
+  class CatalogSubscription
+  {
+  public:
+    CatalogSubscription() = default;
+    CatalogSubscription(std::shared_ptr<const CatalogFeed> feed, std::uint64_t cursor);
+
+    /**
+     * @brief Appends the events published since the previous poll to \p events, at most \p max_events of
+     * them (0 is unlimited). If events were lost because the subscriber fell behind, an EVENTS_LOST event
+     * is appended in their place, after which the consumer should rescan the catalog.
+     *
+     * @return number of appended events
+     */
+    std::size_t poll(std::vector<CatalogEvent> &events, std::size_t max_events = 0);
+
+    /**
+     * @brief How many times events were lost.
+     */
+    std::uint64_t overflows() const;
+
+  private:
+    std::shared_ptr<const CatalogFeed> feed_;
+    std::uint64_t cursor_ = 0;
+    std::uint64_t overflows_ = 0;
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
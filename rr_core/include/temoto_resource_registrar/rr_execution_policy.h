@@ -0,0 +1,153 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_EXECUTION_POLICY_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_EXECUTION_POLICY_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Describes how many queries a server may execute at the same time.
+   */
+  class ExecutionPolicy
+  {
+  public:
+    enum class Mode
+    {
+      INLINE,  // no limits, queries run as soon as they arrive
+      STRAND,  // queries of the server are executed one at a time
+      BOUNDED  // at most concurrency() queries of the server run at the same time
+    };
+
+    static ExecutionPolicy inlined() { return ExecutionPolicy(Mode::INLINE, 0); }
+
+    static ExecutionPolicy strand() { return ExecutionPolicy(Mode::STRAND, 1); }
+
+    static ExecutionPolicy bounded(std::size_t concurrency) { return ExecutionPolicy(Mode::BOUNDED, concurrency > 0 ? concurrency : 1); }
+
+    Mode mode() const { return mode_; }
+
+    std::size_t concurrency() const { return concurrency_; }
+
+  private:
+    ExecutionPolicy(Mode mode, std::size_t concurrency) : mode_(mode), concurrency_(concurrency){};
+
+    Mode mode_;
+    std::size_t concurrency_;
+  };
+
+  struct QueueMetrics
+  {
+    std::size_t admitted_ = 0;
+    std::size_t running_ = 0;
+    std::size_t queued_ = 0;
+    std::size_t max_queued_ = 0;
+    std::size_t expired_ = 0;
+    std::chrono::nanoseconds total_wait_ = std::chrono::nanoseconds(0);
+    std::chrono::nanoseconds max_wait_ = std::chrono::nanoseconds(0);
+  };
+
+  /**
+   * @brief Admits at most a fixed number of concurrent holders. Callers that do not fit are blocked until
+   * a holder leaves. Waiting callers are admitted by priority, then by the earliest deadline and finally in
+   * arrival order.
+   */
+  class AdmissionGate
+  {
+  public:
+    explicit AdmissionGate(std::size_t limit);
+
+    AdmissionGate(const AdmissionGate &) = delete;
+    AdmissionGate &operator=(const AdmissionGate &) = delete;
+
+    /**
+     * @brief Blocks until the caller is admitted.
+     *
+     * @param priority higher values are admitted first
+     * @param deadline the caller gives up waiting at this point in time, unless it is the epoch
+     * @return false if the deadline passed before the caller was admitted.
+     */
+    bool acquire(int priority = 0,
+                 const std::chrono::system_clock::time_point &deadline = std::chrono::system_clock::time_point());
+
+    void release();
+
+    QueueMetrics metrics() const;
+
+    /**
+     * @brief Holds the gate for the lifetime of the object. A NULL gate is never waited for.
+     */
+    class Admission
+    {
+    public:
+      Admission(AdmissionGate *gate,
+                int priority = 0,
+                const std::chrono::system_clock::time_point &deadline = std::chrono::system_clock::time_point())
+          : gate_(gate), admitted_(true)
+      {
+        if (gate_ != NULL)
+        {
+          admitted_ = gate_->acquire(priority, deadline);
+        }
+      }
+
+      ~Admission()
+      {
+        if (gate_ != NULL && admitted_)
+        {
+          gate_->release();
+        }
+      }
+
+      Admission(const Admission &) = delete;
+      Admission &operator=(const Admission &) = delete;
+
+      bool admitted() const { return admitted_; }
+
+    private:
+      AdmissionGate *gate_;
+      bool admitted_;
+    };
+
+  private:
+    struct Waiter
+    {
+      int priority_;
+      std::chrono::system_clock::time_point deadline_;
+      std::uint64_t sequence_;
+      bool admitted_;
+
+      bool precedes(const Waiter &other) const;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable admitted_cv_;
+    std::vector<Waiter *> waiters_;
+    std::size_t limit_;
+    std::uint64_t next_sequence_;
+    QueueMetrics metrics_;
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -0,0 +1,209 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_INLINE_FUNCTION_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_INLINE_FUNCTION_H
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace temoto_resource_registrar
+{
+  template <class Signature, std::size_t Capacity = 4 * sizeof(void *)>
+  class InlineFunction;
+
+  /**
+   * @brief Move-only callable wrapper which keeps the target in a fixed size inline buffer, so it never
+   * allocates. Targets larger than \p Capacity are rejected at compile time. Function pointers and
+   * std::function objects that are empty, as well as NULL, produce an empty InlineFunction.
+   *
+   * Calling an empty InlineFunction throws std::bad_function_call.
+   */
+  template <class R, class... Args, std::size_t Capacity>
+  class InlineFunction<R(Args...), Capacity>
+  {
+    template <class...>
+    struct Void
+    {
+      typedef void type;
+    };
+
+    template <class F, class = void>
+    struct IsCallable : std::false_type
+    {
+    };
+
+    template <class F>
+    struct IsCallable<F, typename Void<decltype(std::declval<F &>()(std::declval<Args>()...))>::type>
+        : std::true_type
+    {
+    };
+
+    template <class F>
+    using EnableIfTarget = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value &&
+                                                   IsCallable<typename std::decay<F>::type>::value>::type;
+
+  public:
+    InlineFunction() noexcept
+        : invoke_(&invokeEmpty), manage_(NULL){};
+
+    InlineFunction(std::nullptr_t) noexcept
+        : InlineFunction(){};
+
+    template <class F, class = EnableIfTarget<F>>
+    InlineFunction(F callable)
+        : InlineFunction()
+    {
+      typedef typename std::decay<F>::type Target;
+      static_assert(sizeof(Target) <= Capacity, "callable does not fit into the inline storage of InlineFunction");
+      static_assert(alignof(Target) <= alignof(Storage), "callable is over-aligned for InlineFunction");
+      static_assert(std::is_nothrow_move_constructible<Target>::value, "callable must be nothrow move constructible");
+
+      if (isEmpty(callable))
+      {
+        return;
+      }
+
+      new (&storage_) Target(std::move(callable));
+      invoke_ = &invokeTarget<Target>;
+      manage_ = &manageTarget<Target>;
+    }
+
+    InlineFunction(InlineFunction &&other) noexcept
+        : InlineFunction()
+    {
+      moveFrom(other);
+    }
+
+    InlineFunction &operator=(InlineFunction &&other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        moveFrom(other);
+      }
+      return *this;
+    }
+
+    InlineFunction &operator=(std::nullptr_t) noexcept
+    {
+      reset();
+      return *this;
+    }
+
+    InlineFunction(const InlineFunction &) = delete;
+    InlineFunction &operator=(const InlineFunction &) = delete;
+
+    ~InlineFunction()
+    {
+      reset();
+    }
+
+    R operator()(Args... args) const
+    {
+      return invoke_(const_cast<Storage *>(&storage_), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept
+    {
+      return manage_ != NULL;
+    }
+
+    friend bool operator==(const InlineFunction &function, std::nullptr_t) noexcept { return !function; }
+    friend bool operator==(std::nullptr_t, const InlineFunction &function) noexcept { return !function; }
+    friend bool operator!=(const InlineFunction &function, std::nullptr_t) noexcept { return bool(function); }
+    friend bool operator!=(std::nullptr_t, const InlineFunction &function) noexcept { return bool(function); }
+
+  private:
+    typedef typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type Storage;
+
+    // moves the target from the first buffer into the second one (if given) and destroys the original
+    typedef void (*ManageFn)(void *, void *);
+    typedef R (*InvokeFn)(void *, Args &&...);
+
+    Storage storage_;
+    InvokeFn invoke_;
+    ManageFn manage_;
+
+    void reset() noexcept
+    {
+      if (manage_ != NULL)
+      {
+        manage_(&storage_, NULL);
+      }
+      invoke_ = &invokeEmpty;
+      manage_ = NULL;
+    }
+
+    void moveFrom(InlineFunction &other) noexcept
+    {
+      if (other.manage_ != NULL)
+      {
+        other.manage_(&other.storage_, &storage_);
+        invoke_ = other.invoke_;
+        manage_ = other.manage_;
+        other.invoke_ = &invokeEmpty;
+        other.manage_ = NULL;
+      }
+    }
+
+    template <class Target>
+    static R invokeTarget(void *storage, Args &&... args)
+    {
+      return (*static_cast<Target *>(storage))(std::forward<Args>(args)...);
+    }
+
+    static R invokeEmpty(void *, Args &&...)
+    {
+      throw std::bad_function_call();
+    }
+
+    template <class Target>
+    static void manageTarget(void *from, void *to)
+    {
+      Target *source = static_cast<Target *>(from);
+      if (to != NULL)
+      {
+        new (to) Target(std::move(*source));
+      }
+      source->~Target();
+    }
+
+    template <class F>
+    static bool isEmpty(const F &)
+    {
+      return false;
+    }
+
+    template <class Ret, class... A>
+    static bool isEmpty(Ret (*const &function)(A...))
+    {
+      return function == NULL;
+    }
+
+    template <class Signature>
+    static bool isEmpty(const std::function<Signature> &function)
+    {
+      return !function;
+    }
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -0,0 +1,96 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_LEASE_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_LEASE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Expiry times of leased query ids, kept in a hierarchical timing wheel. Granting, renewing and
+   * dropping a lease are O(1) and advancing the wheel only touches the slots that come due, so a large
+   * number of leases is expired without scanning them. Not thread safe.
+   */
+  class LeaseWheel
+  {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit LeaseWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(100),
+                        Clock::time_point start = Clock::now());
+
+    /**
+     * @brief Grants a lease on \p id, or extends it, so that it expires \p ttl after \p now.
+     */
+    void renew(const std::string &id, std::chrono::milliseconds ttl, Clock::time_point now = Clock::now());
+
+    /**
+     * @return false if \p id is not leased.
+     */
+    bool remove(const std::string &id);
+
+    bool contains(const std::string &id) const;
+
+    std::size_t size() const;
+
+    /**
+     * @brief Moves the wheel forward to \p now.
+     *
+     * @return ids whose lease expired
+     */
+    std::vector<std::string> advance(Clock::time_point now);
+
+    /**
+     * @brief Point in time when advancing the wheel can expire leases next.
+     */
+    Clock::time_point nextTick() const;
+
+  private:
+    static constexpr unsigned int SLOT_BITS = 6;
+    static constexpr std::size_t SLOT_COUNT = 1 << SLOT_BITS;
+    static constexpr std::size_t LEVEL_COUNT = 4;
+
+    struct Lease
+    {
+      std::uint64_t expiry_tick_;
+      std::uint64_t generation_;
+    };
+
+    // renewing a lease leaves its previous slot entry behind, it is skipped by the generation check
+    typedef std::vector<std::pair<std::string, std::uint64_t>> Slot;
+
+    const std::chrono::milliseconds tick_;
+    const Clock::time_point start_;
+    std::uint64_t current_tick_;
+    std::uint64_t next_generation_;
+    std::array<std::array<Slot, SLOT_COUNT>, LEVEL_COUNT> levels_;
+    std::unordered_map<std::string, Lease> leases_;
+
+    void place(const std::string &id, const Lease &lease);
+    void cascade(std::size_t level);
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
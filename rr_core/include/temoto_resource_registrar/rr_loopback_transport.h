@@ -0,0 +1,173 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_LOOPBACK_TRANSPORT_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_LOOPBACK_TRANSPORT_H
+
+#include "rr_transport.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Simulated conditions of a link between two loopback endpoints. A frame is delivered after
+   * latency_ plus a random delay of up to jitter_, once the link has transmitted it at bandwidth_
+   * bytes per second. A zero bandwidth is unlimited.
+   */
+  struct LinkProfile
+  {
+    std::chrono::microseconds latency_ = std::chrono::microseconds(0);
+    std::chrono::microseconds jitter_ = std::chrono::microseconds(0);
+    std::uint64_t bandwidth_ = 0;
+  };
+
+  /**
+   * @brief Timing of a single frame that went through a LoopbackNetwork. injected_ is the delay planned
+   * by the network, measured_ the time between sending and handing the frame to its target.
+   */
+  struct HopTiming
+  {
+    std::string from_;
+    std::string to_;
+    TransportMessage type_;
+    TransportFrame::Kind kind_;
+    std::size_t bytes_;
+    std::chrono::microseconds injected_;
+    std::chrono::microseconds measured_;
+  };
+
+  class LoopbackTransport;
+
+  /**
+   * @brief In-process network connecting LoopbackTransport endpoints. Frames are delivered by a
+   * single thread in the order of their delivery times, and the frames of a link never overtake each
+   * other. The jitter comes from a generator seeded with \p seed, so the same sequence of frames
+   * experiences the same delays on every run.
+   */
+  class LoopbackNetwork
+  {
+  public:
+    explicit LoopbackNetwork(std::uint64_t seed = 0);
+
+    ~LoopbackNetwork();
+
+    LoopbackNetwork(const LoopbackNetwork &) = delete;
+    LoopbackNetwork &operator=(const LoopbackNetwork &) = delete;
+
+    /**
+     * @brief Sets the profile of the links that have no profile of their own.
+     */
+    void setLinkProfile(const LinkProfile &profile);
+
+    /**
+     * @brief Sets the profile of the link from the endpoint \p from to the endpoint \p to.
+     */
+    void setLinkProfile(const std::string &from, const std::string &to, const LinkProfile &profile);
+
+    std::vector<HopTiming> hopTimings() const;
+
+    void clearHopTimings();
+
+  private:
+    friend class LoopbackTransport;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Delivery
+    {
+      Clock::time_point deliver_at_;
+      std::uint64_t sequence_;
+      Clock::time_point sent_at_;
+      std::string from_;
+      std::string target_;
+      std::string data_;
+
+      bool operator>(const Delivery &other) const
+      {
+        return deliver_at_ != other.deliver_at_ ? deliver_at_ > other.deliver_at_ : sequence_ > other.sequence_;
+      }
+    };
+
+    struct Link
+    {
+      // when the link has finished transmitting its last frame, and when that frame arrives
+      Clock::time_point idle_at_;
+      Clock::time_point last_delivery_;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable delivery_cv_;
+    std::mt19937_64 random_;
+    LinkProfile default_profile_;
+    std::map<std::pair<std::string, std::string>, LinkProfile> profiles_;
+    std::map<std::pair<std::string, std::string>, Link> links_;
+    std::priority_queue<Delivery, std::vector<Delivery>, std::greater<Delivery>> deliveries_;
+    std::uint64_t next_sequence_;
+    std::vector<HopTiming> hop_timings_;
+    bool stopping_;
+
+    std::mutex endpoints_mutex_;
+    std::condition_variable delivered_cv_;
+    std::unordered_map<std::string, LoopbackTransport *> endpoints_;
+    // the endpoint a frame is being handed to, delivered without endpoints_mutex_ as it may send a reply
+    LoopbackTransport *delivering_;
+
+    std::thread delivery_thread_;
+
+    void attach(LoopbackTransport *endpoint);
+    void detach(LoopbackTransport *endpoint);
+    void transmit(const std::string &from, const std::string &target, std::string data);
+    void deliveryLoop();
+  };
+
+  /**
+   * @brief Endpoint on a LoopbackNetwork. Frames are encoded and decoded like on the other transports,
+   * so the measured costs include the serialization of the queries.
+   */
+  class LoopbackTransport : public Transport
+  {
+  public:
+    LoopbackTransport(const std::string &name, const std::shared_ptr<LoopbackNetwork> &network);
+
+    ~LoopbackTransport();
+
+  protected:
+    void send(const std::string &target, const TransportFrame &frame) override;
+
+  private:
+    friend class LoopbackNetwork;
+
+    std::shared_ptr<LoopbackNetwork> network_;
+
+    void deliver(TransportFrame frame);
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -17,11 +17,16 @@
 #ifndef TEMOTO_RESOURCE_REGISTRAR__RR_QUERY_BASE_H
 #define TEMOTO_RESOURCE_REGISTRAR__RR_QUERY_BASE_H
 
+#include "rr_cancellation.h"
 #include "rr_query_request.h"
 #include "rr_query_response.h"
 #include "temoto_error.h"
 #include <boost/serialization/access.hpp>
 #include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/version.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <unordered_map>
@@ -33,6 +38,7 @@ namespace temoto_resource_registrar
   public:
 
     resource_registrar::TemotoErrorStack& errorStack() { return error_stack_; }
+    const resource_registrar::TemotoErrorStack& errorStack() const { return error_stack_; }
 
   protected:
     friend class boost::serialization::access;
@@ -53,21 +59,70 @@ namespace temoto_resource_registrar
     typedef std::unordered_map<std::string, std::string> SpanContextType;
 
     SpanContextType &getSpanContext() { return span_context_; }
+    const SpanContextType &getSpanContext() const { return span_context_; }
 
     void setSpanContext(SpanContextType span_context) { span_context_ = span_context; }
 
+    /**
+     * @brief Queries with a higher priority are admitted first when a server is saturated.
+     */
+    void setPriority(int priority) { priority_ = priority; }
+    int priority() const { return priority_; }
+
+    /**
+     * @brief Queries that are still waiting for execution when the deadline passes fail without running.
+     * The deadline is kept in wall clock time, so it stays meaningful when the query is sent to another process.
+     */
+    void setDeadline(const std::chrono::system_clock::time_point &deadline)
+    {
+      deadline_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(deadline.time_since_epoch()).count();
+    }
+
+    void clearDeadline() { deadline_ms_ = 0; }
+
+    bool hasDeadline() const { return deadline_ms_ != 0; }
+
+    std::chrono::system_clock::time_point deadline() const
+    {
+      return std::chrono::system_clock::time_point(std::chrono::milliseconds(deadline_ms_));
+    }
+
+    bool deadlineExpired() const
+    {
+      return hasDeadline() && deadline() <= std::chrono::system_clock::now();
+    }
+
+    /**
+     * @brief Applies the scheduling constraints of the query \p parent, which this query is a dependency of.
+     * The higher priority and the earlier deadline win.
+     */
+    void inherit(const RequestMetadata &parent)
+    {
+      priority_ = std::max(priority_, parent.priority_);
+      if (parent.hasDeadline() && (!hasDeadline() || parent.deadline_ms_ < deadline_ms_))
+      {
+        deadline_ms_ = parent.deadline_ms_;
+      }
+    }
+
   protected:
     friend class boost::serialization::access;
 
     template <class Archive>
-    void serialize(Archive &ar, const unsigned int /* version */)
+    void serialize(Archive &ar, const unsigned int version)
     {
       ar &span_context_;
+      if (version > 0)
+      {
+        ar &priority_ &deadline_ms_;
+      }
     }
 
   private:
     resource_registrar::TemotoErrorStack error_stack_;
     SpanContextType span_context_;
+    int priority_ = 0;
+    std::int64_t deadline_ms_ = 0;
   };
 
   class RrQueryBase
@@ -95,9 +150,20 @@ namespace temoto_resource_registrar
 
     void setRequestMetadata(RequestMetadata metadata) { request_metadata_ = metadata; };
     RequestMetadata &requestMetadata() { return request_metadata_; }
+    const RequestMetadata &requestMetadata() const { return request_metadata_; }
+
+    /**
+     * @brief Token that tells a running load callback to give up. It is shared by the copies of the query
+     * and is not serialized.
+     */
+    void setCancellationToken(const CancellationToken::Ptr &token) { cancellation_token_ = token; }
+    const CancellationToken::Ptr &cancellationToken() const { return cancellation_token_; }
+
+    bool cancelled() const { return cancellation_token_ && cancellation_token_->isCancelled(); }
 
     void setResponseMetadata(ResponseMetadata metadata) { response_metadata_ = metadata; };
     ResponseMetadata &responseMetadata() { return response_metadata_; }
+    const ResponseMetadata &responseMetadata() const { return response_metadata_; }
 
   protected:
     std::string request_id_;
@@ -109,6 +175,8 @@ namespace temoto_resource_registrar
     RequestMetadata request_metadata_;
     ResponseMetadata response_metadata_;
 
+    CancellationToken::Ptr cancellation_token_;
+
     friend class boost::serialization::access;
 
     template <class Archive>
@@ -122,4 +190,6 @@ namespace temoto_resource_registrar
 
 } // namespace temoto_resource_registrar
 
+BOOST_CLASS_VERSION(temoto_resource_registrar::RequestMetadata, 1)
+
 #endif
\ No newline at end of file
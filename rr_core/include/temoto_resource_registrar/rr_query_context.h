@@ -0,0 +1,131 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_QUERY_CONTEXT_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_QUERY_CONTEXT_H
+
+#include "rr_query_base.h"
+#include "temoto_resource_registrar/temoto_logging.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Describes the query whose load callback is being executed. Calls made while a context is
+   * active are registered as dependencies of its query.
+   *
+   * The active context is kept per thread and nests like a stack. Work that is handed over to other
+   * threads (thread pools, std::async, ...) carries the context along via QueryContext::bind or by
+   * installing a QueryContext::Scope with a context obtained from QueryContext::current().
+   */
+  class QueryContext
+  {
+  public:
+    typedef std::shared_ptr<const QueryContext> Ptr;
+
+    QueryContext(const std::string &rr,
+                 const RrQueryBase &query,
+                 const Ptr &parent = Ptr(),
+                 bool rollback_deferred = false)
+        : rr_(rr), query_(query), parent_(parent), rollback_deferred_(rollback_deferred){};
+
+    /**
+     * @brief Name of the RR whose server is executing the query.
+     */
+    const std::string &rr() const { return rr_; }
+
+    const RrQueryBase &query() const { return query_; }
+
+    const Ptr &parent() const { return parent_; }
+
+    /**
+     * @brief If set, a failing nested call does not unload the dependencies of the query right away. The
+     * code that installed the context (e.g. RrBase::callAll) takes care of the rollback.
+     */
+    bool rollbackDeferred() const { return rollback_deferred_; }
+
+    static Ptr current() { return active(); }
+
+    static void push(const std::string &rr, const RrQueryBase &query)
+    {
+      active() = std::make_shared<const QueryContext>(rr, query, active());
+    }
+
+    static void pop(const std::string &query_id)
+    {
+      if (active() && active()->query().id() == query_id)
+      {
+        active() = active()->parent();
+      }
+    }
+
+    /**
+     * @brief Installs a context on the current thread for the lifetime of the scope.
+     */
+    class Scope
+    {
+    public:
+      explicit Scope(const Ptr &context) : previous_(active())
+      {
+        active() = context;
+      }
+
+      ~Scope()
+      {
+        active() = previous_;
+      }
+
+      Scope(const Scope &) = delete;
+      Scope &operator=(const Scope &) = delete;
+
+    private:
+      Ptr previous_;
+    };
+
+    /**
+     * @brief Wraps \p callable so that it runs with the context that is active at the time of binding,
+     * regardless of the thread it is eventually executed on. The tracing span context is carried along
+     * as well.
+     */
+    template <class Callable>
+    static auto bind(Callable callable)
+    {
+      Ptr context = current();
+      return temoto_logging::bindSpanContext([context, callable](auto &&... args) mutable {
+        Scope scope(context);
+        return callable(std::forward<decltype(args)>(args)...);
+      });
+    }
+
+  private:
+    std::string rr_;
+    RrQueryBase query_;
+    Ptr parent_;
+    bool rollback_deferred_;
+
+    static Ptr &active()
+    {
+      static thread_local Ptr active_context;
+      return active_context;
+    }
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
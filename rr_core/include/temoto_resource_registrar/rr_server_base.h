@@ -20,9 +20,12 @@
 #include "rr_catalog.h"
 #include "rr_client_base.h"
 #include "rr_exceptions.h"
+#include "rr_execution_policy.h"
 #include "rr_id_utils.h"
 #include "rr_identifiable.h"
+#include "rr_inline_function.h"
 #include "rr_query_base.h"
+#include "rr_watchdog.h"
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
@@ -46,14 +49,29 @@ namespace temoto_resource_registrar
   {
 
   public:
-    RrServerBase(const std::string &name, void (*loadCallback)(RrQueryBase &), void (*unLoadCallback)(RrQueryBase &))
-        : name_(name), load_callback_ptr_(loadCallback), unload_callback_ptr_(unLoadCallback){};
+    typedef InlineFunction<void(RrQueryBase &)> QueryCallback;
+    typedef InlineFunction<void(const TransactionInfo &)> TransactionCallback;
+
+    /**
+     * @brief Callbacks can be function pointers, lambdas or other callables that fit the inline storage of
+     * InlineFunction. NULL leaves the callback unset.
+     */
+    RrServerBase(const std::string &name, QueryCallback loadCallback, QueryCallback unLoadCallback)
+        : name_(name), load_callback_ptr_(std::move(loadCallback)), unload_callback_ptr_(std::move(unLoadCallback)){};
+
+    RrServerBase(const RrServerBase &) = delete;
+    RrServerBase &operator=(const RrServerBase &) = delete;
 
     std::string id() const
     {
       return id_;
     };
 
+    std::string name() const
+    {
+      return name_;
+    }
+
     void initializeServer(const std::string &rr, const RrCatalogPtr &reg)
     {
       id_ = IDUtils::generateServerName(rr, name_);
@@ -70,9 +88,77 @@ namespace temoto_resource_registrar
 
     virtual bool unloadMessage(const std::string &id) = 0;
 
-    void registerTransactionCb(std::function<void(const TransactionInfo &)> callback)
+    void registerTransactionCb(TransactionCallback callback)
+    {
+      transaction_callback_ptr_ = std::move(callback);
+    }
+
+    /**
+     * @brief Limits the number of concurrently executed queries of the server. Has to be set before the
+     * server is registered in an RR.
+     */
+    void setExecutionPolicy(const ExecutionPolicy &policy)
+    {
+      execution_policy_ = policy;
+    }
+
+    const ExecutionPolicy &executionPolicy() const
+    {
+      return execution_policy_;
+    }
+
+    /**
+     * @brief Sets the time limits of the load callbacks. Has to be set before the server is registered in an RR.
+     */
+    void setLoadTimeouts(const LoadTimeouts &timeouts)
     {
-      transaction_callback_ptr_ = callback;
+      load_timeouts_ = timeouts;
+    }
+
+    const LoadTimeouts &loadTimeouts() const
+    {
+      return load_timeouts_;
+    }
+
+    /**
+     * @brief Keeps a resource loaded for \p period after its last requester released it, so that an
+     * identical request arriving in the meantime reuses it without running the load callback. Has to be
+     * set before the server is registered in an RR.
+     */
+    void setLinger(const std::chrono::milliseconds &period)
+    {
+      linger_ = period;
+    }
+
+    const std::chrono::milliseconds &linger() const
+    {
+      return linger_;
+    }
+
+    /**
+     * @brief Answers requests whose load callback failed recently with the cached error instead of running
+     * the callback again. Has to be set before the server is registered in an RR. Only takes effect for
+     * processQuery implementations that run their load callback through loadWithBackoff.
+     */
+    void setFailureBackoff(const FailureBackoff &backoff)
+    {
+      failure_backoff_ = backoff;
+    }
+
+    const FailureBackoff &failureBackoff() const
+    {
+      return failure_backoff_;
+    }
+
+    /**
+     * @brief Forgets the cached failures of the server, so the next requests run the load callback again.
+     */
+    void signalRecovery()
+    {
+      if (rr_catalog_)
+      {
+        rr_catalog_->clearFailures(id_);
+      }
     }
 
     virtual void triggerCallback(const Status &status) const {
@@ -88,18 +174,54 @@ namespace temoto_resource_registrar
     std::string id_;
     bool initialized_ = false;
 
-    void (*load_callback_ptr_)(RrQueryBase &);
-    void (*unload_callback_ptr_)(RrQueryBase &);
+    QueryCallback load_callback_ptr_;
+    QueryCallback unload_callback_ptr_;
 
-    std::function<void(const TransactionInfo &)> transaction_callback_ptr_;
+    TransactionCallback transaction_callback_ptr_;
 
     std::string generateId() const
     {
       return boost::uuids::to_string(boost::uuids::random_generator()());
     }
 
+    /**
+     * @brief Runs \p load for \p request_data unless the request failed recently, in which case the cached
+     * error is appended to the response of \p query instead. A TemotoErrorStack thrown by \p load is
+     * remembered for the failure back-off, unless \p query was cancelled, and rethrown.
+     *
+     * @return false if \p load was skipped because of a cached failure
+     */
+    template <class Load>
+    bool loadWithBackoff(const std::string &request_data, RrQueryBase &query, Load load) const
+    {
+      resource_registrar::TemotoErrorStack cached_error;
+      if (rr_catalog_->cachedFailure(id_, request_data, cached_error))
+      {
+        query.responseMetadata().errorStack().appendError(cached_error);
+        return false;
+      }
+
+      try
+      {
+        load();
+      }
+      catch (const resource_registrar::TemotoErrorStack &e)
+      {
+        if (!query.cancelled())
+        {
+          rr_catalog_->storeFailure(id_, request_data, e);
+        }
+        throw;
+      }
+      return true;
+    }
+
   private:
     std::string name_;
+    ExecutionPolicy execution_policy_ = ExecutionPolicy::inlined();
+    LoadTimeouts load_timeouts_;
+    std::chrono::milliseconds linger_ = std::chrono::milliseconds(0);
+    FailureBackoff failure_backoff_;
   };
 
 } // namespace temoto_resource_registrar
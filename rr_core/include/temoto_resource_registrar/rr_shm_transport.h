@@ -0,0 +1,94 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_SHM_TRANSPORT_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_SHM_TRANSPORT_H
+
+#include "rr_transport.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Transport between RRs running as processes on the same host. Every endpoint owns an inbox,
+   * a ring buffer in the POSIX shared memory object "/temoto_rr_<name>", which the other endpoints write
+   * their frames into. Frames larger than the ring are streamed through it in parts. The reader and
+   * blocked writers are woken up with futexes.
+   */
+  class ShmTransport : public Transport
+  {
+  public:
+    /**
+     * @param name of the RR served by this endpoint
+     * @param capacity size of the inbox in bytes
+     * @throws resource_registrar::TemotoErrorStack if the inbox of \p name belongs to a running endpoint.
+     * An inbox left behind by an endpoint that exited is taken over.
+     */
+    explicit ShmTransport(const std::string &name, std::size_t capacity = 1 << 20);
+
+    ~ShmTransport();
+
+  protected:
+    void send(const std::string &target, const TransportFrame &frame) override;
+
+  private:
+    // header of the ring buffer, followed by its data in the shared memory object
+    struct Ring;
+
+    struct Mapping
+    {
+      Ring *ring_;
+      std::size_t size_;
+      ino_t inode_;
+    };
+
+    static std::string segmentName(const std::string &rr);
+
+    // process that created the inbox \p segment, 0 while the inbox is missing or not initialized
+    static pid_t inboxOwner(const std::string &segment);
+
+    static bool processAlive(pid_t pid);
+
+    Mapping inbox_;
+    std::string inbox_name_;
+
+    std::mutex peers_mutex_;
+    std::unordered_map<std::string, Mapping> peers_;
+    std::vector<Mapping> retired_peers_;
+
+    std::atomic<bool> stopping_;
+    std::thread receiver_;
+
+    Mapping openPeer(const std::string &target);
+
+    // drops \p mapping of \p target if the inbox it maps was replaced, returns whether it was
+    bool retireReplacedPeer(const std::string &target, const Mapping &mapping);
+
+    // publishes \p size bytes as the reader frees space, false once the reader stopped taking them
+    static bool stream(Ring &ring, const char *data, std::size_t size);
+    void receiveLoop();
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -0,0 +1,123 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_THREAD_POOL_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Fixed size work-stealing thread pool. Every worker owns a task queue; tasks submitted from a
+   * worker go to its own queue and idle workers steal from the others.
+   */
+  class ThreadPool
+  {
+  public:
+    typedef std::function<void()> Task;
+
+    explicit ThreadPool(std::size_t thread_count);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(Task task);
+
+    /**
+     * @brief Executes one queued task on the calling thread.
+     *
+     * @return false if there was nothing to execute.
+     */
+    bool runPendingTask();
+
+    std::size_t size() const;
+
+    /**
+     * @brief Process wide pool used by the registrars.
+     */
+    static ThreadPool &shared();
+
+  private:
+    struct WorkQueue
+    {
+      std::mutex mutex_;
+      std::deque<Task> tasks_;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<std::size_t> pending_;
+    std::atomic<std::size_t> next_queue_;
+    bool stopping_;
+
+    bool popTask(std::size_t start_index, Task &task);
+
+    void workerLoop(std::size_t index);
+  };
+
+  /**
+   * @brief Fork-join helper on top of a ThreadPool. The waiting thread helps executing queued tasks, so
+   * groups can be nested inside tasks of the same pool.
+   */
+  class TaskGroup
+  {
+  public:
+    explicit TaskGroup(ThreadPool &pool);
+
+    /**
+     * @brief Waits for the outstanding tasks. Errors that were not collected by wait() are dropped.
+     */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    void run(ThreadPool::Task task);
+
+    /**
+     * @brief Blocks until all tasks of the group have finished and rethrows the first error one of them
+     * raised.
+     */
+    void wait();
+
+  private:
+    ThreadPool &pool_;
+
+    std::mutex mutex_;
+    std::condition_variable done_cv_;
+    std::size_t outstanding_;
+    std::exception_ptr first_error_;
+
+    void join();
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -0,0 +1,239 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_TRANSPORT_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_TRANSPORT_H
+
+#include "rr_client_base.h"
+#include "rr_query_base.h"
+#include "rr_serializer.h"
+#include "rr_status.h"
+#include "temoto_error.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Requests that RRs send to each other over a Transport.
+   */
+  enum class TransportMessage : std::uint8_t
+  {
+    CALL,            // query to a server of the target RR
+    STATUS,          // status of a resource for the queries subscribed to it
+    UNLOAD,          // release of query ids served by the target RR
+    DATA_FETCH,      // queries of a server that originate from the requesting RR
+    DATA_FETCH_PAGE, // bounded page of the DATA_FETCH result
+    DATA_DELTA       // changes of the DATA_FETCH result since a catalog generation
+  };
+
+  /**
+   * @brief Length prefixed binary encoding of the fields of a message. Fields are read back in the order
+   * they were written.
+   */
+  class PayloadWriter
+  {
+  public:
+    PayloadWriter &put(std::uint32_t value);
+    PayloadWriter &put(std::uint64_t value);
+    PayloadWriter &put(const std::string &value);
+    PayloadWriter &put(const std::vector<std::string> &values);
+    PayloadWriter &put(const Status &status);
+
+    const std::string &str() const { return data_; }
+
+  private:
+    std::string data_;
+  };
+
+  class PayloadReader
+  {
+  public:
+    explicit PayloadReader(std::string data) : data_(std::move(data)), offset_(0){};
+
+    /**
+     * @throws resource_registrar::TemotoErrorStack if the payload ends before the field does.
+     */
+    PayloadReader &get(std::uint32_t &value);
+    PayloadReader &get(std::uint64_t &value);
+    PayloadReader &get(std::string &value);
+    PayloadReader &get(std::vector<std::string> &values);
+    PayloadReader &get(Status &status);
+
+  private:
+    std::string data_;
+    std::size_t offset_;
+
+    void take(void *destination, std::size_t size);
+  };
+
+  /**
+   * @brief Unit of data moved by the transports that exchange bytes.
+   */
+  struct TransportFrame
+  {
+    enum class Kind : std::uint8_t
+    {
+      REQUEST,
+      RESPONSE,
+      FAILURE // payload is the serialized TemotoErrorStack of the failed request
+    };
+
+    Kind kind_ = Kind::REQUEST;
+    TransportMessage type_ = TransportMessage::CALL;
+    std::uint64_t request_id_ = 0;
+    std::string sender_;
+    std::string payload_;
+
+    /**
+     * @brief Appends the frame, prefixed with its length, to \p buffer.
+     */
+    void encode(std::string &buffer) const;
+
+    std::size_t encodedSize() const;
+
+    /**
+     * @brief Decodes the frame at the front of \p data.
+     *
+     * @return number of consumed bytes, or 0 if \p data does not hold a complete frame yet.
+     * @throws resource_registrar::TemotoErrorStack if the frame is malformed.
+     */
+    static std::size_t decode(const char *data, std::size_t size, TransportFrame &frame);
+  };
+
+  /**
+   * @brief Endpoint of an RR for exchanging requests with RRs that are not reachable in-process. The
+   * base class pairs requests with their responses and runs the handler of incoming requests, the
+   * implementations only move frames between endpoints. Endpoints are addressed by RR name.
+   */
+  class Transport
+  {
+  public:
+    typedef std::function<std::string(TransportMessage type, const std::string &payload)> Handler;
+
+    explicit Transport(const std::string &name);
+
+    virtual ~Transport();
+
+    Transport(const Transport &) = delete;
+    Transport &operator=(const Transport &) = delete;
+
+    const std::string &name() const;
+
+    /**
+     * @brief Installs the handler of incoming requests. Every request is handled on a thread of its own,
+     * since handlers may block on nested requests. Passing NULL waits until the running handlers have
+     * returned. Implementations call serve(NULL) first thing in their destructor.
+     */
+    void serve(Handler handler);
+
+    void setRequestTimeout(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Sends a request to the RR \p target and blocks until its response arrives.
+     *
+     * @throws resource_registrar::TemotoErrorStack if the request failed on either side or timed out.
+     */
+    std::string request(const std::string &target, TransportMessage type, const std::string &payload);
+
+  protected:
+    /**
+     * @brief Delivers \p frame to the endpoint of \p target.
+     *
+     * @throws resource_registrar::TemotoErrorStack if the endpoint is not reachable.
+     */
+    virtual void send(const std::string &target, const TransportFrame &frame) = 0;
+
+    /**
+     * @brief Hands a frame that arrived at this endpoint over to the transport.
+     */
+    void receive(TransportFrame frame);
+
+    void failPendingRequests(const std::string &reason);
+
+  private:
+    std::string name_;
+    std::chrono::milliseconds request_timeout_;
+
+    std::mutex handler_mutex_;
+    std::condition_variable handlers_done_cv_;
+    Handler handler_;
+    std::size_t running_handlers_;
+
+    std::mutex pending_mutex_;
+    std::uint64_t next_request_id_;
+    std::unordered_map<std::uint64_t, std::promise<TransportFrame>> pending_;
+
+    void dispatch(TransportFrame request, Handler handler);
+  };
+
+  /**
+   * @brief Client that forwards its queries over the transport of the RR. The target RR has to expose
+   * the server with RrBase::serveRemote.
+   */
+  class TransportClient : public RrClientBase
+  {
+  public:
+    TransportClient(const std::string &rr, const std::string &name) : RrClientBase(rr, name){};
+
+    void setTransport(const std::shared_ptr<Transport> &transport)
+    {
+      transport_ = transport;
+    }
+
+    template <class QueryType>
+    void invoke(QueryType &query) const
+    {
+      if (!transport_)
+      {
+        throw resource_registrar::TemotoErrorStack("no transport to reach '" + rr_ + "'", id());
+      }
+
+      std::string response = transport_->request(rr_,
+                                                 TransportMessage::CALL,
+                                                 PayloadWriter()
+                                                     .put(id())
+                                                     .put(Serializer::serialize<RrQueryBase>(query))
+                                                     .put(Serializer::serialize<QueryType>(query))
+                                                     .str());
+
+      std::string base_data;
+      std::string typed_data;
+      PayloadReader(response).get(base_data).get(typed_data);
+
+      // the cancellation token is local to this process
+      CancellationToken::Ptr token = query.cancellationToken();
+      query = Serializer::deserialize<QueryType>(typed_data);
+      static_cast<RrQueryBase &>(query) = Serializer::deserialize<RrQueryBase>(base_data);
+      query.setCancellationToken(token);
+    }
+
+  private:
+    std::shared_ptr<Transport> transport_;
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
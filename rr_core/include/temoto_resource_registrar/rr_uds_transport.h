@@ -0,0 +1,126 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_UDS_TRANSPORT_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_UDS_TRANSPORT_H
+
+#include "rr_transport.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Counters of a UdsTransport. frames_sent_ / writes_ is the average number of frames coalesced
+   * into a single write.
+   */
+  struct UdsStatistics
+  {
+    std::uint64_t frames_sent_ = 0;
+    std::uint64_t writes_ = 0;
+    std::uint64_t frames_received_ = 0;
+    std::uint64_t reads_ = 0;
+    std::uint64_t connections_ = 0;
+  };
+
+  /**
+   * @brief Transport between RRs over Unix domain sockets, for processes that cannot share memory. Every
+   * endpoint listens on "<directory>/temoto_rr_<name>.sock". All requests to a peer are pipelined over a
+   * single connection and told apart by their request ids.
+   *
+   * A single I/O thread drives the sockets with epoll. Frames sent from other threads are queued on their
+   * connection and written by the I/O thread, so the frames queued in the meantime go out in one write.
+   */
+  class UdsTransport : public Transport
+  {
+  public:
+    /**
+     * @param name of the RR served by this endpoint
+     * @param directory where the sockets of the endpoints are placed
+     */
+    explicit UdsTransport(const std::string &name, const std::string &directory = "/tmp");
+
+    ~UdsTransport();
+
+    UdsStatistics statistics() const;
+
+  protected:
+    void send(const std::string &target, const TransportFrame &frame) override;
+
+  private:
+    struct Connection
+    {
+      explicit Connection(int fd) : fd_(fd){};
+
+      int fd_;
+      std::string peer_;
+
+      // guards output_, flush_scheduled_ and closed_, everything else is owned by the I/O thread
+      std::mutex output_mutex_;
+      std::string output_;
+      bool flush_scheduled_ = false;
+      bool closed_ = false;
+
+      std::string writing_;
+      std::size_t written_ = 0;
+      bool writable_wait_ = false;
+
+      std::string input_;
+    };
+    typedef std::shared_ptr<Connection> ConnectionPtr;
+
+    std::string directory_;
+    std::string socket_path_;
+    int listen_fd_;
+    int epoll_fd_;
+    int wakeup_fd_;
+
+    mutable std::mutex connections_mutex_;
+    std::unordered_map<int, ConnectionPtr> connections_;
+    std::unordered_map<std::string, ConnectionPtr> peers_;
+    std::vector<ConnectionPtr> flush_queue_;
+
+    mutable std::mutex statistics_mutex_;
+    UdsStatistics statistics_;
+
+    std::atomic<bool> stopping_;
+    std::thread io_thread_;
+
+    static std::string socketPath(const std::string &directory, const std::string &rr);
+
+    ConnectionPtr connectPeer(const std::string &target);
+    void addConnection(const ConnectionPtr &connection);
+    void closeConnection(const ConnectionPtr &connection);
+    bool isClosed(const ConnectionPtr &connection);
+
+    void ioLoop();
+    void acceptConnections();
+    void readConnection(const ConnectionPtr &connection);
+    void flushConnection(const ConnectionPtr &connection);
+    void wakeup();
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -0,0 +1,191 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TEMOTO_RESOURCE_REGISTRAR__RR_WATCHDOG_H
+#define TEMOTO_RESOURCE_REGISTRAR__RR_WATCHDOG_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace temoto_resource_registrar
+{
+  /**
+   * @brief Time limits of the load callbacks of a server. A zero limit is not enforced.
+   *
+   * Exceeding the soft limit is only reported. When the hard limit is exceeded the query is cancelled and
+   * its caller is completed with a timeout error, while the callback is left to finish in the background.
+   */
+  struct LoadTimeouts
+  {
+    std::chrono::milliseconds soft_ = std::chrono::milliseconds(0);
+    std::chrono::milliseconds hard_ = std::chrono::milliseconds(0);
+  };
+
+  /**
+   * @brief Histogram of the execution times of the queries of a server. Bucket i counts the queries that
+   * took at most BUCKET_LIMITS_MS[i] milliseconds, the last bucket counts the rest.
+   */
+  struct LoadStatistics
+  {
+    static constexpr std::array<std::uint64_t, 12> BUCKET_LIMITS_MS{{1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000}};
+
+    std::array<std::size_t, BUCKET_LIMITS_MS.size() + 1> buckets_{};
+    std::size_t count_ = 0;
+    std::chrono::nanoseconds total_ = std::chrono::nanoseconds(0);
+    std::chrono::nanoseconds max_ = std::chrono::nanoseconds(0);
+    std::size_t soft_limit_exceeded_ = 0;
+    std::size_t hard_limit_exceeded_ = 0;
+
+    void record(const std::chrono::nanoseconds &duration);
+  };
+
+  /**
+   * @brief Single thread that runs timeout callbacks, kept in a hashed timing wheel. Scheduling and
+   * cancelling a timer are O(1), so a large number of outstanding timers is cheap. Callbacks run on the
+   * watchdog thread and should return quickly.
+   */
+  class Watchdog
+  {
+  public:
+    typedef std::uint64_t TimerId;
+
+    explicit Watchdog(std::chrono::milliseconds tick = std::chrono::milliseconds(5), std::size_t slot_count = 512);
+
+    ~Watchdog();
+
+    Watchdog(const Watchdog &) = delete;
+    Watchdog &operator=(const Watchdog &) = delete;
+
+    TimerId schedule(std::chrono::milliseconds delay, std::function<void()> callback);
+
+    /**
+     * @brief Removes a timer that has not fired yet.
+     *
+     * @return false if the timer already fired or was cancelled before.
+     */
+    bool cancel(TimerId id);
+
+    std::size_t pending() const;
+
+    /**
+     * @brief Process wide watchdog used by the registrars.
+     */
+    static Watchdog &shared();
+
+    /**
+     * @brief Cancels the timer when going out of scope. A zero id or a NULL watchdog is ignored.
+     */
+    class ScopedTimer
+    {
+    public:
+      ScopedTimer(Watchdog *watchdog, TimerId id) : watchdog_(watchdog), id_(id){};
+
+      ~ScopedTimer()
+      {
+        if (watchdog_ != NULL && id_ != 0)
+        {
+          watchdog_->cancel(id_);
+        }
+      }
+
+      ScopedTimer(const ScopedTimer &) = delete;
+      ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+      Watchdog *watchdog_;
+      TimerId id_;
+    };
+
+  private:
+    struct Timer
+    {
+      std::size_t rounds_;
+      std::function<void()> callback_;
+    };
+
+    const std::chrono::milliseconds tick_;
+    std::vector<std::vector<TimerId>> slots_;
+    std::unordered_map<TimerId, Timer> timers_;
+    std::size_t current_slot_;
+    TimerId next_id_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    bool stopping_;
+    std::thread thread_;
+
+    void run();
+  };
+
+  /**
+   * @brief Threads that run the load callbacks of servers with a hard time limit. A running task that is
+   * abandoned has its thread replaced, so callbacks that never return do not take threads away from the
+   * other loads. The abandoned thread exits once its task returns. Tasks may outlive the executor.
+   */
+  class LoadExecutor
+  {
+  public:
+    typedef std::function<void()> Task;
+
+    // progress of a submitted task
+    struct Ticket;
+    typedef std::shared_ptr<Ticket> TicketPtr;
+
+    explicit LoadExecutor(std::size_t thread_count);
+
+    ~LoadExecutor();
+
+    LoadExecutor(const LoadExecutor &) = delete;
+    LoadExecutor &operator=(const LoadExecutor &) = delete;
+
+    TicketPtr submit(Task task);
+
+    /**
+     * @brief Stops counting the thread of \p ticket as one of the executor's threads if the task is
+     * running, and starts a replacement. Queued tasks are left to run as usual.
+     */
+    void abandon(const TicketPtr &ticket);
+
+    /**
+     * @brief Threads of the executor, including the abandoned ones whose task is still running.
+     */
+    std::size_t threadCount() const;
+
+    /**
+     * @brief Process wide executor used by the registrars.
+     */
+    static LoadExecutor &shared();
+
+  private:
+    struct State;
+    std::shared_ptr<State> state_;
+
+    static void startWorker(const std::shared_ptr<State> &state);
+    static void workerLoop(std::shared_ptr<State> state);
+  };
+
+} // namespace temoto_resource_registrar
+
+#endif
@@ -0,0 +1,257 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef TEMOTO_LOGGING__TEMOTO_ASYNC_LOGGING_H
+#define TEMOTO_LOGGING__TEMOTO_ASYNC_LOGGING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <console_bridge/console.h>
+#include "temoto_resource_registrar/string_formatting.h"
+
+namespace temoto_logging
+{
+
+/**
+ * @brief Formats a log record on the writer thread.
+ */
+class LogFormatter
+{
+public:
+  virtual ~LogFormatter() = default;
+  virtual std::string str() const = 0;
+};
+
+namespace details
+{
+  // arguments are copied when the record is captured, C strings by value as they usually point into
+  // temporaries of the logging call site
+  template <typename T>
+  typename std::decay<T>::type capture(const T& value)
+  {
+    return value;
+  }
+
+  template <std::size_t N>
+  std::string capture(const char (&value)[N])
+  {
+    return value;
+  }
+
+  inline std::string capture(const char* value)
+  {
+    return value ? value : "(null)";
+  }
+
+  inline std::string capture(char* value)
+  {
+    return capture(static_cast<const char*>(value));
+  }
+
+  template <typename... Captured>
+  class DeferredFormat : public LogFormatter
+  {
+  public:
+    DeferredFormat(std::string format_string, Captured... args)
+    : format_string_(std::move(format_string))
+    , args_(std::move(args)...)
+    {
+    }
+
+    std::string str() const override
+    {
+      return str(std::index_sequence_for<Captured...>());
+    }
+
+  private:
+    std::string format_string_;
+    std::tuple<Captured...> args_;
+
+    template <std::size_t... I>
+    std::string str(std::index_sequence<I...>) const
+    {
+      return format(format_string_, std::get<I>(args_)...);
+    }
+  };
+} // details namespace
+
+struct AsyncLoggingOptions
+{
+  enum class OverflowPolicy
+  {
+    DROP,  // records that do not fit the ring of their thread are counted and discarded
+    BLOCK  // the logging thread waits until the writer made room
+  };
+
+  typedef std::function<void(console_bridge::LogLevel level, const char* file, int line, const std::string& message)> Output;
+
+  // records per logging thread
+  std::size_t ring_capacity_ = 1024;
+  OverflowPolicy overflow_policy_ = OverflowPolicy::DROP;
+  // how long the writer sleeps when the rings are empty
+  std::chrono::milliseconds flush_interval_ = std::chrono::milliseconds(10);
+  // drain the rings when the process receives SIGSEGV, SIGABRT, SIGBUS, SIGILL or SIGFPE
+  bool flush_on_crash_ = true;
+  // console_bridge::log if not set
+  Output output_;
+};
+
+struct AsyncLoggingStatistics
+{
+  std::uint64_t written_ = 0;
+  std::uint64_t dropped_ = 0;
+  // records whose thread had to wait for room in its ring
+  std::uint64_t blocked_ = 0;
+};
+
+/**
+ * @brief Logging backend that takes formatting and output off the logging threads. Every thread that
+ * logs gets its own single producer ring, which a background writer drains in order. Records of
+ * different threads are not ordered relative to each other.
+ *
+ * While the logger is stopped, the TEMOTO_LOG_ macros format and write synchronously as before.
+ */
+class AsyncLogger
+{
+public:
+  static AsyncLogger& instance();
+
+  void start(const AsyncLoggingOptions& options = AsyncLoggingOptions());
+
+  /**
+   * @brief Writes the remaining records and stops the writer.
+   */
+  void stop();
+
+  bool running() const
+  {
+    return running_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Writes every record captured so far on the calling thread.
+   */
+  void flush();
+
+  AsyncLoggingStatistics statistics() const;
+
+  /**
+   * @return false if the logger is not running, the record is left to the caller then
+   */
+  bool push(console_bridge::LogLevel level, const char* file, int line, std::unique_ptr<LogFormatter>& formatter);
+  bool push(console_bridge::LogLevel level, const char* file, int line, std::string& message);
+
+  ~AsyncLogger();
+
+private:
+  struct Record
+  {
+    console_bridge::LogLevel level_;
+    const char* file_;
+    int line_;
+    std::unique_ptr<LogFormatter> formatter_;
+    std::string message_;
+  };
+
+  class Ring;
+  struct ThreadRing;
+
+  AsyncLogger() = default;
+
+  std::atomic<bool> running_{false};
+  // bumped by start, makes threads register a ring with the new capacity
+  std::atomic<std::uint64_t> epoch_{0};
+  // the parts of options_ that are read by the logging threads
+  std::atomic<std::size_t> ring_capacity_{0};
+  std::atomic<bool> block_{false};
+  AsyncLoggingOptions options_;
+
+  std::mutex rings_mutex_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+
+  // held while draining, the rings have a single consumer
+  std::mutex drain_mutex_;
+  std::thread writer_;
+  std::mutex writer_mutex_;
+  std::condition_variable writer_cv_;
+  bool stop_requested_ = false;
+
+  std::atomic<std::uint64_t> written_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<std::uint64_t> blocked_{0};
+
+  bool push(Record& record);
+  Ring& threadRing();
+  void writerLoop();
+  std::size_t drain();
+  // requires drain_mutex_, does not wait for rings_mutex_ when crashing
+  std::size_t drainRings(bool crashing);
+  void write(Record& record);
+  static void crashHandler(int signal);
+};
+
+/**
+ * @brief Writes an already formatted log record, through the AsyncLogger if it is running.
+ */
+inline void write(const char* file, int line, console_bridge::LogLevel level, std::string message)
+{
+  AsyncLogger& logger = AsyncLogger::instance();
+  if (!logger.running() || !logger.push(level, file, line, message))
+  {
+    console_bridge::log(file, line, level, "%s", message.c_str());
+  }
+}
+
+/**
+ * @brief Formats and writes a log record, through the AsyncLogger if it is running. Formatting is
+ * left to the writer thread then.
+ */
+template <typename... Args>
+void log(const char* file, int line, console_bridge::LogLevel level, std::string format_string, const Args&... args)
+{
+  AsyncLogger& logger = AsyncLogger::instance();
+  if (logger.running())
+  {
+    typedef details::DeferredFormat<decltype(details::capture(args))...> Formatter;
+    std::unique_ptr<LogFormatter> formatter(new Formatter(std::move(format_string), details::capture(args)...));
+    if (logger.push(level, file, line, formatter))
+    {
+      return;
+    }
+    // stopped in the meantime
+    std::string message = formatter->str();
+    console_bridge::log(file, line, level, "%s", message.c_str());
+    return;
+  }
+
+  std::string message = format(std::move(format_string), args...);
+  console_bridge::log(file, line, level, "%s", message.c_str());
+}
+
+} // temoto_logging namespace
+
+#endif
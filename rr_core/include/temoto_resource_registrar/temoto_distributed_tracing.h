@@ -17,6 +17,7 @@
 #ifndef TEMOTO_LOGGING__TEMOTO_DISTRIBUTED_TRACING_H
 #define TEMOTO_LOGGING__TEMOTO_DISTRIBUTED_TRACING_H
 
+#include <chrono>
 #include <thread>
 #include <functional>
 #include <fstream>
@@ -26,6 +27,7 @@
 #include "opentracing/dynamic_load.h"
 #include <text_map_carrier.h>
 #include "yaml-cpp/yaml.h"
+#include "temoto_resource_registrar/temoto_trace_sampling.h"
 
 namespace temoto_logging
 {
@@ -33,7 +35,9 @@ namespace temoto_logging
 struct SpanHandle; // fowrward declaration
 typedef std::unordered_map<std::string, std::string> StringMap;
 typedef StringMap SpanContextType;
-typedef std::map<std::thread::id, std::stack<SpanHandle>> SpanStacks;
+
+// spans opened by a thread, innermost on top
+typedef std::stack<SpanHandle> SpanStack;
 
 /**
  * @brief Helper datastructure to contain a span and its context
@@ -43,6 +47,16 @@ struct SpanHandle
 {
   std::unique_ptr<opentracing::Span> span;
   SpanContextType context;
+
+  // roots of unsampled traces have no span, but are reported afterwards if they fail or are slow
+  bool tail_candidate = false;
+  const char* function = NULL;
+  std::string name;
+  std::chrono::system_clock::time_point start;
+  std::chrono::steady_clock::time_point steady_start;
+
+  // created when the span starts, so that it is only marked failed by exceptions that leave it
+  UnwindingDetector unwinding_detector;
 };
 
 /**
@@ -114,6 +114,13 @@ namespace resource_registrar
     {
     }
 
+    TemotoErrorStack &operator=(const TemotoErrorStack &tes)
+    {
+      error_stack_ = tes.error_stack_;
+      messages_ = tes.messages_;
+      return *this;
+    }
+
     TemotoErrorStack(const std::string &serialized_errstack)
     {
       std::stringstream ss(serialized_errstack);
@@ -175,7 +182,7 @@ namespace resource_registrar
       return ss.str();
     }
 
-    const bool empty() {
+    const bool empty() const {
       return error_stack_.size() == 0;
     }
 
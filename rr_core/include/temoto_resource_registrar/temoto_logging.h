@@ -17,6 +17,10 @@
 #ifndef TEMOTO_LOGGING__TEMOTO_LOGGING_H
 #define TEMOTO_LOGGING__TEMOTO_LOGGING_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <mutex>
 #include <string>
@@ -27,6 +31,8 @@
 #include <iostream>
 #include <exception>
 #include "temoto_resource_registrar/string_formatting.h"
+#include "temoto_resource_registrar/temoto_async_logging.h"
+#include "temoto_resource_registrar/temoto_trace_sampling.h"
 
 #ifdef temoto_enable_tracing
 #include "temoto_resource_registrar/temoto_distributed_tracing.h"
@@ -37,19 +43,32 @@
 #define GET_NAME_FF TEMOTO_LOG_ATTR.getNsWithSlash() + __func__
 #define GET_NAME TEMOTO_LOG_ATTR.getNsWithSlash() + GET_CLASS_NAME + "::" + __func__
 
-// TeMoto logging related definitions via console bridge
+// Per call site "[from GET_NAME_FF]: " prefix, built once per thread and namespace change
+#define TEMOTO_LOG_PREFIX_ \
+  static thread_local temoto_logging::CallSitePrefix temoto_log_call_site; \
+  const std::string &temoto_log_prefix = temoto_log_call_site.get(__func__);
+
+// TeMoto logging related definitions via console bridge, or the AsyncLogger if it is running. Neither the
+// prefix nor the message (nor the arguments) are evaluated if the level is disabled
 #ifdef temoto_enable_tracing
   #define TEMOTO_LOG_(level, fmt, ...) \
   { \
-    std::string msg = temoto_logging::format(std::string("[from " + GET_NAME_FF + "]: " + fmt).c_str(), ##__VA_ARGS__); \
-    console_bridge::log(__FILE__, __LINE__, level, msg.c_str()); \
-    TEMOTO_LOG_ATTR.sendSpanLog(msg); \
+    if (temoto_logging::levelEnabled(level)) \
+    { \
+      TEMOTO_LOG_PREFIX_ \
+      std::string msg = temoto_logging::format(temoto_log_prefix + fmt, ##__VA_ARGS__); \
+      TEMOTO_LOG_ATTR.sendSpanLog(msg); \
+      temoto_logging::write(__FILE__, __LINE__, level, std::move(msg)); \
+    } \
   }
 #else
   #define TEMOTO_LOG_(level, fmt, ...) \
   { \
-    std::string msg = temoto_logging::format(std::string("[from " + GET_NAME_FF + "]: " + fmt).c_str(), ##__VA_ARGS__); \
-    console_bridge::log(__FILE__, __LINE__, level, msg.c_str()); \
+    if (temoto_logging::levelEnabled(level)) \
+    { \
+      TEMOTO_LOG_PREFIX_ \
+      temoto_logging::log(__FILE__, __LINE__, level, temoto_log_prefix + fmt, ##__VA_ARGS__); \
+    } \
   }
 #endif
 
@@ -69,18 +88,26 @@
 #ifdef temoto_enable_tracing
   #define TEMOTO_LOG_STREAM_(level, fmt, ...) \
   { \
-    std::stringstream ss; \
-    ss << "[from " << GET_NAME_FF << "]: " << fmt; \
-    std::string msg = temoto_logging::format(ss.str().c_str(), ##__VA_ARGS__); \
-    console_bridge::log(__FILE__, __LINE__, level, msg.c_str()); \
-    TEMOTO_LOG_ATTR.sendSpanLog(msg); \
+    if (temoto_logging::levelEnabled(level)) \
+    { \
+      TEMOTO_LOG_PREFIX_ \
+      std::stringstream ss; \
+      ss << temoto_log_prefix << fmt; \
+      std::string msg = temoto_logging::format(ss.str(), ##__VA_ARGS__); \
+      TEMOTO_LOG_ATTR.sendSpanLog(msg); \
+      temoto_logging::write(__FILE__, __LINE__, level, std::move(msg)); \
+    } \
   }
 #else
   #define TEMOTO_LOG_STREAM_(level, fmt, ...) \
   { \
-    std::stringstream ss; \
-    ss << "[from " << GET_NAME_FF << "]: " << fmt; \
-    console_bridge::log(__FILE__, __LINE__, level, ss.str().c_str(), ##__VA_ARGS__); \
+    if (temoto_logging::levelEnabled(level)) \
+    { \
+      TEMOTO_LOG_PREFIX_ \
+      std::stringstream ss; \
+      ss << temoto_log_prefix << fmt; \
+      temoto_logging::write(__FILE__, __LINE__, level, temoto_logging::streamMessage(ss, ##__VA_ARGS__)); \
+    } \
   }
 #endif
 
@@ -99,12 +126,17 @@
 // Distribted tracing related macro definitions
 #ifdef temoto_enable_tracing
   #define START_SPAN_UNIQUE(span_collector_name) \
-    temoto_logging::SpanCollector span_collector_name(TEMOTO_LOG_ATTR.startTracingSpan(GET_NAME_FF));
+    temoto_logging::SpanCollector span_collector_name(TEMOTO_LOG_ATTR.startFunctionSpan(__func__));
 
   #define START_SPAN START_SPAN_UNIQUE(temoto_tracing_span_collector)
+
+  // like START_SPAN, continuing the trace of parent_span_context if the thread has no span yet
+  #define START_SPAN_CHILD_OF(parent_span_context) \
+    temoto_logging::SpanCollector temoto_tracing_span_collector(TEMOTO_LOG_ATTR.startFunctionSpan(__func__, parent_span_context));
 #else
   #define START_SPAN_UNIQUE(span_collector_name)
   #define START_SPAN
+  #define START_SPAN_CHILD_OF(parent_span_context)
 #endif
 
 namespace temoto_logging
@@ -125,6 +157,17 @@ public:
       temoto_namespace_ = std::string(env_temoto_namespace);
     }
 
+    TraceSampling sampling;
+    if (const char *env_sampling_probability = std::getenv("TEMOTO_TRACE_SAMPLING_PROBABILITY"))
+    {
+      sampling.probability_ = std::atof(env_sampling_probability);
+    }
+    if (const char *env_latency_threshold = std::getenv("TEMOTO_TRACE_LATENCY_THRESHOLD_MS"))
+    {
+      sampling.latency_threshold_ = std::chrono::milliseconds(std::atol(env_latency_threshold));
+    }
+    setTraceSampling(sampling);
+
   #ifdef temoto_enable_tracing
     if (const char *env_tracer_config_pth = std::getenv("TEMOTO_TRACER_CONFIG_PATH"))
     {
@@ -140,6 +183,7 @@ public:
   void initialize(std::string subsystem_name = "")
   {
     subsystem_name_ = subsystem_name;
+    version_++;
     #ifdef temoto_enable_tracing
     initializeTracer();
     #endif
@@ -185,22 +229,44 @@ public:
   void setSubsystemName(const std::string& subsystem_name)
   {
     subsystem_name_ = subsystem_name;
+    version_++;
   }
 
   void appendSubsystemName(const std::string& appended_portion)
   {
     subsystem_name_ = subsystem_name_ + "/" + appended_portion;
+    version_++;
+  }
+
+  /**
+   * @brief Changes whenever getNsWithSlash changes, lets cached logging prefixes know they are stale.
+   */
+  unsigned int version() const
+  {
+    return version_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Takes effect for traces started afterwards. Ignored unless tracing is enabled.
+   */
+  void setTraceSampling(const TraceSampling& sampling)
+  {
+    sampler_.setSampling(sampling);
+  }
+
+  TraceSampling getTraceSampling() const
+  {
+    return sampler_.sampling();
   }
 
 private:
   std::string temoto_namespace_;
   std::string subsystem_name_;
+  std::atomic<unsigned int> version_{0};
+  TraceSampler sampler_;
 
 #ifdef temoto_enable_tracing
 
-  SpanStacks span_stacks_;
-  mutable std::recursive_mutex span_stacks_mtx_;
-
   opentracing::v2::expected<opentracing::v2::DynamicTracingLibraryHandle> tracer_handle_maybe_;
   opentracing::v2::expected<std::shared_ptr<opentracing::v2::Tracer>> tracer_;
   std::string tracer_config_path_;
@@ -265,20 +331,27 @@ private:
     CONSOLE_BRIDGE_logInform("[from %s] Tracer initialized", std::string(getNsWithSlash() + __func__).c_str());
   }
 
+  /*
+   * Span stacks are kept per thread, so that tracing does not make the threads wait for each other.
+   * Spans do not follow work to other threads by themselves, see adoptSpanContext.
+   */
+  static SpanStack& spanStack()
+  {
+    static thread_local SpanStack span_stack;
+    return span_stack;
+  }
+
   bool spanStackEmpty() const
   {
-    std::lock_guard<std::recursive_mutex> l(span_stacks_mtx_);
-    //CONSOLE_BRIDGE_logError("[from %s] spanstacks size %d", std::string(getNsWithSlash() + __func__).c_str(), span_stacks_.size());
-    return span_stacks_.find(std::this_thread::get_id()) == span_stacks_.end();
+    return spanStack().empty();
   }
 
 public:
   SpanContextType topParentSpanContext() const
   {
-    std::lock_guard<std::recursive_mutex> l(span_stacks_mtx_);
     if (!spanStackEmpty())
     {
-      return span_stacks_.at(std::this_thread::get_id()).top().context;
+      return spanStack().top().context;
     }
     else
     {
@@ -288,47 +361,140 @@ public:
 
   void pushParentSpan(SpanHandle& span_handle)
   {
-    std::lock_guard<std::recursive_mutex> l(span_stacks_mtx_);
-    span_stacks_[std::this_thread::get_id()].push(std::move(span_handle));
+    spanStack().push(std::move(span_handle));
   }
 
   void popParentSpan()
   {
-    std::lock_guard<std::recursive_mutex> l(span_stacks_mtx_);
     if (spanStackEmpty())
     {
       throw std::runtime_error("A pop was attempted at an empty trace span stack");
     }
 
-    span_stacks_[std::this_thread::get_id()].pop();
-    if (span_stacks_[std::this_thread::get_id()].empty())
+    SpanHandle& span_handle = spanStack().top();
+    // popped by a SpanCollector that is unwound by an exception
+    bool failed = span_handle.unwinding_detector.unwinding();
+    try
+    {
+      if (span_handle.span && failed)
+      {
+        span_handle.span->SetTag("error", true);
+      }
+      if (span_handle.tail_candidate)
+      {
+        reportUnsampledRoot(span_handle, failed);
+      }
+    }
+    catch (...)
     {
-      span_stacks_.erase(std::this_thread::get_id());
+      // tracing must not turn an unwinding exception into a terminate
     }
+    spanStack().pop();
   }
 
+  /**
+   * @brief Continues the trace of \p span_context (taken with topParentSpanContext on another thread) on
+   * the calling thread. Spans started until the returned callback is invoked become its children.
+   */
+  std::function<void()> adoptSpanContext(const SpanContextType& span_context)
+  {
+    if (span_context.empty())
+    {
+      return [] {};
+    }
+
+    SpanHandle span_handle;
+    span_handle.context = span_context;
+    pushParentSpan(span_handle);
+    return [this] { popParentSpan(); };
+  }
+
+  /**
+   * @brief Starts a span that is a child of \p parent_context if given, or of the innermost span of the
+   * calling thread.
+   */
   std::function<void()> startTracingSpan(const std::string& span_name, SpanContextType parent_context = SpanContextType{})
   {
-    std::lock_guard<std::recursive_mutex> l(span_stacks_mtx_);
-    
-    std::unique_ptr<opentracing::Span> tracing_span;
+    return startSpan(NULL, span_name, parent_context, true);
+  }
 
-    if (!parent_context.empty())
+  /**
+   * @brief Starts a span named after \p function that is a child of the innermost span of the calling
+   * thread, or of \p parent_context if the thread has none. The name is only built if the trace is sampled.
+   */
+  std::function<void()> startFunctionSpan(const char* function, const SpanContextType& parent_context = SpanContextType{})
+  {
+    return startSpan(function, std::string(), parent_context, false);
+  }
+
+  void sendSpanLog(const std::string& msg)
+  {
+    // adopted contexts have no span of this thread to log to
+    if (spanStackEmpty() || !spanStack().top().span)
     {
-      TextMapCarrier carrier(parent_context);
-      auto span_context_maybe = (*tracer_)->Extract(carrier);
-      tracing_span = (*tracer_)->StartSpan(span_name, {opentracing::ChildOf(span_context_maybe->get())});
+      return;
     }
-    else if (spanStackEmpty()) 
+    spanStack().top().span->Log({{"info", msg}});
+  }
+
+private:
+  std::function<void()> startSpan(const char* function,
+                                  const std::string& span_name,
+                                  const SpanContextType& parent_context,
+                                  bool prefer_parent_context)
+  {
+    const SpanContextType* parent = NULL;
+    if (!parent_context.empty() && (prefer_parent_context || spanStackEmpty()))
     {
-      tracing_span = (*tracer_)->StartSpan(span_name);
+      parent = &parent_context;
     }
-    else
+    else if (!spanStackEmpty())
+    {
+      parent = &spanStack().top().context;
+    }
+
+    TraceSampler::Decision decision = sampler_.decide(parent);
+    if (decision == TraceSampler::Decision::UNSAMPLED && parent != NULL)
+    {
+      // the thread already carries the decision, nested spans of unsampled traces are free
+      if (parent != &parent_context)
+      {
+        return [] {};
+      }
+      SpanHandle span_handle;
+      span_handle.context = parent_context;
+      pushParentSpan(span_handle);
+      return [this] { popParentSpan(); };
+    }
+
+    if (decision != TraceSampler::Decision::SAMPLED)
+    {
+      SpanHandle span_handle;
+      TraceSampler::markUnsampled(span_handle.context);
+      if (decision == TraceSampler::Decision::TAIL_CANDIDATE)
+      {
+        span_handle.tail_candidate = true;
+        span_handle.function = function;
+        span_handle.name = span_name;
+        span_handle.start = std::chrono::system_clock::now();
+        span_handle.steady_start = std::chrono::steady_clock::now();
+      }
+      pushParentSpan(span_handle);
+      return [this] { popParentSpan(); };
+    }
+
+    std::string name = function != NULL ? getNsWithSlash() + function : span_name;
+    std::unique_ptr<opentracing::Span> tracing_span;
+    if (parent != NULL)
     {
-      SpanContextType spc = topParentSpanContext();
+      SpanContextType spc = *parent;
       TextMapCarrier carrier(spc);
       auto span_context_maybe = (*tracer_)->Extract(carrier);
-      tracing_span = (*tracer_)->StartSpan(span_name, {opentracing::ChildOf(span_context_maybe->get())});
+      tracing_span = (*tracer_)->StartSpan(name, {opentracing::ChildOf(span_context_maybe->get())});
+    }
+    else
+    {
+      tracing_span = (*tracer_)->StartSpan(name);
     }
 
     SpanContextType span_context;
@@ -340,17 +506,25 @@ public:
     span_handle.context = span_context;
     pushParentSpan(span_handle);
 
-    return std::bind(&LoggingAttributes::popParentSpan, this);
+    return [this] { popParentSpan(); };
   }
 
-  void sendSpanLog(const std::string& msg)
+  void reportUnsampledRoot(const SpanHandle& span_handle, bool failed)
   {
-    std::lock_guard<std::recursive_mutex> l(span_stacks_mtx_);
-    if (spanStackEmpty())
+    if (!sampler_.reportTail(failed, std::chrono::steady_clock::now() - span_handle.steady_start))
     {
       return;
     }
-    span_stacks_.at(std::this_thread::get_id()).top().span->Log({{"info", msg}});
+
+    std::string name = span_handle.function != NULL ? getNsWithSlash() + span_handle.function : span_handle.name;
+    std::unique_ptr<opentracing::Span> tracing_span = (*tracer_)->StartSpan(name,
+      {opentracing::StartTimestamp(span_handle.start, span_handle.steady_start)});
+    tracing_span->SetTag("sampling.tail", failed ? "error" : "latency");
+    if (failed)
+    {
+      tracing_span->SetTag("error", true);
+    }
+    tracing_span->Finish();
   }
 #endif
 };
@@ -358,4 +532,69 @@ public:
 
 extern temoto_logging::LoggingAttributes TEMOTO_LOG_ATTR;
 
+namespace temoto_logging
+{
+
+inline bool levelEnabled(console_bridge::LogLevel level)
+{
+  return level >= console_bridge::getLogLevel();
+}
+
+/**
+ * @brief Wraps \p callable so that spans it starts continue the trace that is active at the time of
+ * binding, regardless of the thread it is eventually executed on.
+ */
+#ifdef temoto_enable_tracing
+template <class Callable>
+auto bindSpanContext(Callable callable)
+{
+  SpanContextType span_context = TEMOTO_LOG_ATTR.topParentSpanContext();
+  return [span_context, callable](auto&&... args) mutable {
+    SpanCollector span_handoff(TEMOTO_LOG_ATTR.adoptSpanContext(span_context));
+    return callable(std::forward<decltype(args)>(args)...);
+  };
+}
+#else
+template <class Callable>
+Callable bindSpanContext(Callable callable)
+{
+  return callable;
+}
+#endif
+
+// streamed messages only go through boost::format if there are arguments, as printf did before
+inline std::string streamMessage(const std::stringstream& ss)
+{
+  return ss.str();
+}
+
+template <typename... Args>
+std::string streamMessage(const std::stringstream& ss, const Args&... args)
+{
+  return format(ss.str(), args...);
+}
+
+/**
+ * @brief Logging prefix of a call site, see TEMOTO_LOG_PREFIX_.
+ */
+class CallSitePrefix
+{
+public:
+  const std::string& get(const char* function)
+  {
+    unsigned int version = TEMOTO_LOG_ATTR.version();
+    if (prefix_.empty() || version != version_)
+    {
+      prefix_ = "[from " + TEMOTO_LOG_ATTR.getNsWithSlash() + function + "]: ";
+      version_ = version;
+    }
+    return prefix_;
+  }
+
+private:
+  std::string prefix_;
+  unsigned int version_ = 0;
+};
+} // temoto_logging namespace
+
 #endif
\ No newline at end of file
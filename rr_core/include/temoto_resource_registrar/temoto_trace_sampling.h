@@ -0,0 +1,170 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef TEMOTO_LOGGING__TEMOTO_TRACE_SAMPLING_H
+#define TEMOTO_LOGGING__TEMOTO_TRACE_SAMPLING_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <boost/core/uncaught_exceptions.hpp>
+
+namespace temoto_logging
+{
+
+// span context entry of traces that were not head sampled, carried along with the context
+constexpr const char* UNSAMPLED_KEY = "temoto-unsampled";
+
+/**
+ * @brief Which traces are recorded. Head sampling is decided when a trace starts (a span without a
+ * parent) and travels with the span context, so unsampled traces cost next to nothing downstream.
+ * Tail sampling still reports the root of an unsampled trace if it failed or was slow.
+ */
+struct TraceSampling
+{
+  // share of traces that are recorded, between 0 and 1
+  double probability_ = 1.0;
+  // report unsampled roots that took at least this long, zero disables
+  std::chrono::milliseconds latency_threshold_ = std::chrono::milliseconds(0);
+  // report unsampled roots that were left by an exception
+  bool keep_errors_ = true;
+};
+
+/**
+ * @brief Sampling decisions of the tracer, which do not depend on the tracing library.
+ */
+class TraceSampler
+{
+public:
+  typedef std::unordered_map<std::string, std::string> SpanContext;
+
+  enum class Decision
+  {
+    SAMPLED,
+    UNSAMPLED,
+    // root of an unsampled trace that is reported afterwards if it fails or is slow
+    TAIL_CANDIDATE
+  };
+
+  void setSampling(const TraceSampling& sampling)
+  {
+    double probability = std::min(std::max(sampling.probability_, 0.0), 1.0);
+    sampling_threshold_ = static_cast<std::uint64_t>(probability * SAMPLING_SCALE);
+    latency_threshold_ms_ = sampling.latency_threshold_.count();
+    keep_errors_ = sampling.keep_errors_;
+  }
+
+  TraceSampling sampling() const
+  {
+    TraceSampling sampling;
+    sampling.probability_ = static_cast<double>(sampling_threshold_.load()) / SAMPLING_SCALE;
+    sampling.latency_threshold_ = std::chrono::milliseconds(latency_threshold_ms_.load());
+    sampling.keep_errors_ = keep_errors_;
+    return sampling;
+  }
+
+  /**
+   * @brief Decides on a span that continues \p parent_context, or starts a trace if \p parent_context is
+   * NULL. Only the start of a trace is sampled, the spans of a trace follow the decision of its root.
+   */
+  Decision decide(const SpanContext* parent_context) const
+  {
+    if (parent_context != NULL)
+    {
+      return unsampled(*parent_context) ? Decision::UNSAMPLED : Decision::SAMPLED;
+    }
+    if (headSample())
+    {
+      return Decision::SAMPLED;
+    }
+    return (keep_errors_ || latency_threshold_ms_ > 0) ? Decision::TAIL_CANDIDATE : Decision::UNSAMPLED;
+  }
+
+  /**
+   * @brief Whether a TAIL_CANDIDATE that took \p elapsed is reported.
+   */
+  bool reportTail(bool failed, std::chrono::steady_clock::duration elapsed) const
+  {
+    std::int64_t latency_threshold_ms = latency_threshold_ms_;
+    bool slow = latency_threshold_ms > 0 && elapsed >= std::chrono::milliseconds(latency_threshold_ms);
+    return (failed && keep_errors_) || slow;
+  }
+
+  /**
+   * @brief Draws the head sampling decision of a new trace.
+   */
+  bool headSample() const
+  {
+    std::uint64_t threshold = sampling_threshold_.load(std::memory_order_relaxed);
+    if (threshold >= SAMPLING_SCALE)
+    {
+      return true;
+    }
+
+    // xorshift, seeded per thread
+    static thread_local std::uint64_t state =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+      static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^ 0x9e3779b97f4a7c15ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (state >> 32) < threshold;
+  }
+
+  static bool unsampled(const SpanContext& span_context)
+  {
+    return span_context.count(UNSAMPLED_KEY) != 0;
+  }
+
+  static void markUnsampled(SpanContext& span_context)
+  {
+    span_context[UNSAMPLED_KEY] = "1";
+  }
+
+private:
+  // a trace is sampled if 32 random bits are below the threshold
+  static constexpr std::uint64_t SAMPLING_SCALE = std::uint64_t(1) << 32;
+  std::atomic<std::uint64_t> sampling_threshold_{SAMPLING_SCALE};
+  std::atomic<std::int64_t> latency_threshold_ms_{0};
+  std::atomic<bool> keep_errors_{true};
+};
+
+/**
+ * @brief Tells whether the scope it was created in is being left by an exception. Unlike
+ * std::uncaught_exception, a scope that runs while an older exception unwinds is not mistaken for a
+ * failed one.
+ */
+class UnwindingDetector
+{
+public:
+  bool unwinding() const
+  {
+    return boost::core::uncaught_exceptions() > uncaught_exceptions_;
+  }
+
+private:
+  unsigned int uncaught_exceptions_ = boost::core::uncaught_exceptions();
+};
+
+} // temoto_logging namespace
+
+#endif
@@ -29,7 +29,23 @@ namespace temoto_resource_registrar
 
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
     std::cout << "locking..." << std::endl;
-    id_query_map_[request_data] = QueryContainer<RawData>(q, request_data, query_data, server);
+    auto replaced = id_query_map_.find(request_data);
+    if (replaced != id_query_map_.end())
+    {
+      for (const auto &id : replaced->second.rr_ids_)
+      {
+        id_request_index_.erase(id.first);
+      }
+      if (replaced->second.q_.id() != q.id())
+      {
+        recordChange(replaced->second.responsible_server_, replaced->second, true);
+      }
+    }
+    QueryContainer<RawData> &stored = id_query_map_[request_data] = QueryContainer<RawData>(q, request_data, query_data, server);
+    recordChange(server, stored, false);
+    publish(CatalogEvent::Type::QUERY_STORED, server, q.id());
+    id_request_index_[q.id()] = request_data;
+    failed_requests_.erase(requestDigest(server, request_data));
     std::cout << "id_query_map_[request_data] set" << std::endl;
     server_id_map_[server].insert(q.id());
     std::cout << "server_id_map_[server] set" << std::endl;
@@ -56,6 +72,8 @@ namespace temoto_resource_registrar
     if (key.size())
     {
       id_query_map_[key].raw_query_ = response;
+      recordChange(server, id_query_map_[key], false);
+      publish(CatalogEvent::Type::RESPONSE_UPDATED, server, id_query_map_[key].q_.id());
     }
   }
 
@@ -72,6 +90,24 @@ namespace temoto_resource_registrar
         return wrapper.q_.id();
       }
     }
+
+    // a pooled resource is revived without running its load callback again
+    for (auto it = lingering_.begin(); it != lingering_.end(); ++it)
+    {
+      const QueryContainer<RawData> &container = it->container_;
+      if (container.raw_request_ == request_data &&
+          container.responsible_server_ == server)
+      {
+        UUID id = container.q_.id();
+        recordChange(server, id_query_map_[container.raw_request_] = container, false);
+        publish(CatalogEvent::Type::QUERY_STORED, server, id);
+        warm_pool_statistics_.entries_--;
+        warm_pool_statistics_.bytes_ -= it->bytes_;
+        warm_pool_statistics_.revived_++;
+        lingering_.erase(it);
+        return id;
+      }
+    }
     return "";
   }
 
@@ -83,13 +119,33 @@ namespace temoto_resource_registrar
 
     std::cout << "processExisting" << std::endl;
 
-    request = findOriginalContainer(id).raw_request_;
-
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    auto indexed = id_request_index_.find(id);
+    if (indexed != id_request_index_.end())
+    {
+      request = indexed->second;
+    }
+    else
+    {
+      // id is the original query id returned by queryExists, which is no longer among the ids of the
+      // container once its first requester released it (always the case for revived resources)
+      for (auto const &query_entry : id_query_map_)
+      {
+        if (query_entry.second.q_.id() == id)
+        {
+          request = query_entry.first;
+          break;
+        }
+      }
+    }
+
     if (request.size())
     {
+      generation_++;
       id_query_map_[request].storeNewId(q.id(), q.origin());
+      id_request_index_[q.id()] = request;
       server_id_map_[server].insert(q.id());
+      publish(CatalogEvent::Type::ID_ATTACHED, server, q.id(), id_query_map_[request].q_.id());
       return id_query_map_[request].raw_query_;
     }
 
@@ -108,6 +164,16 @@ namespace temoto_resource_registrar
   {
 
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+
+    auto released = releasing_.find(id);
+    if (released != releasing_.end() && released->second.responsible_server_ == server)
+    {
+      std::string query_response = released->second.raw_query_;
+      releasing_.erase(released);
+      unloadable = true;
+      return query_response;
+    }
+
     auto vec = server_id_map_[server];
     int removed_el_cnt = vec.erase(id);
     server_id_map_[server] = vec;
@@ -123,16 +189,29 @@ namespace temoto_resource_registrar
       {
         query_response = qc.raw_query_;
         qc.removeId(id);
+        id_request_index_.erase(id);
 
+        generation_++;
         if (!qc.getIdCount())
         {
-          unloadable = true;
           id_query_map_.erase(qc.raw_request_);
+          recordChange(qc.responsible_server_, qc, true);
+
+          auto linger_period = server_linger_.find(qc.responsible_server_);
+          if (linger_period != server_linger_.end())
+          {
+            linger(qc, linger_period->second);
+          }
+          else
+          {
+            unloadable = true;
+          }
         }
         else
         {
           id_query_map_[qc.raw_request_] = qc;
         }
+        publish(CatalogEvent::Type::ID_UNLOADED, server, id, qc.q_.id());
       }
     }
 
@@ -145,16 +224,228 @@ namespace temoto_resource_registrar
     return query_response;
   }
 
+  void RrCatalog::linger(const QueryContainer<RawData> &container, const std::chrono::milliseconds &period)
+  {
+    std::size_t bytes = container.raw_request_.size() + container.raw_query_.size();
+    lingering_.push_front({container, std::chrono::steady_clock::now() + period, bytes});
+    warm_pool_statistics_.entries_++;
+    warm_pool_statistics_.bytes_ += bytes;
+
+    // the resource that was just released is kept even if it alone exceeds the byte limit
+    while (lingering_.size() > 1 &&
+           (warm_pool_statistics_.entries_ > warm_pool_limits_.max_entries_ ||
+            warm_pool_statistics_.bytes_ > warm_pool_limits_.max_bytes_))
+    {
+      evicted_.push_back(lingering_.back().container_);
+      warm_pool_statistics_.entries_--;
+      warm_pool_statistics_.bytes_ -= lingering_.back().bytes_;
+      warm_pool_statistics_.evicted_++;
+      lingering_.pop_back();
+    }
+  }
+
+  void RrCatalog::rebuildIndex()
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    id_request_index_.clear();
+    for (auto const &query_entry : id_query_map_)
+    {
+      for (auto const &id : query_entry.second.rr_ids_)
+      {
+        id_request_index_[id.first] = query_entry.first;
+      }
+    }
+  }
+
+  void RrCatalog::setServerLinger(const ServerName &server, const std::chrono::milliseconds &period)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    if (period.count() > 0)
+    {
+      server_linger_[server] = period;
+    }
+    else
+    {
+      server_linger_.erase(server);
+    }
+  }
+
+  bool RrCatalog::lingers(const ServerName &server)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    return server_linger_.count(server) > 0;
+  }
+
+  void RrCatalog::setWarmPoolLimits(const WarmPoolLimits &limits)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    warm_pool_limits_ = limits;
+  }
+
+  WarmPoolStatistics RrCatalog::warmPoolStatistics()
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    return warm_pool_statistics_;
+  }
+
+  std::vector<UUID> RrCatalog::takeReleasedLingering(bool all)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<UUID> ids;
+    for (const auto &container : evicted_)
+    {
+      ids.push_back(container.q_.id());
+      releasing_[container.q_.id()] = container;
+    }
+    evicted_.clear();
+
+    for (auto it = lingering_.begin(); it != lingering_.end();)
+    {
+      if (!all && it->expires_ > now)
+      {
+        ++it;
+        continue;
+      }
+
+      ids.push_back(it->container_.q_.id());
+      releasing_[it->container_.q_.id()] = it->container_;
+      warm_pool_statistics_.entries_--;
+      warm_pool_statistics_.bytes_ -= it->bytes_;
+      warm_pool_statistics_.expired_++;
+      it = lingering_.erase(it);
+    }
+
+    return ids;
+  }
+
+  std::chrono::steady_clock::time_point RrCatalog::nextLingerExpiry()
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    if (!evicted_.empty())
+    {
+      return std::chrono::steady_clock::now();
+    }
+
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (const auto &entry : lingering_)
+    {
+      next = std::min(next, entry.expires_);
+    }
+    return next;
+  }
+
+  std::size_t RrCatalog::requestDigest(const ServerName &server, const RawData &request_data)
+  {
+    std::size_t digest = std::hash<std::string>()(server);
+    // boost::hash_combine
+    digest ^= std::hash<std::string>()(request_data) + 0x9e3779b9 + (digest << 6) + (digest >> 2);
+    return digest;
+  }
+
+  void RrCatalog::setServerFailureBackoff(const ServerName &server, const FailureBackoff &backoff)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    if (backoff.initial_.count() > 0)
+    {
+      server_backoff_[server] = backoff;
+    }
+    else
+    {
+      server_backoff_.erase(server);
+      clearFailures(server);
+    }
+  }
+
+  bool RrCatalog::cachedFailure(const ServerName &server,
+                                const RawData &request_data,
+                                resource_registrar::TemotoErrorStack &error)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    auto failed = failed_requests_.find(requestDigest(server, request_data));
+    if (failed == failed_requests_.end() ||
+        failed->second.server_ != server ||
+        failed->second.raw_request_ != request_data)
+    {
+      return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= failed->second.expires_)
+    {
+      failed_requests_.erase(failed);
+      return false;
+    }
+    if (now >= failed->second.retry_at_)
+    {
+      return false;
+    }
+
+    error = resource_registrar::TemotoErrorStack(failed->second.serialized_error_);
+    return true;
+  }
+
+  void RrCatalog::storeFailure(const ServerName &server,
+                               const RawData &request_data,
+                               const resource_registrar::TemotoErrorStack &error)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    auto backoff = server_backoff_.find(server);
+    if (backoff == server_backoff_.end())
+    {
+      return;
+    }
+
+    FailedRequest &failed = failed_requests_[requestDigest(server, request_data)];
+    if (failed.server_ != server || failed.raw_request_ != request_data)
+    {
+      // new entry, or a digest collision that replaces the older request
+      failed = FailedRequest{server, request_data, "", 0, {}, {}};
+    }
+
+    std::chrono::milliseconds delay = backoff->second.initial_;
+    for (unsigned int i = 0; i < failed.failures_ && delay < backoff->second.max_; i++)
+    {
+      delay *= 2;
+    }
+    delay = std::min(delay, backoff->second.max_);
+
+    auto now = std::chrono::steady_clock::now();
+    failed.failures_++;
+    failed.serialized_error_ = resource_registrar::TemotoErrorStack(error).serialize();
+    failed.retry_at_ = now + delay;
+    failed.expires_ = now + backoff->second.ttl_;
+  }
+
+  void RrCatalog::clearFailures(const ServerName &server)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    for (auto it = failed_requests_.begin(); it != failed_requests_.end();)
+    {
+      if (it->second.server_ == server)
+      {
+        it = failed_requests_.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
   QueryContainer<RawData> RrCatalog::findOriginalContainer(const std::string &id)
   {
     std::cout << "findOriginalContainer: " << id << std::endl;
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
-    for (auto const &query_entry : id_query_map_)
+    auto indexed = id_request_index_.find(id);
+    if (indexed != id_request_index_.end())
     {
-      if (query_entry.second.rr_ids_.count(id))
+      auto query_entry = id_query_map_.find(indexed->second);
+      if (query_entry != id_query_map_.end() && query_entry->second.rr_ids_.count(id))
       {
-        std::cout << "Found!: " << query_entry.second.q_.id() << std::endl;
-        return query_entry.second;
+        std::cout << "Found!: " << query_entry->second.q_.id() << std::endl;
+        return query_entry->second;
       }
     }
     std::cout << "Not found! Returning raw container" << std::endl;
@@ -164,17 +455,27 @@ namespace temoto_resource_registrar
   ServerName RrCatalog::getIdServer(const std::string &id)
   {
     std::cout << "getIdServer: " << id << std::endl;
+    {
+      std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+      auto released = releasing_.find(id);
+      if (released != releasing_.end())
+      {
+        return released->second.responsible_server_;
+      }
+    }
     return findOriginalContainer(id).responsible_server_;
   }
 
   std::unordered_map<UUID, std::string> RrCatalog::getAllQueryIds(const std::string &id)
   {
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
-    for (auto const &query_entry : id_query_map_)
+    auto indexed = id_request_index_.find(id);
+    if (indexed != id_request_index_.end())
     {
-      if (query_entry.second.rr_ids_.count(id))
+      auto query_entry = id_query_map_.find(indexed->second);
+      if (query_entry != id_query_map_.end() && query_entry->second.rr_ids_.count(id))
       {
-        return query_entry.second.rr_ids_;
+        return query_entry->second.rr_ids_;
       }
     }
     std::unordered_map<UUID, std::string> empty_map;
@@ -186,7 +487,9 @@ namespace temoto_resource_registrar
                                   const std::string &dependency_id)
   {
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    generation_++;
     id_dependency_map_[query_id].registerDependency(dependency_source, dependency_id);
+    publish(CatalogEvent::Type::DEPENDENCY_ADDED, dependency_source, query_id, dependency_id);
   }
 
   std::unordered_map<UUID, std::string> RrCatalog::getDependencies(const std::string &query_id)
@@ -203,11 +506,24 @@ namespace temoto_resource_registrar
                                    const std::string &dependency_id)
   {
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
-    id_dependency_map_[query_id].removeDependency(dependency_id);
+    generation_++;
+    auto container = id_dependency_map_.find(query_id);
+    if (container == id_dependency_map_.end())
+    {
+      return;
+    }
+
+    const std::string *dependency_rr = container->second.findDependency(dependency_id);
+    if (dependency_rr != NULL)
+    {
+      std::string rr = *dependency_rr;
+      container->second.removeDependency(dependency_id);
+      publish(CatalogEvent::Type::DEPENDENCY_REMOVED, rr, query_id, dependency_id);
+    }
 
-    if (!id_dependency_map_[query_id].count())
+    if (!container->second.count())
     {
-      id_dependency_map_.erase(query_id);
+      id_dependency_map_.erase(container);
     }
   }
 
@@ -228,6 +544,7 @@ namespace temoto_resource_registrar
                                         const std::string &id)
   {
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    generation_++;
     client_id_map_[client].insert(id);
   }
 
@@ -287,6 +604,205 @@ namespace temoto_resource_registrar
     throw ElementNotFoundException("Server not found");
   }
 
+  std::string RrCatalog::visitServerQueries(const ServerName &server,
+                                            const RrName &origin_rr,
+                                            const std::string &cursor,
+                                            std::size_t limit,
+                                            DataProjection projection,
+                                            const QuerySink &sink)
+  {
+    static const RawData EMPTY;
+
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    auto server_ids = server_id_map_.find(server);
+    if (server_ids == server_id_map_.end())
+    {
+      throw ElementNotFoundException("Server not found");
+    }
+
+    // a resource is visited at its smallest id, which keeps it on a single page
+    std::unordered_map<const QueryContainer<RawData> *, UUID> first_ids;
+    std::size_t visited = 0;
+
+    for (auto id = server_ids->second.upper_bound(cursor); id != server_ids->second.end(); id++)
+    {
+      auto indexed = id_request_index_.find(*id);
+      if (indexed == id_request_index_.end())
+      {
+        continue;
+      }
+      auto query_entry = id_query_map_.find(indexed->second);
+      if (query_entry == id_query_map_.end())
+      {
+        continue;
+      }
+
+      QueryContainer<RawData> &container = query_entry->second;
+      auto first_id = first_ids.find(&container);
+      if (first_id == first_ids.end())
+      {
+        UUID smallest = *id;
+        for (const auto &container_id : container.rr_ids_)
+        {
+          smallest = std::min(smallest, container_id.first);
+        }
+        first_id = first_ids.emplace(&container, smallest).first;
+      }
+
+      if (first_id->second != *id || container.q_.origin() != origin_rr)
+      {
+        continue;
+      }
+
+      if (limit > 0 && visited == limit)
+      {
+        return *std::prev(id);
+      }
+
+      sink(container.q_.id(),
+           projection == DataProjection::RESPONSE ? EMPTY : container.raw_request_,
+           projection == DataProjection::REQUEST ? EMPTY : container.raw_query_);
+      visited++;
+    }
+
+    return "";
+  }
+
+  std::uint64_t RrCatalog::generation()
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    return generation_;
+  }
+
+  DataDelta RrCatalog::fetchChanges(const ServerName &server, const RrName &origin_rr, std::uint64_t since, DataProjection projection)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+
+    DataDelta delta;
+    delta.generation_ = generation_;
+
+    auto history = histories_.find(server);
+    if (since == 0 || since < history_horizon_ || since > generation_ ||
+        (history != histories_.end() && since < history->second.horizon_))
+    {
+      delta.reset_ = true;
+      try
+      {
+        visitServerQueries(server, origin_rr, "", 0, projection, [&delta](const UUID &id, const RawData &request, const RawData &response) {
+          delta.changed_.emplace_back(id, std::make_pair(request, response));
+        });
+      }
+      catch (const ElementNotFoundException &)
+      {
+        // no resources left
+      }
+      return delta;
+    }
+
+    if (history == histories_.end())
+    {
+      return delta;
+    }
+
+    for (auto change = history->second.changes_.upper_bound(since); change != history->second.changes_.end(); change++)
+    {
+      if (change->second.origin_ != origin_rr)
+      {
+        continue;
+      }
+
+      if (change->second.removed_)
+      {
+        delta.removed_.push_back(change->second.id_);
+        continue;
+      }
+
+      auto query_entry = id_query_map_.find(change->second.request_);
+      if (query_entry != id_query_map_.end())
+      {
+        delta.changed_.emplace_back(change->second.id_,
+                                    std::make_pair(projection == DataProjection::RESPONSE ? "" : query_entry->second.raw_request_,
+                                                   projection == DataProjection::REQUEST ? "" : query_entry->second.raw_query_));
+      }
+    }
+    return delta;
+  }
+
+  void RrCatalog::setTombstoneLimit(std::size_t limit)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    tombstone_limit_ = limit;
+  }
+
+  void RrCatalog::recordChange(const ServerName &server, QueryContainer<RawData> &container, bool removed)
+  {
+    ServerHistory &history = histories_[server];
+    UUID id = container.q_.id();
+
+    auto latest = history.latest_.find(id);
+    if (latest != history.latest_.end())
+    {
+      history.changes_.erase(latest->second);
+      history.tombstones_.erase(latest->second);
+    }
+
+    generation_++;
+    history.changes_[generation_] = ResourceChange{id, container.q_.origin(), removed ? "" : container.raw_request_, removed};
+    history.latest_[id] = generation_;
+
+    if (removed)
+    {
+      history.tombstones_.insert(generation_);
+      while (history.tombstones_.size() > tombstone_limit_)
+      {
+        std::uint64_t oldest = *history.tombstones_.begin();
+        history.latest_.erase(history.changes_[oldest].id_);
+        history.changes_.erase(oldest);
+        history.tombstones_.erase(history.tombstones_.begin());
+        history.horizon_ = oldest;
+      }
+    }
+  }
+
+  void RrCatalog::resetHistory()
+  {
+    histories_.clear();
+    history_horizon_ = ++generation_;
+    publish(CatalogEvent::Type::CATALOG_REPLACED, "", "");
+  }
+
+  void RrCatalog::publish(CatalogEvent::Type type, const std::string &server, const UUID &id, const UUID &related_id)
+  {
+    if (!feed_)
+    {
+      return;
+    }
+
+    CatalogEvent event;
+    event.type_ = type;
+    event.generation_ = generation_;
+    event.server_ = server;
+    event.id_ = id;
+    event.related_id_ = related_id;
+    feed_->publish(event);
+  }
+
+  CatalogSubscription RrCatalog::subscribe()
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    if (!feed_)
+    {
+      feed_ = std::make_shared<CatalogFeed>(feed_capacity_);
+    }
+    return CatalogSubscription(feed_, feed_->head());
+  }
+
+  void RrCatalog::setFeedCapacity(std::size_t capacity)
+  {
+    std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
+    feed_capacity_ = capacity;
+  }
+
   void RrCatalog::storeServerRr(const ServerName &server, const RrName &rr)
   {
     std::lock_guard<std::recursive_mutex> lock(modify_mutex_);
@@ -0,0 +1,181 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "temoto_resource_registrar/rr_catalog_feed.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace temoto_resource_registrar
+{
+  static constexpr std::size_t WORD_SIZE = sizeof(std::uint64_t);
+
+  static void appendString(std::string &record, const std::string &value)
+  {
+    std::uint32_t size = value.size();
+    record.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    record.append(value);
+  }
+
+  static const char *takeString(const char *data, std::string &value)
+  {
+    std::uint32_t size;
+    std::memcpy(&size, data, sizeof(size));
+    value.assign(data + sizeof(size), size);
+    return data + sizeof(size) + size;
+  }
+
+  CatalogFeed::CatalogFeed(std::size_t capacity)
+      : words_(std::max<std::size_t>(capacity / WORD_SIZE, 16)),
+        ring_(new std::atomic<std::uint64_t>[words_]),
+        reserved_(0),
+        head_(0)
+  {
+    for (std::size_t i = 0; i < words_; i++)
+    {
+      ring_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  std::atomic<std::uint64_t> &CatalogFeed::word(std::uint64_t position) const
+  {
+    return ring_[(position / WORD_SIZE) % words_];
+  }
+
+  void CatalogFeed::publish(const CatalogEvent &event)
+  {
+    record_.clear();
+    record_.push_back(static_cast<char>(event.type_));
+    record_.append(reinterpret_cast<const char *>(&event.generation_), sizeof(event.generation_));
+    appendString(record_, event.server_);
+    appendString(record_, event.id_);
+    appendString(record_, event.related_id_);
+
+    std::uint64_t capacity = words_ * WORD_SIZE;
+    std::uint64_t payload_words = (record_.size() + WORD_SIZE - 1) / WORD_SIZE;
+    std::uint64_t size = WORD_SIZE * (1 + payload_words);
+    std::uint64_t head = head_.load(std::memory_order_relaxed);
+
+    if (size > capacity)
+    {
+      // does not fit, skip a whole ring so that every reader notices the loss
+      reserved_.store(head + capacity + WORD_SIZE, std::memory_order_relaxed);
+      head_.store(head + capacity + WORD_SIZE, std::memory_order_release);
+      return;
+    }
+
+    // readers that copied any of the overwritten words see the new reservation after their copy
+    reserved_.store(head + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    word(head).store(record_.size(), std::memory_order_relaxed);
+    for (std::uint64_t i = 0; i < payload_words; i++)
+    {
+      std::uint64_t value = 0;
+      std::memcpy(&value, record_.data() + i * WORD_SIZE, std::min<std::size_t>(WORD_SIZE, record_.size() - i * WORD_SIZE));
+      word(head + WORD_SIZE * (1 + i)).store(value, std::memory_order_relaxed);
+    }
+
+    head_.store(head + size, std::memory_order_release);
+  }
+
+  std::uint64_t CatalogFeed::head() const
+  {
+    return head_.load(std::memory_order_acquire);
+  }
+
+  bool CatalogFeed::read(std::uint64_t &cursor, std::vector<CatalogEvent> &events, std::size_t max_events) const
+  {
+    std::uint64_t capacity = words_ * WORD_SIZE;
+    std::string record;
+
+    for (std::size_t count = 0; max_events == 0 || count < max_events; count++)
+    {
+      std::uint64_t head = head_.load(std::memory_order_acquire);
+      if (cursor == head)
+      {
+        return true;
+      }
+      if (head - cursor > capacity)
+      {
+        cursor = head;
+        return false;
+      }
+
+      // the copy is only trusted if the writer did not reserve the words in the meantime
+      std::uint64_t record_size = word(cursor).load(std::memory_order_relaxed);
+      std::uint64_t payload_words = (record_size + WORD_SIZE - 1) / WORD_SIZE;
+      bool sane = record_size >= 1 + sizeof(std::uint64_t) + 3 * sizeof(std::uint32_t) &&
+                  WORD_SIZE * (1 + payload_words) <= capacity;
+      if (sane)
+      {
+        record.resize(payload_words * WORD_SIZE);
+        for (std::uint64_t i = 0; i < payload_words; i++)
+        {
+          std::uint64_t value = word(cursor + WORD_SIZE * (1 + i)).load(std::memory_order_relaxed);
+          std::memcpy(&record[i * WORD_SIZE], &value, WORD_SIZE);
+        }
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!sane || reserved_.load(std::memory_order_relaxed) - cursor > capacity)
+      {
+        cursor = head_.load(std::memory_order_acquire);
+        return false;
+      }
+
+      CatalogEvent event;
+      const char *data = record.data();
+      event.type_ = static_cast<CatalogEvent::Type>(data[0]);
+      std::memcpy(&event.generation_, data + 1, sizeof(event.generation_));
+      data = takeString(data + 1 + sizeof(event.generation_), event.server_);
+      data = takeString(data, event.id_);
+      takeString(data, event.related_id_);
+      events.push_back(std::move(event));
+
+      cursor += WORD_SIZE * (1 + payload_words);
+    }
+    return true;
+  }
+
+  CatalogSubscription::CatalogSubscription(std::shared_ptr<const CatalogFeed> feed, std::uint64_t cursor)
+      : feed_(std::move(feed)),
+        cursor_(cursor)
+  {
+  }
+
+  std::size_t CatalogSubscription::poll(std::vector<CatalogEvent> &events, std::size_t max_events)
+  {
+    if (!feed_)
+    {
+      return 0;
+    }
+
+    std::size_t before = events.size();
+    if (!feed_->read(cursor_, events, max_events))
+    {
+      overflows_++;
+      events.push_back(CatalogEvent());
+    }
+    return events.size() - before;
+  }
+
+  std::uint64_t CatalogSubscription::overflows() const
+  {
+    return overflows_;
+  }
+
+} // namespace temoto_resource_registrar
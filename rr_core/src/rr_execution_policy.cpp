@@ -0,0 +1,112 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "temoto_resource_registrar/rr_execution_policy.h"
+
+#include <algorithm>
+
+namespace temoto_resource_registrar
+{
+  bool AdmissionGate::Waiter::precedes(const Waiter &other) const
+  {
+    if (priority_ != other.priority_)
+    {
+      return priority_ > other.priority_;
+    }
+
+    // callers without a deadline come after the ones that have one
+    bool has_deadline = deadline_.time_since_epoch().count() != 0;
+    bool other_has_deadline = other.deadline_.time_since_epoch().count() != 0;
+    if (has_deadline != other_has_deadline)
+    {
+      return has_deadline;
+    }
+    if (has_deadline && deadline_ != other.deadline_)
+    {
+      return deadline_ < other.deadline_;
+    }
+
+    return sequence_ < other.sequence_;
+  }
+
+  AdmissionGate::AdmissionGate(std::size_t limit) : limit_(std::max<std::size_t>(limit, 1)), next_sequence_(0)
+  {
+  }
+
+  bool AdmissionGate::acquire(int priority, const std::chrono::system_clock::time_point &deadline)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (metrics_.running_ < limit_ && waiters_.empty())
+    {
+      metrics_.admitted_++;
+      metrics_.running_++;
+      return true;
+    }
+
+    Waiter waiter{priority, deadline, next_sequence_++, false};
+    waiters_.push_back(&waiter);
+    metrics_.queued_++;
+    metrics_.max_queued_ = std::max(metrics_.max_queued_, metrics_.queued_);
+
+    auto wait_start = std::chrono::steady_clock::now();
+    auto is_admitted = [&waiter] { return waiter.admitted_; };
+    if (deadline.time_since_epoch().count() == 0)
+    {
+      admitted_cv_.wait(lock, is_admitted);
+    }
+    else if (!admitted_cv_.wait_until(lock, deadline, is_admitted))
+    {
+      waiters_.erase(std::find(waiters_.begin(), waiters_.end(), &waiter));
+      metrics_.queued_--;
+      metrics_.expired_++;
+      return false;
+    }
+
+    auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wait_start);
+    metrics_.admitted_++;
+    metrics_.total_wait_ += waited;
+    metrics_.max_wait_ = std::max(metrics_.max_wait_, waited);
+    return true;
+  }
+
+  void AdmissionGate::release()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (waiters_.empty())
+    {
+      metrics_.running_--;
+      return;
+    }
+
+    // the slot is handed over directly, so the number of running holders does not change
+    auto next = std::min_element(waiters_.begin(), waiters_.end(), [](const Waiter *a, const Waiter *b) {
+      return a->precedes(*b);
+    });
+    (*next)->admitted_ = true;
+    waiters_.erase(next);
+    metrics_.queued_--;
+    admitted_cv_.notify_all();
+  }
+
+  QueueMetrics AdmissionGate::metrics() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return metrics_;
+  }
+
+} // namespace temoto_resource_registrar
@@ -0,0 +1,171 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "temoto_resource_registrar/rr_lease.h"
+
+#include <algorithm>
+
+namespace temoto_resource_registrar
+{
+  constexpr unsigned int LeaseWheel::SLOT_BITS;
+  constexpr std::size_t LeaseWheel::SLOT_COUNT;
+  constexpr std::size_t LeaseWheel::LEVEL_COUNT;
+
+  LeaseWheel::LeaseWheel(std::chrono::milliseconds tick, Clock::time_point start)
+      : tick_(std::max(tick, std::chrono::milliseconds(1))),
+        start_(start),
+        current_tick_(0),
+        next_generation_(0)
+  {
+  }
+
+  void LeaseWheel::renew(const std::string &id, std::chrono::milliseconds ttl, Clock::time_point now)
+  {
+    // round up, a lease never expires early
+    auto since_start = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_) + ttl;
+    std::uint64_t expiry_tick = since_start.count() > 0 ? (since_start.count() + tick_.count() - 1) / tick_.count() : 0;
+    expiry_tick = std::max(expiry_tick, current_tick_ + 1);
+
+    auto lease = leases_.find(id);
+    if (lease != leases_.end() && lease->second.expiry_tick_ == expiry_tick)
+    {
+      return;
+    }
+
+    Lease renewed{expiry_tick, next_generation_++};
+    leases_[id] = renewed;
+    place(id, renewed);
+  }
+
+  bool LeaseWheel::remove(const std::string &id)
+  {
+    return leases_.erase(id) > 0;
+  }
+
+  bool LeaseWheel::contains(const std::string &id) const
+  {
+    return leases_.count(id) > 0;
+  }
+
+  std::size_t LeaseWheel::size() const
+  {
+    return leases_.size();
+  }
+
+  std::vector<std::string> LeaseWheel::advance(Clock::time_point now)
+  {
+    std::vector<std::string> expired;
+    if (now < start_)
+    {
+      return expired;
+    }
+    std::uint64_t target_tick = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_).count() / tick_.count();
+
+    while (current_tick_ < target_tick)
+    {
+      current_tick_++;
+
+      // refill the lower levels from the highest level that wrapped around
+      std::size_t wrapped = 0;
+      while (wrapped + 1 < LEVEL_COUNT && (current_tick_ & ((std::uint64_t(1) << (SLOT_BITS * (wrapped + 1))) - 1)) == 0)
+      {
+        wrapped++;
+      }
+      for (std::size_t level = wrapped; level > 0; level--)
+      {
+        cascade(level);
+      }
+
+      Slot due;
+      due.swap(levels_[0][current_tick_ & (SLOT_COUNT - 1)]);
+      for (const auto &entry : due)
+      {
+        auto lease = leases_.find(entry.first);
+        if (lease == leases_.end() || lease->second.generation_ != entry.second)
+        {
+          continue;
+        }
+
+        if (lease->second.expiry_tick_ <= current_tick_)
+        {
+          expired.push_back(entry.first);
+          leases_.erase(lease);
+        }
+        else
+        {
+          place(lease->first, lease->second);
+        }
+      }
+
+      if (leases_.empty())
+      {
+        // nothing left to expire, skip the idle ticks
+        for (auto &level : levels_)
+        {
+          for (auto &slot : level)
+          {
+            slot.clear();
+          }
+        }
+        current_tick_ = target_tick;
+      }
+    }
+
+    return expired;
+  }
+
+  LeaseWheel::Clock::time_point LeaseWheel::nextTick() const
+  {
+    return start_ + tick_ * (current_tick_ + 1);
+  }
+
+  void LeaseWheel::place(const std::string &id, const Lease &lease)
+  {
+    // a cascaded lease that is due now goes to the level 0 slot that is processed next
+    std::uint64_t delta = lease.expiry_tick_ > current_tick_ ? lease.expiry_tick_ - current_tick_ : 0;
+    std::uint64_t expiry_tick = current_tick_ + delta;
+
+    std::size_t level = 0;
+    while (level + 1 < LEVEL_COUNT && delta >= (std::uint64_t(1) << (SLOT_BITS * (level + 1))))
+    {
+      level++;
+    }
+
+    // leases beyond the range of the wheel are parked in the furthest slot and placed again from there
+    std::uint64_t range = std::uint64_t(1) << (SLOT_BITS * LEVEL_COUNT);
+    if (delta >= range)
+    {
+      expiry_tick = current_tick_ + range - 1;
+    }
+
+    levels_[level][(expiry_tick >> (SLOT_BITS * level)) & (SLOT_COUNT - 1)].emplace_back(id, lease.generation_);
+  }
+
+  void LeaseWheel::cascade(std::size_t level)
+  {
+    Slot slot;
+    slot.swap(levels_[level][(current_tick_ >> (SLOT_BITS * level)) & (SLOT_COUNT - 1)]);
+    for (const auto &entry : slot)
+    {
+      auto lease = leases_.find(entry.first);
+      if (lease != leases_.end() && lease->second.generation_ == entry.second)
+      {
+        place(lease->first, lease->second);
+      }
+    }
+  }
+
+} // namespace temoto_resource_registrar
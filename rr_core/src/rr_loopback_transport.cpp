@@ -0,0 +1,207 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "temoto_resource_registrar/rr_loopback_transport.h"
+
+#include <algorithm>
+
+namespace temoto_resource_registrar
+{
+  LoopbackNetwork::LoopbackNetwork(std::uint64_t seed)
+      : random_(seed), next_sequence_(0), stopping_(false), delivering_(NULL)
+  {
+    delivery_thread_ = std::thread(&LoopbackNetwork::deliveryLoop, this);
+  }
+
+  LoopbackNetwork::~LoopbackNetwork()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    delivery_cv_.notify_all();
+    delivery_thread_.join();
+  }
+
+  void LoopbackNetwork::setLinkProfile(const LinkProfile &profile)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    default_profile_ = profile;
+  }
+
+  void LoopbackNetwork::setLinkProfile(const std::string &from, const std::string &to, const LinkProfile &profile)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    profiles_[std::make_pair(from, to)] = profile;
+  }
+
+  std::vector<HopTiming> LoopbackNetwork::hopTimings() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hop_timings_;
+  }
+
+  void LoopbackNetwork::clearHopTimings()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hop_timings_.clear();
+  }
+
+  void LoopbackNetwork::attach(LoopbackTransport *endpoint)
+  {
+    std::lock_guard<std::mutex> lock(endpoints_mutex_);
+    if (!endpoints_.emplace(endpoint->name(), endpoint).second)
+    {
+      throw resource_registrar::TemotoErrorStack("endpoint '" + endpoint->name() + "' already exists", "LoopbackNetwork");
+    }
+  }
+
+  void LoopbackNetwork::detach(LoopbackTransport *endpoint)
+  {
+    std::unique_lock<std::mutex> lock(endpoints_mutex_);
+    endpoints_.erase(endpoint->name());
+
+    // waits for a delivery to the endpoint that is in progress, unless the endpoint is detached by it
+    if (std::this_thread::get_id() != delivery_thread_.get_id())
+    {
+      delivered_cv_.wait(lock, [this, endpoint] { return delivering_ != endpoint; });
+    }
+  }
+
+  void LoopbackNetwork::transmit(const std::string &from, const std::string &target, std::string data)
+  {
+    {
+      std::lock_guard<std::mutex> lock(endpoints_mutex_);
+      if (endpoints_.count(target) == 0)
+      {
+        throw resource_registrar::TemotoErrorStack("could not reach '" + target + "'", from);
+      }
+    }
+
+    Clock::time_point now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto link_id = std::make_pair(from, target);
+    auto profile = profiles_.find(link_id);
+    const LinkProfile &link_profile = profile != profiles_.end() ? profile->second : default_profile_;
+    Link &link = links_[link_id];
+
+    // the frame waits for the frames ahead of it on the link, then takes its own transmission time
+    Clock::time_point transmitted = std::max(now, link.idle_at_);
+    if (link_profile.bandwidth_ > 0)
+    {
+      transmitted += std::chrono::microseconds(data.size() * 1000000 / link_profile.bandwidth_);
+    }
+    link.idle_at_ = transmitted;
+
+    // the modulo keeps the drawn delays identical across standard library implementations
+    std::chrono::microseconds jitter(0);
+    if (link_profile.jitter_.count() > 0)
+    {
+      jitter = std::chrono::microseconds(random_() % (link_profile.jitter_.count() + 1));
+    }
+
+    Clock::time_point deliver_at = std::max(transmitted + link_profile.latency_ + jitter, link.last_delivery_);
+    link.last_delivery_ = deliver_at;
+
+    deliveries_.push(Delivery{deliver_at, next_sequence_++, now, from, target, std::move(data)});
+    delivery_cv_.notify_one();
+  }
+
+  void LoopbackNetwork::deliveryLoop()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+      delivery_cv_.wait(lock, [this] { return stopping_ || !deliveries_.empty(); });
+      if (stopping_)
+      {
+        return;
+      }
+
+      Clock::time_point deliver_at = deliveries_.top().deliver_at_;
+      if (Clock::now() < deliver_at)
+      {
+        // an earlier frame may be queued in the meantime
+        delivery_cv_.wait_until(lock, deliver_at);
+        continue;
+      }
+
+      Delivery delivery = std::move(const_cast<Delivery &>(deliveries_.top()));
+      deliveries_.pop();
+      lock.unlock();
+
+      TransportFrame frame;
+      TransportFrame::decode(delivery.data_.data(), delivery.data_.size(), frame);
+      HopTiming timing{delivery.from_,
+                       delivery.target_,
+                       frame.type_,
+                       frame.kind_,
+                       delivery.data_.size(),
+                       std::chrono::duration_cast<std::chrono::microseconds>(delivery.deliver_at_ - delivery.sent_at_),
+                       std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - delivery.sent_at_)};
+
+      {
+        // recorded first, a response completes a request whose caller may look at the timings right away
+        std::lock_guard<std::mutex> timings_lock(mutex_);
+        hop_timings_.push_back(std::move(timing));
+      }
+
+      std::unique_lock<std::mutex> endpoints_lock(endpoints_mutex_);
+      auto endpoint = endpoints_.find(delivery.target_);
+      if (endpoint != endpoints_.end())
+      {
+        LoopbackTransport *target = endpoint->second;
+        delivering_ = target;
+        endpoints_lock.unlock();
+        target->deliver(std::move(frame));
+        endpoints_lock.lock();
+        delivering_ = NULL;
+        delivered_cv_.notify_all();
+      }
+      endpoints_lock.unlock();
+
+      lock.lock();
+    }
+  }
+
+  LoopbackTransport::LoopbackTransport(const std::string &name, const std::shared_ptr<LoopbackNetwork> &network)
+      : Transport(name), network_(network)
+  {
+    network_->attach(this);
+  }
+
+  LoopbackTransport::~LoopbackTransport()
+  {
+    serve(NULL);
+    network_->detach(this);
+    failPendingRequests("transport of '" + name() + "' was shut down");
+  }
+
+  void LoopbackTransport::send(const std::string &target, const TransportFrame &frame)
+  {
+    std::string data;
+    frame.encode(data);
+    network_->transmit(name(), target, std::move(data));
+  }
+
+  void LoopbackTransport::deliver(TransportFrame frame)
+  {
+    receive(std::move(frame));
+  }
+
+} // namespace temoto_resource_registrar
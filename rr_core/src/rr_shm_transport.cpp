@@ -0,0 +1,462 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "temoto_resource_registrar/rr_shm_transport.h"
+#include "temoto_resource_registrar/temoto_logging.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace temoto_resource_registrar
+{
+  static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+                "the ring buffer needs lock free atomics that work across processes");
+
+  struct ShmTransport::Ring
+  {
+    static constexpr std::uint32_t MAGIC = 0x52524d54;
+
+    // set once the ring is initialized, cleared when its owner shuts down
+    std::atomic<std::uint32_t> magic_;
+    std::uint32_t capacity_;
+
+    // process that reads the ring, written before anything else once the ring is sized
+    pid_t owner_;
+
+    // serializes the writers
+    pthread_mutex_t write_mutex_;
+
+    // positions of the last frame a writer started, under write_mutex_. A writer that died or gave up
+    // before its end leaves the rest to the next writer, which pads the frame out
+    std::uint64_t frame_start_;
+    std::uint64_t frame_end_;
+
+    // end of the last frame that was padded out, the reader drops that frame
+    std::atomic<std::uint64_t> broken_end_;
+
+    // bytes written and read since the ring was created
+    std::atomic<std::uint64_t> head_;
+    std::atomic<std::uint64_t> tail_;
+
+    // futex words, bumped whenever data is written or space is freed
+    std::atomic<std::uint32_t> data_seq_;
+    std::atomic<std::uint32_t> space_seq_;
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  constexpr std::uint32_t ShmTransport::Ring::MAGIC;
+
+  namespace
+  {
+    void futexWait(std::atomic<std::uint32_t> &word, std::uint32_t expected, std::chrono::milliseconds timeout)
+    {
+      timespec ts;
+      ts.tv_sec = timeout.count() / 1000;
+      ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+      syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT, expected, &ts, NULL, 0);
+    }
+
+    void futexWake(std::atomic<std::uint32_t> &word)
+    {
+      syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+
+    void lockRobust(pthread_mutex_t *mutex)
+    {
+      // a writer died while holding the lock, the frame it was writing is padded out by the caller
+      if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+      {
+        pthread_mutex_consistent(mutex);
+      }
+    }
+
+    void copyIn(char *ring_data, std::size_t capacity, std::uint64_t position, const char *source, std::size_t size)
+    {
+      std::size_t offset = position % capacity;
+      std::size_t first = std::min(size, capacity - offset);
+      std::memcpy(ring_data + offset, source, first);
+      std::memcpy(ring_data, source + first, size - first);
+    }
+
+    void copyOut(const char *ring_data, std::size_t capacity, std::uint64_t position, char *destination, std::size_t size)
+    {
+      std::size_t offset = position % capacity;
+      std::size_t first = std::min(size, capacity - offset);
+      std::memcpy(destination, ring_data + offset, first);
+      std::memcpy(destination + first, ring_data, size - first);
+    }
+  } // namespace
+
+  ShmTransport::ShmTransport(const std::string &name, std::size_t capacity)
+      : Transport(name), inbox_name_(segmentName(name)), stopping_(false)
+  {
+    int fd = shm_open(inbox_name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+      // a previous instance that crashed may have left its inbox behind, a running one keeps it. An inbox
+      // without an owner may be in the middle of being created, it is only taken over if it stays that way
+      pid_t owner = inboxOwner(inbox_name_);
+      for (int i = 0; i < 10 && owner == 0; i++)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        owner = inboxOwner(inbox_name_);
+      }
+      if (processAlive(owner))
+      {
+        throw resource_registrar::TemotoErrorStack("'" + inbox_name_ + "' is in use by a running endpoint", name);
+      }
+      shm_unlink(inbox_name_.c_str());
+      fd = shm_open(inbox_name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    }
+    if (fd < 0)
+    {
+      throw resource_registrar::TemotoErrorStack("could not create '" + inbox_name_ + "': " + std::strerror(errno), name);
+    }
+
+    inbox_.size_ = sizeof(Ring) + capacity;
+    if (ftruncate(fd, inbox_.size_) != 0)
+    {
+      close(fd);
+      shm_unlink(inbox_name_.c_str());
+      throw resource_registrar::TemotoErrorStack("could not size '" + inbox_name_ + "': " + std::strerror(errno), name);
+    }
+
+    void *memory = mmap(NULL, inbox_.size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+      shm_unlink(inbox_name_.c_str());
+      throw resource_registrar::TemotoErrorStack("could not map '" + inbox_name_ + "': " + std::strerror(errno), name);
+    }
+
+    inbox_.ring_ = new (memory) Ring;
+    inbox_.ring_->owner_ = getpid();
+    inbox_.ring_->capacity_ = capacity;
+    inbox_.ring_->frame_start_ = 0;
+    inbox_.ring_->frame_end_ = 0;
+    inbox_.ring_->broken_end_ = 0;
+    inbox_.ring_->head_ = 0;
+    inbox_.ring_->tail_ = 0;
+    inbox_.ring_->data_seq_ = 0;
+    inbox_.ring_->space_seq_ = 0;
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&inbox_.ring_->write_mutex_, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    inbox_.ring_->magic_.store(Ring::MAGIC, std::memory_order_release);
+
+    receiver_ = std::thread(&ShmTransport::receiveLoop, this);
+  }
+
+  ShmTransport::~ShmTransport()
+  {
+    serve(NULL);
+
+    stopping_ = true;
+    inbox_.ring_->data_seq_++;
+    futexWake(inbox_.ring_->data_seq_);
+    receiver_.join();
+
+    failPendingRequests("transport of '" + name() + "' was shut down");
+
+    // writers that still have the inbox mapped notice it is gone
+    inbox_.ring_->magic_.store(0, std::memory_order_release);
+    inbox_.ring_->space_seq_++;
+    futexWake(inbox_.ring_->space_seq_);
+    munmap(inbox_.ring_, inbox_.size_);
+    shm_unlink(inbox_name_.c_str());
+
+    for (auto &peer : peers_)
+    {
+      munmap(peer.second.ring_, peer.second.size_);
+    }
+    for (auto &peer : retired_peers_)
+    {
+      munmap(peer.ring_, peer.size_);
+    }
+  }
+
+  std::string ShmTransport::segmentName(const std::string &rr)
+  {
+    std::string segment = "/temoto_rr_";
+    for (char c : rr)
+    {
+      segment.push_back(c == '/' ? '_' : c);
+    }
+    return segment;
+  }
+
+  pid_t ShmTransport::inboxOwner(const std::string &segment)
+  {
+    int fd = shm_open(segment.c_str(), O_RDONLY, 0600);
+    if (fd < 0)
+    {
+      return 0;
+    }
+
+    struct stat info;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(Ring))
+    {
+      memory = mmap(NULL, sizeof(Ring), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+      return 0;
+    }
+
+    pid_t owner = static_cast<Ring *>(memory)->owner_;
+    munmap(memory, sizeof(Ring));
+    return owner;
+  }
+
+  bool ShmTransport::processAlive(pid_t pid)
+  {
+    // a reused pid keeps the inbox as well, which fails safe
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+  }
+
+  ShmTransport::Mapping ShmTransport::openPeer(const std::string &target)
+  {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+
+    auto peer = peers_.find(target);
+    if (peer != peers_.end())
+    {
+      // a peer that crashed never cleared the magic of its inbox
+      if (peer->second.ring_->magic_.load(std::memory_order_acquire) == Ring::MAGIC && processAlive(peer->second.ring_->owner_))
+      {
+        return peer->second;
+      }
+      // the peer was restarted, its inbox is a new object. Other senders may still use the old mapping
+      retired_peers_.push_back(peer->second);
+      peers_.erase(peer);
+    }
+
+    std::string segment = segmentName(target);
+    int fd = shm_open(segment.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+    {
+      throw resource_registrar::TemotoErrorStack("'" + target + "' is not reachable: " + std::strerror(errno), name());
+    }
+
+    struct stat info;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) > sizeof(Ring))
+    {
+      memory = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+      throw resource_registrar::TemotoErrorStack("could not map the inbox of '" + target + "'", name());
+    }
+
+    Mapping mapping{static_cast<Ring *>(memory), static_cast<std::size_t>(info.st_size), info.st_ino};
+    if (mapping.ring_->magic_.load(std::memory_order_acquire) != Ring::MAGIC)
+    {
+      munmap(memory, mapping.size_);
+      throw resource_registrar::TemotoErrorStack("the inbox of '" + target + "' is not initialized", name());
+    }
+
+    peers_[target] = mapping;
+    return mapping;
+  }
+
+  bool ShmTransport::retireReplacedPeer(const std::string &target, const Mapping &mapping)
+  {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+
+    int fd = shm_open(segmentName(target).c_str(), O_RDONLY, 0600);
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct stat info;
+    bool replaced = fstat(fd, &info) == 0 && info.st_ino != mapping.inode_;
+    close(fd);
+
+    auto peer = peers_.find(target);
+    if (replaced && peer != peers_.end() && peer->second.ring_ == mapping.ring_)
+    {
+      retired_peers_.push_back(peer->second);
+      peers_.erase(peer);
+    }
+    return replaced;
+  }
+
+  bool ShmTransport::stream(Ring &ring, const char *data, std::size_t size)
+  {
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    std::size_t written = 0;
+    while (written < size)
+    {
+      std::uint32_t space_seq = ring.space_seq_.load(std::memory_order_acquire);
+      if (ring.magic_.load(std::memory_order_acquire) != Ring::MAGIC)
+      {
+        return false;
+      }
+
+      // the length prefix of a frame is published at once, the reader sizes the frame by it
+      std::uint64_t head = ring.head_.load(std::memory_order_relaxed);
+      std::uint64_t space = ring.capacity_ - (head - ring.tail_.load(std::memory_order_acquire));
+      std::size_t minimum = written == 0 ? std::min(size, sizeof(std::uint32_t)) : 1;
+      if (space < minimum)
+      {
+        if (std::chrono::steady_clock::now() > give_up)
+        {
+          return false;
+        }
+        futexWait(ring.space_seq_, space_seq, std::chrono::milliseconds(100));
+        continue;
+      }
+
+      std::size_t part = std::min<std::uint64_t>(space, size - written);
+      copyIn(ring.data(), ring.capacity_, head, data + written, part);
+      written += part;
+      ring.head_.store(head + part, std::memory_order_release);
+
+      ring.data_seq_.fetch_add(1, std::memory_order_release);
+      futexWake(ring.data_seq_);
+      give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    }
+    return true;
+  }
+
+  void ShmTransport::send(const std::string &target, const TransportFrame &frame)
+  {
+    Mapping peer = openPeer(target);
+    Ring *ring = peer.ring_;
+
+    std::string buffer;
+    frame.encode(buffer);
+
+    lockRobust(&ring->write_mutex_);
+
+    // a writer that died or gave up in the middle of its frame keeps the reader waiting for the rest
+    bool written = true;
+    std::uint64_t head = ring->head_.load(std::memory_order_relaxed);
+    if (head > ring->frame_start_ && head < ring->frame_end_)
+    {
+      std::string padding(ring->frame_end_ - head, '\0');
+      ring->broken_end_.store(ring->frame_end_, std::memory_order_relaxed);
+      written = stream(*ring, padding.data(), padding.size());
+    }
+    if (written)
+    {
+      ring->frame_start_ = ring->head_.load(std::memory_order_relaxed);
+      ring->frame_end_ = ring->frame_start_ + buffer.size();
+      written = stream(*ring, buffer.data(), buffer.size());
+    }
+
+    pthread_mutex_unlock(&ring->write_mutex_);
+
+    if (written)
+    {
+      return;
+    }
+    if (ring->magic_.load(std::memory_order_acquire) != Ring::MAGIC)
+    {
+      throw resource_registrar::TemotoErrorStack("'" + target + "' was shut down", name());
+    }
+
+    // nobody reads the inbox of a peer that crashed, its restart created a new one
+    if (retireReplacedPeer(target, peer))
+    {
+      send(target, frame);
+      return;
+    }
+    throw resource_registrar::TemotoErrorStack("the inbox of '" + target + "' is full", name());
+  }
+
+  void ShmTransport::receiveLoop()
+  {
+    Ring *ring = inbox_.ring_;
+    std::string buffer;
+    // bytes of the frame in buffer that were taken from the ring so far
+    std::size_t received = 0;
+
+    while (!stopping_)
+    {
+      std::uint32_t data_seq = ring->data_seq_.load(std::memory_order_acquire);
+      std::uint64_t tail = ring->tail_.load(std::memory_order_relaxed);
+      std::uint64_t head = ring->head_.load(std::memory_order_acquire);
+      if (head == tail)
+      {
+        futexWait(ring->data_seq_, data_seq, std::chrono::milliseconds(100));
+        continue;
+      }
+
+      // the length prefix is published at once, the rest of a large frame may follow in parts
+      if (received == 0)
+      {
+        std::uint32_t length;
+        copyOut(ring->data(), ring->capacity_, tail, reinterpret_cast<char *>(&length), sizeof(length));
+        buffer.resize(sizeof(length) + length);
+      }
+      std::size_t part = std::min<std::uint64_t>(head - tail, buffer.size() - received);
+      copyOut(ring->data(), ring->capacity_, tail, &buffer[received], part);
+      received += part;
+
+      ring->tail_.store(tail + part, std::memory_order_release);
+      ring->space_seq_.fetch_add(1, std::memory_order_release);
+      futexWake(ring->space_seq_);
+
+      if (received < buffer.size())
+      {
+        continue;
+      }
+      received = 0;
+
+      if (tail + part == ring->broken_end_.load(std::memory_order_relaxed))
+      {
+        TEMOTO_WARN_("dropped a frame left unfinished by its writer in the inbox of '%s'", name().c_str());
+        continue;
+      }
+
+      TransportFrame frame;
+      try
+      {
+        TransportFrame::decode(buffer.data(), buffer.size(), frame);
+      }
+      catch (const resource_registrar::TemotoErrorStack &e)
+      {
+        // the sender of a malformed frame is unknown, so it cannot be answered
+        TEMOTO_WARN_("dropped a malformed frame in the inbox of '%s': %s", name().c_str(), e.what());
+        continue;
+      }
+      receive(std::move(frame));
+    }
+  }
+
+} // namespace temoto_resource_registrar
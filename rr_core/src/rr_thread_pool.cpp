@@ -0,0 +1,232 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "temoto_resource_registrar/rr_thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace temoto_resource_registrar
+{
+  namespace
+  {
+    // Pool and queue index of the worker running on this thread
+    thread_local ThreadPool *worker_pool = NULL;
+    thread_local std::size_t worker_index = 0;
+  } // namespace
+
+  ThreadPool::ThreadPool(std::size_t thread_count)
+      : pending_(0), next_queue_(0), stopping_(false)
+  {
+    thread_count = std::max<std::size_t>(thread_count, 1);
+
+    for (std::size_t i = 0; i < thread_count; i++)
+    {
+      queues_.push_back(std::make_unique<WorkQueue>());
+    }
+
+    for (std::size_t i = 0; i < thread_count; i++)
+    {
+      workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex_);
+      stopping_ = true;
+    }
+    wake_cv_.notify_all();
+
+    for (auto &worker : workers_)
+    {
+      worker.join();
+    }
+  }
+
+  void ThreadPool::submit(Task task)
+  {
+    std::size_t index = (worker_pool == this) ? worker_index : next_queue_++ % queues_.size();
+
+    {
+      std::lock_guard<std::mutex> lock(queues_[index]->mutex_);
+      queues_[index]->tasks_.push_back(std::move(task));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex_);
+      pending_++;
+    }
+    wake_cv_.notify_one();
+  }
+
+  bool ThreadPool::runPendingTask()
+  {
+    Task task;
+    if (!popTask((worker_pool == this) ? worker_index : 0, task))
+    {
+      return false;
+    }
+
+    task();
+    return true;
+  }
+
+  std::size_t ThreadPool::size() const
+  {
+    return workers_.size();
+  }
+
+  ThreadPool &ThreadPool::shared()
+  {
+    static ThreadPool pool(std::max<std::size_t>(std::thread::hardware_concurrency(), 4));
+    return pool;
+  }
+
+  bool ThreadPool::popTask(std::size_t start_index, Task &task)
+  {
+    // own queue is consumed from the back, the others are stolen from the front
+    {
+      WorkQueue &own = *queues_[start_index];
+      std::lock_guard<std::mutex> lock(own.mutex_);
+      if (!own.tasks_.empty())
+      {
+        task = std::move(own.tasks_.back());
+        own.tasks_.pop_back();
+        pending_--;
+        return true;
+      }
+    }
+
+    for (std::size_t i = 1; i < queues_.size(); i++)
+    {
+      WorkQueue &victim = *queues_[(start_index + i) % queues_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex_);
+      if (!victim.tasks_.empty())
+      {
+        task = std::move(victim.tasks_.front());
+        victim.tasks_.pop_front();
+        pending_--;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void ThreadPool::workerLoop(std::size_t index)
+  {
+    worker_pool = this;
+    worker_index = index;
+
+    while (true)
+    {
+      Task task;
+      if (popTask(index, task))
+      {
+        task();
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(wake_mutex_);
+      wake_cv_.wait(lock, [this] { return stopping_ || pending_ > 0; });
+      if (stopping_ && pending_ == 0)
+      {
+        return;
+      }
+    }
+  }
+
+  TaskGroup::TaskGroup(ThreadPool &pool) : pool_(pool), outstanding_(0)
+  {
+  }
+
+  TaskGroup::~TaskGroup()
+  {
+    join();
+  }
+
+  void TaskGroup::run(ThreadPool::Task task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      outstanding_++;
+    }
+
+    pool_.submit([this, task]() {
+      std::exception_ptr error;
+      try
+      {
+        task();
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (error && !first_error_)
+      {
+        first_error_ = error;
+      }
+      if (--outstanding_ == 0)
+      {
+        done_cv_.notify_all();
+      }
+    });
+  }
+
+  void TaskGroup::wait()
+  {
+    join();
+
+    std::exception_ptr error;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::swap(error, first_error_);
+    }
+
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  void TaskGroup::join()
+  {
+    while (true)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (outstanding_ == 0)
+        {
+          return;
+        }
+      }
+
+      if (pool_.runPendingTask())
+      {
+        continue;
+      }
+
+      // nothing to help with, the remaining tasks are running elsewhere
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_cv_.wait_for(lock, std::chrono::milliseconds(1), [this] { return outstanding_ == 0; });
+    }
+  }
+
+} // namespace temoto_resource_registrar
@@ -0,0 +1,366 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "temoto_resource_registrar/rr_transport.h"
+
+#include <cstring>
+#include <thread>
+
+namespace temoto_resource_registrar
+{
+  // kind, type, request id and sender length that precede the sender and the payload
+  static constexpr std::size_t FRAME_HEADER_SIZE = 1 + 1 + 8 + 4;
+
+  PayloadWriter &PayloadWriter::put(std::uint32_t value)
+  {
+    data_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    return *this;
+  }
+
+  PayloadWriter &PayloadWriter::put(std::uint64_t value)
+  {
+    data_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    return *this;
+  }
+
+  PayloadWriter &PayloadWriter::put(const std::string &value)
+  {
+    put(static_cast<std::uint32_t>(value.size()));
+    data_.append(value);
+    return *this;
+  }
+
+  PayloadWriter &PayloadWriter::put(const std::vector<std::string> &values)
+  {
+    put(static_cast<std::uint32_t>(values.size()));
+    for (const auto &value : values)
+    {
+      put(value);
+    }
+    return *this;
+  }
+
+  PayloadWriter &PayloadWriter::put(const Status &status)
+  {
+    return put(static_cast<std::uint32_t>(status.state_))
+        .put(status.id_)
+        .put(status.message_)
+        .put(status.serialised_request_)
+        .put(status.serialised_response_);
+  }
+
+  void PayloadReader::take(void *destination, std::size_t size)
+  {
+    if (data_.size() - offset_ < size)
+    {
+      throw resource_registrar::TemotoErrorStack("truncated transport payload", "PayloadReader");
+    }
+    std::memcpy(destination, data_.data() + offset_, size);
+    offset_ += size;
+  }
+
+  PayloadReader &PayloadReader::get(std::uint32_t &value)
+  {
+    take(&value, sizeof(value));
+    return *this;
+  }
+
+  PayloadReader &PayloadReader::get(std::uint64_t &value)
+  {
+    take(&value, sizeof(value));
+    return *this;
+  }
+
+  PayloadReader &PayloadReader::get(std::string &value)
+  {
+    std::uint32_t size;
+    get(size);
+    value.resize(size);
+    take(&value[0], size);
+    return *this;
+  }
+
+  PayloadReader &PayloadReader::get(std::vector<std::string> &values)
+  {
+    std::uint32_t count;
+    get(count);
+    values.clear();
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+      std::string value;
+      get(value);
+      values.push_back(std::move(value));
+    }
+    return *this;
+  }
+
+  PayloadReader &PayloadReader::get(Status &status)
+  {
+    std::uint32_t state;
+    get(state)
+        .get(status.id_)
+        .get(status.message_)
+        .get(status.serialised_request_)
+        .get(status.serialised_response_);
+    status.state_ = static_cast<Status::State>(state);
+    return *this;
+  }
+
+  std::size_t TransportFrame::encodedSize() const
+  {
+    return sizeof(std::uint32_t) + FRAME_HEADER_SIZE + sender_.size() + payload_.size();
+  }
+
+  void TransportFrame::encode(std::string &buffer) const
+  {
+    std::uint32_t length = FRAME_HEADER_SIZE + sender_.size() + payload_.size();
+    std::uint32_t sender_size = sender_.size();
+
+    buffer.reserve(buffer.size() + sizeof(length) + length);
+    buffer.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    buffer.push_back(static_cast<char>(kind_));
+    buffer.push_back(static_cast<char>(type_));
+    buffer.append(reinterpret_cast<const char *>(&request_id_), sizeof(request_id_));
+    buffer.append(reinterpret_cast<const char *>(&sender_size), sizeof(sender_size));
+    buffer.append(sender_);
+    buffer.append(payload_);
+  }
+
+  std::size_t TransportFrame::decode(const char *data, std::size_t size, TransportFrame &frame)
+  {
+    std::uint32_t length;
+    if (size < sizeof(length))
+    {
+      return 0;
+    }
+    std::memcpy(&length, data, sizeof(length));
+    if (size - sizeof(length) < length)
+    {
+      return 0;
+    }
+
+    std::uint32_t sender_size;
+    if (length < FRAME_HEADER_SIZE)
+    {
+      throw resource_registrar::TemotoErrorStack("malformed transport frame", "TransportFrame");
+    }
+    const char *header = data + sizeof(length);
+    std::memcpy(&sender_size, header + 10, sizeof(sender_size));
+    if (length - FRAME_HEADER_SIZE < sender_size)
+    {
+      throw resource_registrar::TemotoErrorStack("malformed transport frame", "TransportFrame");
+    }
+
+    frame.kind_ = static_cast<Kind>(header[0]);
+    frame.type_ = static_cast<TransportMessage>(header[1]);
+    std::memcpy(&frame.request_id_, header + 2, sizeof(frame.request_id_));
+    frame.sender_.assign(header + FRAME_HEADER_SIZE, sender_size);
+    frame.payload_.assign(header + FRAME_HEADER_SIZE + sender_size, length - FRAME_HEADER_SIZE - sender_size);
+    return sizeof(length) + length;
+  }
+
+  Transport::Transport(const std::string &name)
+      : name_(name),
+        request_timeout_(std::chrono::seconds(30)),
+        running_handlers_(0),
+        next_request_id_(1)
+  {
+  }
+
+  Transport::~Transport()
+  {
+    serve(NULL);
+    failPendingRequests("transport of '" + name_ + "' was shut down");
+  }
+
+  const std::string &Transport::name() const
+  {
+    return name_;
+  }
+
+  void Transport::serve(Handler handler)
+  {
+    std::unique_lock<std::mutex> lock(handler_mutex_);
+    handler_ = std::move(handler);
+    if (!handler_)
+    {
+      handlers_done_cv_.wait(lock, [this] { return running_handlers_ == 0; });
+    }
+  }
+
+  void Transport::setRequestTimeout(std::chrono::milliseconds timeout)
+  {
+    request_timeout_ = timeout;
+  }
+
+  std::string Transport::request(const std::string &target, TransportMessage type, const std::string &payload)
+  {
+    TransportFrame frame;
+    frame.kind_ = TransportFrame::Kind::REQUEST;
+    frame.type_ = type;
+    frame.sender_ = name_;
+    frame.payload_ = payload;
+
+    std::future<TransportFrame> response;
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      frame.request_id_ = next_request_id_++;
+      response = pending_[frame.request_id_].get_future();
+    }
+
+    try
+    {
+      send(target, frame);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_.erase(frame.request_id_);
+      throw;
+    }
+
+    if (response.wait_for(request_timeout_) != std::future_status::ready)
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_.erase(frame.request_id_);
+      throw resource_registrar::TemotoErrorStack("request to '" + target + "' timed out", name_);
+    }
+
+    TransportFrame reply = response.get();
+    if (reply.kind_ == TransportFrame::Kind::FAILURE)
+    {
+      resource_registrar::TemotoErrorStack error(reply.payload_);
+      error.appendError("request to '" + target + "' failed", name_);
+      throw error;
+    }
+    return reply.payload_;
+  }
+
+  void Transport::receive(TransportFrame frame)
+  {
+    if (frame.kind_ != TransportFrame::Kind::REQUEST)
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      auto pending = pending_.find(frame.request_id_);
+      if (pending != pending_.end())
+      {
+        pending->second.set_value(std::move(frame));
+        pending_.erase(pending);
+      }
+      return;
+    }
+
+    Handler handler;
+    {
+      std::lock_guard<std::mutex> lock(handler_mutex_);
+      handler = handler_;
+      if (handler)
+      {
+        running_handlers_++;
+      }
+    }
+
+    if (!handler)
+    {
+      TransportFrame reply;
+      reply.kind_ = TransportFrame::Kind::FAILURE;
+      reply.type_ = frame.type_;
+      reply.request_id_ = frame.request_id_;
+      reply.sender_ = name_;
+      reply.payload_ = resource_registrar::TemotoErrorStack("'" + name_ + "' does not serve requests", name_).serialize();
+      try
+      {
+        send(frame.sender_, reply);
+      }
+      catch (...)
+      {
+      }
+      return;
+    }
+
+    std::thread(&Transport::dispatch, this, std::move(frame), std::move(handler)).detach();
+  }
+
+  void Transport::dispatch(TransportFrame request, Handler handler)
+  {
+    TransportFrame reply;
+    reply.kind_ = TransportFrame::Kind::RESPONSE;
+    reply.type_ = request.type_;
+    reply.request_id_ = request.request_id_;
+    reply.sender_ = name_;
+
+    try
+    {
+      reply.payload_ = handler(request.type_, request.payload_);
+    }
+    catch (const resource_registrar::TemotoErrorStack &e)
+    {
+      reply.kind_ = TransportFrame::Kind::FAILURE;
+      reply.payload_ = resource_registrar::TemotoErrorStack(e).serialize();
+    }
+    catch (const std::exception &e)
+    {
+      reply.kind_ = TransportFrame::Kind::FAILURE;
+      reply.payload_ = resource_registrar::TemotoErrorStack(e.what(), name_).serialize();
+    }
+    catch (...)
+    {
+      reply.kind_ = TransportFrame::Kind::FAILURE;
+      reply.payload_ = resource_registrar::TemotoErrorStack("unknown error", name_).serialize();
+    }
+
+    try
+    {
+      send(request.sender_, reply);
+    }
+    catch (const resource_registrar::TemotoErrorStack &e)
+    {
+      // e.g. the response does not fit the transport, let the requester know instead of timing out
+      reply.kind_ = TransportFrame::Kind::FAILURE;
+      reply.payload_ = resource_registrar::TemotoErrorStack(e).serialize();
+      try
+      {
+        send(request.sender_, reply);
+      }
+      catch (...)
+      {
+      }
+    }
+    catch (...)
+    {
+      // the requester is gone, its request times out on its side
+    }
+
+    std::lock_guard<std::mutex> lock(handler_mutex_);
+    running_handlers_--;
+    handlers_done_cv_.notify_all();
+  }
+
+  void Transport::failPendingRequests(const std::string &reason)
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    for (auto &pending : pending_)
+    {
+      TransportFrame failure;
+      failure.kind_ = TransportFrame::Kind::FAILURE;
+      failure.request_id_ = pending.first;
+      failure.payload_ = resource_registrar::TemotoErrorStack(reason, name_).serialize();
+      pending.second.set_value(std::move(failure));
+    }
+    pending_.clear();
+  }
+
+} // namespace temoto_resource_registrar
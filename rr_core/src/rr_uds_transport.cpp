@@ -0,0 +1,471 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "temoto_resource_registrar/rr_uds_transport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace temoto_resource_registrar
+{
+  UdsTransport::UdsTransport(const std::string &name, const std::string &directory)
+      : Transport(name),
+        directory_(directory),
+        socket_path_(socketPath(directory, name)),
+        listen_fd_(-1),
+        epoll_fd_(-1),
+        wakeup_fd_(-1),
+        stopping_(false)
+  {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path_.size() >= sizeof(address.sun_path))
+    {
+      throw resource_registrar::TemotoErrorStack("socket path '" + socket_path_ + "' is too long", name);
+    }
+    std::strncpy(address.sun_path, socket_path_.c_str(), sizeof(address.sun_path) - 1);
+
+    auto fail = [&](const std::string &what) {
+      std::string error = what + " '" + socket_path_ + "': " + std::strerror(errno);
+      for (int fd : {listen_fd_, epoll_fd_, wakeup_fd_})
+      {
+        if (fd >= 0)
+        {
+          close(fd);
+        }
+      }
+      throw resource_registrar::TemotoErrorStack(error, name);
+    };
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0)
+    {
+      fail("could not create");
+    }
+
+    // a previous instance that crashed may have left its socket behind
+    unlink(socket_path_.c_str());
+    if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd_, SOMAXCONN) != 0)
+    {
+      fail("could not listen on");
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wakeup_fd_ < 0)
+    {
+      unlink(socket_path_.c_str());
+      fail("could not poll");
+    }
+
+    for (int fd : {listen_fd_, wakeup_fd_})
+    {
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    io_thread_ = std::thread(&UdsTransport::ioLoop, this);
+  }
+
+  UdsTransport::~UdsTransport()
+  {
+    serve(NULL);
+
+    // the I/O thread flushes the responses of the handlers before it returns
+    stopping_ = true;
+    wakeup();
+    io_thread_.join();
+
+    failPendingRequests("transport of '" + name() + "' was shut down");
+
+    for (auto &connection : connections_)
+    {
+      close(connection.first);
+    }
+    close(listen_fd_);
+    close(epoll_fd_);
+    close(wakeup_fd_);
+    unlink(socket_path_.c_str());
+  }
+
+  UdsStatistics UdsTransport::statistics() const
+  {
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    return statistics_;
+  }
+
+  std::string UdsTransport::socketPath(const std::string &directory, const std::string &rr)
+  {
+    std::string name = rr;
+    std::replace(name.begin(), name.end(), '/', '_');
+    return directory + "/temoto_rr_" + name + ".sock";
+  }
+
+  void UdsTransport::send(const std::string &target, const TransportFrame &frame)
+  {
+    ConnectionPtr connection = connectPeer(target);
+
+    bool schedule;
+    {
+      std::lock_guard<std::mutex> lock(connection->output_mutex_);
+      if (connection->closed_)
+      {
+        throw resource_registrar::TemotoErrorStack("connection to '" + target + "' was lost", name());
+      }
+      frame.encode(connection->output_);
+      schedule = !connection->flush_scheduled_;
+      connection->flush_scheduled_ = true;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(statistics_mutex_);
+      statistics_.frames_sent_++;
+    }
+
+    // frames queued before the I/O thread gets to the connection are written together
+    if (schedule)
+    {
+      {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        flush_queue_.push_back(connection);
+      }
+      wakeup();
+    }
+  }
+
+  UdsTransport::ConnectionPtr UdsTransport::connectPeer(const std::string &target)
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    auto peer = peers_.find(target);
+    if (peer != peers_.end())
+    {
+      return peer->second;
+    }
+
+    std::string path = socketPath(directory_, target);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+      std::string error = "could not reach '" + target + "': " + std::strerror(errno);
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      throw resource_registrar::TemotoErrorStack(error, name());
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    ConnectionPtr connection = std::make_shared<Connection>(fd);
+    connection->peer_ = target;
+    peers_[target] = connection;
+    addConnection(connection);
+    return connection;
+  }
+
+  void UdsTransport::addConnection(const ConnectionPtr &connection)
+  {
+    // called with connections_mutex_ held
+    connections_[connection->fd_] = connection;
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = connection->fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection->fd_, &event);
+
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    statistics_.connections_++;
+  }
+
+  void UdsTransport::closeConnection(const ConnectionPtr &connection)
+  {
+    if (isClosed(connection))
+    {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      connections_.erase(connection->fd_);
+      auto peer = peers_.find(connection->peer_);
+      if (peer != peers_.end() && peer->second == connection)
+      {
+        peers_.erase(peer);
+      }
+    }
+
+    // the requests already sent over the connection time out on the requesting side
+    std::lock_guard<std::mutex> lock(connection->output_mutex_);
+    connection->closed_ = true;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd_, NULL);
+    close(connection->fd_);
+  }
+
+  bool UdsTransport::isClosed(const ConnectionPtr &connection)
+  {
+    // the fd of a closed connection may already belong to a new one
+    std::lock_guard<std::mutex> lock(connection->output_mutex_);
+    return connection->closed_;
+  }
+
+  void UdsTransport::ioLoop()
+  {
+    std::vector<epoll_event> events(64);
+    std::vector<ConnectionPtr> flushes;
+
+    while (true)
+    {
+      int count = epoll_wait(epoll_fd_, events.data(), events.size(), -1);
+      if (count < 0 && errno != EINTR)
+      {
+        return;
+      }
+
+      for (int i = 0; i < count; i++)
+      {
+        int fd = events[i].data.fd;
+        if (fd == wakeup_fd_)
+        {
+          std::uint64_t wakeups;
+          while (read(wakeup_fd_, &wakeups, sizeof(wakeups)) > 0)
+          {
+          }
+          continue;
+        }
+
+        if (fd == listen_fd_)
+        {
+          acceptConnections();
+          continue;
+        }
+
+        ConnectionPtr connection;
+        {
+          std::lock_guard<std::mutex> lock(connections_mutex_);
+          auto it = connections_.find(fd);
+          if (it == connections_.end())
+          {
+            continue;
+          }
+          connection = it->second;
+        }
+
+        if (events[i].events & EPOLLOUT)
+        {
+          flushConnection(connection);
+        }
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+          readConnection(connection);
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        flushes.swap(flush_queue_);
+      }
+      for (const auto &connection : flushes)
+      {
+        flushConnection(connection);
+      }
+      flushes.clear();
+
+      if (stopping_)
+      {
+        return;
+      }
+    }
+  }
+
+  void UdsTransport::acceptConnections()
+  {
+    while (true)
+    {
+      int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0)
+      {
+        return;
+      }
+
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      addConnection(std::make_shared<Connection>(fd));
+    }
+  }
+
+  void UdsTransport::readConnection(const ConnectionPtr &connection)
+  {
+    if (isClosed(connection))
+    {
+      return;
+    }
+
+    char buffer[1 << 16];
+    bool closed = false;
+    std::uint64_t reads = 0;
+
+    while (true)
+    {
+      ssize_t received = recv(connection->fd_, buffer, sizeof(buffer), 0);
+      if (received > 0)
+      {
+        connection->input_.append(buffer, received);
+        reads++;
+        continue;
+      }
+      if (received < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+      break;
+    }
+
+    std::vector<TransportFrame> frames;
+    try
+    {
+      std::size_t offset = 0;
+      TransportFrame frame;
+      while (std::size_t used = TransportFrame::decode(connection->input_.data() + offset,
+                                                       connection->input_.size() - offset,
+                                                       frame))
+      {
+        offset += used;
+        frames.push_back(std::move(frame));
+      }
+      connection->input_.erase(0, offset);
+    }
+    catch (const resource_registrar::TemotoErrorStack &)
+    {
+      // the stream lost its framing, nothing after this point can be trusted
+      closed = true;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(statistics_mutex_);
+      statistics_.reads_ += reads;
+      statistics_.frames_received_ += frames.size();
+    }
+
+    for (auto &frame : frames)
+    {
+      receive(std::move(frame));
+    }
+
+    if (closed)
+    {
+      closeConnection(connection);
+    }
+  }
+
+  void UdsTransport::flushConnection(const ConnectionPtr &connection)
+  {
+    if (isClosed(connection))
+    {
+      return;
+    }
+
+    std::uint64_t writes = 0;
+    bool drained = false;
+
+    while (true)
+    {
+      if (connection->written_ == connection->writing_.size())
+      {
+        std::lock_guard<std::mutex> lock(connection->output_mutex_);
+        if (connection->closed_)
+        {
+          return;
+        }
+        if (connection->output_.empty())
+        {
+          connection->flush_scheduled_ = false;
+          drained = true;
+          break;
+        }
+        connection->writing_.clear();
+        connection->writing_.swap(connection->output_);
+        connection->written_ = 0;
+      }
+
+      ssize_t sent = ::send(connection->fd_,
+                            connection->writing_.data() + connection->written_,
+                            connection->writing_.size() - connection->written_,
+                            MSG_NOSIGNAL);
+      if (sent > 0)
+      {
+        connection->written_ += sent;
+        writes++;
+        continue;
+      }
+      if (sent < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+        // the rest is written once the peer has drained its socket
+        if (!connection->writable_wait_)
+        {
+          epoll_event event;
+          event.events = EPOLLIN | EPOLLOUT;
+          event.data.fd = connection->fd_;
+          epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd_, &event);
+          connection->writable_wait_ = true;
+        }
+        break;
+      }
+
+      closeConnection(connection);
+      break;
+    }
+
+    if (drained && connection->writable_wait_)
+    {
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.fd = connection->fd_;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd_, &event);
+      connection->writable_wait_ = false;
+    }
+
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    statistics_.writes_ += writes;
+  }
+
+  void UdsTransport::wakeup()
+  {
+    std::uint64_t wakeup = 1;
+    ssize_t result = write(wakeup_fd_, &wakeup, sizeof(wakeup));
+    (void)result;
+  }
+
+} // namespace temoto_resource_registrar
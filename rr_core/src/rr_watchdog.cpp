@@ -0,0 +1,249 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "temoto_resource_registrar/rr_watchdog.h"
+
+#include <algorithm>
+
+namespace temoto_resource_registrar
+{
+  constexpr std::array<std::uint64_t, 12> LoadStatistics::BUCKET_LIMITS_MS;
+
+  void LoadStatistics::record(const std::chrono::nanoseconds &duration)
+  {
+    std::uint64_t duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    std::size_t bucket = std::lower_bound(BUCKET_LIMITS_MS.begin(), BUCKET_LIMITS_MS.end(), duration_ms) - BUCKET_LIMITS_MS.begin();
+
+    buckets_[bucket]++;
+    count_++;
+    total_ += duration;
+    max_ = std::max(max_, duration);
+  }
+
+  Watchdog::Watchdog(std::chrono::milliseconds tick, std::size_t slot_count)
+      : tick_(std::max(tick, std::chrono::milliseconds(1))),
+        slots_(std::max<std::size_t>(slot_count, 1)),
+        current_slot_(0),
+        next_id_(1),
+        stopping_(false)
+  {
+    thread_ = std::thread(&Watchdog::run, this);
+  }
+
+  Watchdog::~Watchdog()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    stop_cv_.notify_all();
+    thread_.join();
+  }
+
+  Watchdog::TimerId Watchdog::schedule(std::chrono::milliseconds delay, std::function<void()> callback)
+  {
+    // round up, a timer never fires early
+    std::size_t ticks = std::max<std::size_t>((delay.count() + tick_.count() - 1) / tick_.count(), 1);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    TimerId id = next_id_++;
+    timers_[id] = Timer{(ticks - 1) / slots_.size(), std::move(callback)};
+    slots_[(current_slot_ + ticks) % slots_.size()].push_back(id);
+    return id;
+  }
+
+  bool Watchdog::cancel(TimerId id)
+  {
+    // the id stays in its slot and is skipped when the slot comes up
+    std::lock_guard<std::mutex> lock(mutex_);
+    return timers_.erase(id) > 0;
+  }
+
+  std::size_t Watchdog::pending() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return timers_.size();
+  }
+
+  Watchdog &Watchdog::shared()
+  {
+    static Watchdog watchdog;
+    return watchdog;
+  }
+
+  void Watchdog::run()
+  {
+    auto next_tick = std::chrono::steady_clock::now() + tick_;
+    std::vector<std::function<void()>> expired;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+      if (stop_cv_.wait_until(lock, next_tick, [this] { return stopping_; }))
+      {
+        return;
+      }
+      next_tick += tick_;
+
+      current_slot_ = (current_slot_ + 1) % slots_.size();
+      std::vector<TimerId> &slot = slots_[current_slot_];
+      std::vector<TimerId> remaining;
+
+      for (TimerId id : slot)
+      {
+        auto timer = timers_.find(id);
+        if (timer == timers_.end())
+        {
+          continue;
+        }
+
+        if (timer->second.rounds_ > 0)
+        {
+          timer->second.rounds_--;
+          remaining.push_back(id);
+          continue;
+        }
+
+        expired.push_back(std::move(timer->second.callback_));
+        timers_.erase(timer);
+      }
+      slot.swap(remaining);
+
+      if (expired.empty())
+      {
+        continue;
+      }
+
+      lock.unlock();
+      for (auto &callback : expired)
+      {
+        callback();
+      }
+      expired.clear();
+      lock.lock();
+    }
+  }
+
+  struct LoadExecutor::Ticket
+  {
+    bool running_ = false;
+    bool abandoned_ = false;
+  };
+
+  // shared with the workers, which are detached and may outlive the executor
+  struct LoadExecutor::State
+  {
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::deque<std::pair<TicketPtr, Task>> tasks_;
+    std::size_t thread_count_ = 0;
+    bool stopping_ = false;
+  };
+
+  LoadExecutor::LoadExecutor(std::size_t thread_count) : state_(std::make_shared<State>())
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    for (std::size_t i = 0; i < std::max<std::size_t>(thread_count, 1); i++)
+    {
+      startWorker(state_);
+    }
+  }
+
+  LoadExecutor::~LoadExecutor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex_);
+      state_->stopping_ = true;
+    }
+    state_->work_cv_.notify_all();
+  }
+
+  LoadExecutor::TicketPtr LoadExecutor::submit(Task task)
+  {
+    TicketPtr ticket = std::make_shared<Ticket>();
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex_);
+      state_->tasks_.emplace_back(ticket, std::move(task));
+    }
+    state_->work_cv_.notify_one();
+    return ticket;
+  }
+
+  void LoadExecutor::abandon(const TicketPtr &ticket)
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    if (ticket->running_ && !ticket->abandoned_)
+    {
+      ticket->abandoned_ = true;
+      startWorker(state_);
+    }
+  }
+
+  std::size_t LoadExecutor::threadCount() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->thread_count_;
+  }
+
+  LoadExecutor &LoadExecutor::shared()
+  {
+    static LoadExecutor executor(std::max<std::size_t>(std::thread::hardware_concurrency(), 4));
+    return executor;
+  }
+
+  void LoadExecutor::startWorker(const std::shared_ptr<State> &state)
+  {
+    state->thread_count_++;
+    std::thread(&LoadExecutor::workerLoop, state).detach();
+  }
+
+  void LoadExecutor::workerLoop(std::shared_ptr<State> state)
+  {
+    std::unique_lock<std::mutex> lock(state->mutex_);
+    while (true)
+    {
+      state->work_cv_.wait(lock, [&state] { return state->stopping_ || !state->tasks_.empty(); });
+      if (state->tasks_.empty())
+      {
+        break;
+      }
+
+      TicketPtr ticket = std::move(state->tasks_.front().first);
+      Task task = std::move(state->tasks_.front().second);
+      state->tasks_.pop_front();
+      ticket->running_ = true;
+
+      lock.unlock();
+      try
+      {
+        task();
+      }
+      catch (...)
+      {
+      }
+      lock.lock();
+
+      ticket->running_ = false;
+      // a replacement took over the place of this thread
+      if (ticket->abandoned_)
+      {
+        break;
+      }
+    }
+    state->thread_count_--;
+  }
+
+} // namespace temoto_resource_registrar
@@ -0,0 +1,378 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2021 TeMoto Telerobotics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "temoto_resource_registrar/temoto_async_logging.h"
+
+#include <algorithm>
+#include <csignal>
+
+namespace temoto_logging
+{
+
+static const int CRASH_SIGNALS[] = {SIGSEGV, SIGABRT, SIGBUS, SIGILL, SIGFPE};
+static const std::size_t CRASH_SIGNAL_COUNT = sizeof(CRASH_SIGNALS) / sizeof(CRASH_SIGNALS[0]);
+static struct sigaction previous_crash_actions[CRASH_SIGNAL_COUNT];
+static bool crash_handler_installed = false;
+
+/**
+ * @brief Single producer, single consumer ring of log records.
+ */
+class AsyncLogger::Ring
+{
+public:
+  explicit Ring(std::size_t capacity)
+  : slots_(capacity)
+  , orphaned_(false)
+  , head_(0)
+  , tail_(0)
+  {
+  }
+
+  bool push(Record& record)
+  {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+    {
+      return false;
+    }
+    slots_[tail % slots_.size()] = std::move(record);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(Record& record)
+  {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    record = std::move(slots_[head % slots_.size()]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const
+  {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+  std::size_t capacity() const
+  {
+    return slots_.size();
+  }
+
+  std::vector<Record> slots_;
+  // the producing thread is gone or registered a newer ring
+  std::atomic<bool> orphaned_;
+
+private:
+  alignas(64) std::atomic<std::size_t> head_;
+  alignas(64) std::atomic<std::size_t> tail_;
+};
+
+struct AsyncLogger::ThreadRing
+{
+  std::shared_ptr<Ring> ring_;
+  std::uint64_t epoch_ = 0;
+
+  ~ThreadRing()
+  {
+    if (ring_)
+    {
+      ring_->orphaned_ = true;
+    }
+  }
+};
+
+AsyncLogger& AsyncLogger::instance()
+{
+  static AsyncLogger logger;
+  return logger;
+}
+
+AsyncLogger::~AsyncLogger()
+{
+  stop();
+}
+
+void AsyncLogger::start(const AsyncLoggingOptions& options)
+{
+  stop();
+
+  options_ = options;
+  ring_capacity_ = std::max<std::size_t>(options.ring_capacity_, 1);
+  block_ = options.overflow_policy_ == AsyncLoggingOptions::OverflowPolicy::BLOCK;
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    stop_requested_ = false;
+  }
+  epoch_++;
+
+  if (options.flush_on_crash_)
+  {
+    struct sigaction action = {};
+    action.sa_handler = &AsyncLogger::crashHandler;
+    sigemptyset(&action.sa_mask);
+    for (std::size_t i = 0; i < CRASH_SIGNAL_COUNT; i++)
+    {
+      sigaction(CRASH_SIGNALS[i], &action, &previous_crash_actions[i]);
+    }
+    crash_handler_installed = true;
+  }
+
+  running_.store(true, std::memory_order_release);
+  writer_ = std::thread(&AsyncLogger::writerLoop, this);
+}
+
+void AsyncLogger::stop()
+{
+  if (!running())
+  {
+    return;
+  }
+
+  running_.store(false, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    stop_requested_ = true;
+  }
+  writer_cv_.notify_all();
+  writer_.join();
+
+  // records pushed while stopping stay in their rings until the next flush or start
+  drain();
+
+  if (crash_handler_installed)
+  {
+    for (std::size_t i = 0; i < CRASH_SIGNAL_COUNT; i++)
+    {
+      sigaction(CRASH_SIGNALS[i], &previous_crash_actions[i], NULL);
+    }
+    crash_handler_installed = false;
+  }
+}
+
+void AsyncLogger::flush()
+{
+  drain();
+}
+
+AsyncLoggingStatistics AsyncLogger::statistics() const
+{
+  AsyncLoggingStatistics statistics;
+  statistics.written_ = written_.load();
+  statistics.dropped_ = dropped_.load();
+  statistics.blocked_ = blocked_.load();
+  return statistics;
+}
+
+bool AsyncLogger::push(console_bridge::LogLevel level, const char* file, int line, std::unique_ptr<LogFormatter>& formatter)
+{
+  Record record{level, file, line, std::move(formatter), std::string()};
+  if (push(record))
+  {
+    return true;
+  }
+  formatter = std::move(record.formatter_);
+  return false;
+}
+
+bool AsyncLogger::push(console_bridge::LogLevel level, const char* file, int line, std::string& message)
+{
+  Record record{level, file, line, std::unique_ptr<LogFormatter>(), std::move(message)};
+  if (push(record))
+  {
+    return true;
+  }
+  message = std::move(record.message_);
+  return false;
+}
+
+bool AsyncLogger::push(Record& record)
+{
+  if (!running())
+  {
+    return false;
+  }
+
+  Ring& ring = threadRing();
+  if (ring.push(record))
+  {
+    return true;
+  }
+
+  if (!block_)
+  {
+    dropped_++;
+    return true;
+  }
+
+  blocked_++;
+  writer_cv_.notify_one();
+  while (!ring.push(record))
+  {
+    if (!running())
+    {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+AsyncLogger::Ring& AsyncLogger::threadRing()
+{
+  static thread_local ThreadRing thread_ring;
+
+  std::uint64_t epoch = epoch_.load();
+  if (!thread_ring.ring_ || thread_ring.epoch_ != epoch)
+  {
+    std::shared_ptr<Ring> ring = std::make_shared<Ring>(ring_capacity_.load());
+    {
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      rings_.push_back(ring);
+    }
+    if (thread_ring.ring_)
+    {
+      thread_ring.ring_->orphaned_ = true;
+    }
+    thread_ring.ring_ = std::move(ring);
+    thread_ring.epoch_ = epoch;
+  }
+  return *thread_ring.ring_;
+}
+
+void AsyncLogger::writerLoop()
+{
+  while (true)
+  {
+    std::size_t written = drain();
+
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    if (stop_requested_)
+    {
+      return;
+    }
+    if (!written)
+    {
+      writer_cv_.wait_for(lock, options_.flush_interval_, [this] { return stop_requested_; });
+    }
+  }
+}
+
+std::size_t AsyncLogger::drain()
+{
+  std::lock_guard<std::mutex> lock(drain_mutex_);
+  return drainRings(false);
+}
+
+std::size_t AsyncLogger::drainRings(bool crashing)
+{
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::unique_lock<std::mutex> lock(rings_mutex_, std::defer_lock);
+    if (crashing && !lock.try_lock())
+    {
+      return 0;
+    }
+    if (!crashing)
+    {
+      lock.lock();
+    }
+    rings = rings_;
+  }
+
+  std::size_t written = 0;
+  Record record;
+  for (const auto& ring : rings)
+  {
+    // a busy thread does not hold up the others for more than a ring
+    for (std::size_t i = 0; i < ring->capacity() && ring->pop(record); i++)
+    {
+      write(record);
+      written++;
+    }
+  }
+
+  if (!crashing)
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<Ring>& ring) {
+      return ring->orphaned_ && ring->empty();
+    }), rings_.end());
+  }
+  return written;
+}
+
+void AsyncLogger::write(Record& record)
+{
+  std::string message;
+  if (record.formatter_)
+  {
+    try
+    {
+      message = record.formatter_->str();
+    }
+    catch (const std::exception& e)
+    {
+      message = std::string("failed to format a log record: ") + e.what();
+    }
+    record.formatter_.reset();
+  }
+  else
+  {
+    message = std::move(record.message_);
+  }
+
+  if (options_.output_)
+  {
+    options_.output_(record.level_, record.file_, record.line_, message);
+  }
+  else
+  {
+    console_bridge::log(record.file_, record.line_, record.level_, "%s", message.c_str());
+  }
+  written_++;
+}
+
+void AsyncLogger::crashHandler(int signal)
+{
+  // best effort: formatting is not async-signal-safe, and the crashing thread may be the writer itself
+  AsyncLogger& logger = instance();
+  for (int attempt = 0; attempt < 100; attempt++)
+  {
+    if (logger.drain_mutex_.try_lock())
+    {
+      logger.drainRings(true);
+      logger.drain_mutex_.unlock();
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  for (std::size_t i = 0; i < CRASH_SIGNAL_COUNT; i++)
+  {
+    if (CRASH_SIGNALS[i] == signal)
+    {
+      sigaction(signal, &previous_crash_actions[i], NULL);
+    }
+  }
+  raise(signal);
+}
+
+} // temoto_logging namespace
@@ -3,18 +3,26 @@
 
 #include "console_bridge/console.h"
 
+#include <fcntl.h>
 #include <iostream>
+#include <numeric>
+#include <signal.h>
 #include <sstream>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
 
 #include "temoto_resource_registrar/rr_base.h"
+#include "temoto_resource_registrar/rr_loopback_transport.h"
 #include "temoto_resource_registrar/rr_configuration.h"
 #include "temoto_resource_registrar/rr_serializable.h"
 #include "temoto_resource_registrar/rr_serializer.h"
 #include "temoto_resource_registrar/rr_server_base.h"
+#include "temoto_resource_registrar/rr_shm_transport.h"
+#include "temoto_resource_registrar/rr_uds_transport.h"
 #include "temoto_resource_registrar/temoto_error.h"
 
 #include <boost/archive/binary_iarchive.hpp>
@@ -183,39 +191,30 @@ class RrTemplateServer : public RrServerBase
 {
 
 public:
+  typedef InlineFunction<void(RrQueryTemplate<MessageType> &)> TypedQueryCallback;
+  typedef InlineFunction<void(MessageType, const Status &)> TypedStatusCallback;
+
   RrTemplateServer(const std::string &name,
-                   void (*loadCallback)(RrQueryTemplate<MessageType> &),
-                   void (*unLoadCallback)(RrQueryTemplate<MessageType> &)) : RrServerBase(name,
-                                                                                          NULL,
-                                                                                          NULL),
-                                                                             typed_load_callback_ptr_(loadCallback),
-                                                                             typed_unload_callback_ptr_(unLoadCallback){};
+                   TypedQueryCallback load,
+                   TypedQueryCallback unload) : RrServerBase(name,
+                                                             NULL,
+                                                             NULL),
+                                                typed_load_fn_(std::move(load)),
+                                                typed_unload_fn_(std::move(unload)){};
 
   RrTemplateServer(const std::string &name,
-                   std::function<void(RrQueryTemplate<MessageType> &)> load,
-                   std::function<void(RrQueryTemplate<MessageType> &)> unload,
-                   bool lambdas) : RrServerBase(name,
-                                                NULL,
-                                                NULL),
-                                   typed_load_callback_ptr_(NULL),
-                                   typed_unload_callback_ptr_(NULL),
-                                   typed_load_fn_(load),
-                                   typed_unload_fn_(unload)
+                   TypedQueryCallback load,
+                   TypedQueryCallback unload,
+                   bool) : RrTemplateServer(name, std::move(load), std::move(unload))
   {
   }
 
   RrTemplateServer(const std::string &name,
-                   std::function<void(RrQueryTemplate<MessageType> &)> load,
-                   std::function<void(RrQueryTemplate<MessageType> &)> unload,
-                   std::function<void(MessageType, const Status &)> status) : RrServerBase(name,
-                                                                                           NULL,
-                                                                                           NULL),
-                                                                              typed_load_callback_ptr_(NULL),
-                                                                              typed_unload_callback_ptr_(NULL),
-                                                                              typed_load_fn_(load),
-                                                                              typed_unload_fn_(unload),
-                                                                              typed_status_fn_(status)
+                   TypedQueryCallback load,
+                   TypedQueryCallback unload,
+                   TypedStatusCallback status) : RrTemplateServer(name, std::move(load), std::move(unload))
   {
+    typed_status_fn_ = std::move(status);
   }
 
   void processQuery(RrQueryTemplate<MessageType> &query) const
@@ -234,21 +233,25 @@ public:
     {
       try
       {
-        LOG(INFO) << "Executing query startup callback";
-        transaction_callback_ptr_(TransactionInfo(100, query));
+        bool loaded = loadWithBackoff(serializedRequest, query, [&]() {
+          LOG(INFO) << "Executing query startup callback";
+          transaction_callback_ptr_(TransactionInfo(100, query));
 
-        LOG(INFO) << "Request not found. Running and storing it";
-        if (typed_load_callback_ptr_ != NULL)
-          typed_load_callback_ptr_(query);
-        else
+          LOG(INFO) << "Request not found. Running and storing it";
           typed_load_fn_(query);
 
-        LOG(INFO) << "Finished callback";
+          LOG(INFO) << "Finished callback";
 
-        LOG(INFO) << "Storing query data to server..." << id_;
+          LOG(INFO) << "Storing query data to server..." << id_;
 
-        storeQuery(serializedRequest, query);
-        LOG(INFO) << "Finished storing";
+          storeQuery(serializedRequest, query);
+          LOG(INFO) << "Finished storing";
+        });
+        if (!loaded)
+        {
+          LOG(INFO) << "Request failed recently. Returning the cached error";
+          return;
+        }
       }
       catch (const resource_registrar::TemotoErrorStack &e)
       {
@@ -288,10 +291,7 @@ public:
     {
       RrQueryTemplate<MessageType> q = Serializer::deserialize<RrQueryTemplate<MessageType>>(query);
       LOG(INFO) << "Time for unload CB!";
-      if (typed_unload_callback_ptr_ != NULL)
-        typed_unload_callback_ptr_(q);
-      else
-        typed_unload_fn_(q);
+      typed_unload_fn_(q);
     }
 
     return query.size() > 0;
@@ -301,7 +301,7 @@ public:
   {
     LOG(INFO) << "triggerCallback triggered for server " << id();
 
-    if (typed_status_fn_ != NULL)
+    if (typed_status_fn_)
     {
       MessageType q = Serializer::deserialize<MessageType>(status.serialised_request_);
       typed_status_fn_(q, status);
@@ -309,12 +309,9 @@ public:
   }
 
 protected:
-  void (*typed_load_callback_ptr_)(RrQueryTemplate<MessageType> &);
-  void (*typed_unload_callback_ptr_)(RrQueryTemplate<MessageType> &);
-
-  std::function<void(RrQueryTemplate<MessageType> &)> typed_load_fn_;
-  std::function<void(RrQueryTemplate<MessageType> &)> typed_unload_fn_;
-  std::function<void(MessageType, const Status &)> typed_status_fn_;
+  TypedQueryCallback typed_load_fn_;
+  TypedQueryCallback typed_unload_fn_;
+  TypedStatusCallback typed_status_fn_;
 
 private:
   void storeQuery(const std::string &rawRequest, RrQueryTemplate<MessageType> query) const
@@ -1093,4 +1090,1916 @@ TEST_F(RrBaseTest, RrServerStatusCallbackTest)
   rr_srv.sendStatus(id, {Status::State::FATAL, id, "message"});
 
   EXPECT_EQ(statusCbCnt, 1);
-}
\ No newline at end of file
+}
+TEST_F(RrBaseTest, StatusBatchingTest)
+{
+  class StatusCountingRr : public RrBase
+  {
+  public:
+    StatusCountingRr(const std::string &name) : RrBase(name) {}
+
+    void handleStatus(const std::string &request_id,
+                      const std::vector<std::string> &subscriber_ids,
+                      const Status &status_data)
+    {
+      batches++;
+      for (const auto &id : subscriber_ids)
+      {
+        notified_ids.insert(id);
+      }
+      RrBase::handleStatus(request_id, subscriber_ids, status_data);
+    }
+
+    int batches = 0;
+    std::set<std::string> notified_ids;
+  };
+
+  StatusCountingRr rr_cli1("rr_client1");
+  StatusCountingRr rr_cli2("rr_client2");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client1"] = &rr_cli1;
+  rr_ref["rr_client2"] = &rr_cli2;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli1.setRrReferences(rr_ref);
+  rr_cli2.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  int loadCnt = 0;
+  int statusCbCnt = 0;
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &) {
+    loadCnt++;
+  };
+
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  auto statusCb = [&](Resource1 res, const Status &) {
+    EXPECT_EQ(res.rawMessage(), "sharedContent");
+    statusCbCnt++;
+  };
+
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, statusCb));
+
+  RrQueryTemplate<Resource1> query1(Resource1("sharedContent"), Resource1(""));
+  rr_cli1.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", query1);
+  RrQueryTemplate<Resource1> query2(Resource1("sharedContent"), Resource1(""));
+  rr_cli1.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", query2);
+  RrQueryTemplate<Resource1> query3(Resource1("sharedContent"), Resource1(""));
+  rr_cli2.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", query3);
+
+  EXPECT_EQ(loadCnt, 1);
+
+  rr_srv.sendStatus(query1.id(), {Status::State::UPDATE, query1.id(), "message"});
+
+  // one delivery per subscribing RR, carrying all of its query ids
+  EXPECT_EQ(rr_cli1.batches, 1);
+  EXPECT_EQ(rr_cli2.batches, 1);
+  EXPECT_EQ(rr_cli1.notified_ids.size(), 2);
+  EXPECT_EQ(rr_cli1.notified_ids.count(query1.id()), 1);
+  EXPECT_EQ(rr_cli1.notified_ids.count(query2.id()), 1);
+  EXPECT_EQ(rr_cli2.notified_ids.size(), 1);
+  EXPECT_EQ(rr_cli2.notified_ids.count(query3.id()), 1);
+  // the server status callback still fires once per subscribing query
+  EXPECT_EQ(statusCbCnt, 3);
+}
+
+TEST_F(RrBaseTest, StatusFallbackTest)
+{
+  // RR whose subscribers are only reachable through the per-query override, as in wrapped RRs
+  class PerQueryStatusRr : public RrBase
+  {
+  public:
+    PerQueryStatusRr(const std::string &name) : RrBase(name) {}
+
+    bool callStatusClient(const std::string &, const std::string &, Status status_data)
+    {
+      delivered_ids.push_back(status_data.id_);
+      return true;
+    }
+
+    using RrBase::callStatusClient;
+
+    std::vector<std::string> delivered_ids;
+  };
+
+  RrBase rr_cli("rr_client");
+  PerQueryStatusRr rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &) {};
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb));
+
+  RrQueryTemplate<Resource1> query1(Resource1("sharedContent"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", query1);
+  RrQueryTemplate<Resource1> query2(Resource1("sharedContent"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", query2);
+
+  rr_srv.callStatusClient("rr_unreachable", query1.id(), {query1.id(), query2.id()},
+                          {Status::State::UPDATE, query1.id(), "message"});
+
+  ASSERT_EQ(rr_srv.delivered_ids.size(), 2);
+  EXPECT_EQ(rr_srv.delivered_ids[0], query1.id());
+  EXPECT_EQ(rr_srv.delivered_ids[1], query2.id());
+}
+
+TEST_F(RrBaseTest, QueryContextPropagationTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_agnt("rr_agent");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_ref["rr_agent"] = &rr_agnt;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+  rr_agnt.setRrReferences(rr_ref);
+
+  std::atomic<int> childUnloadCnt(0);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    EXPECT_TRUE(QueryContext::current() != NULL);
+    EXPECT_EQ(QueryContext::current()->query().id(), query.id());
+
+    // nested call executed on another thread, carrying the context along
+    auto childCall = QueryContext::bind([&](int i) {
+      RrQueryTemplate<Resource2> childQuery(Resource2(i, 0), Resource2());
+      rr_agnt.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_srv, "srv2", childQuery);
+    });
+    std::async(std::launch::async, childCall, 1).get();
+    std::async(std::launch::async, childCall, 2).get();
+  };
+
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+  auto loadCb2 = [&](RrQueryTemplate<Resource2> &) {};
+  auto unloadCb2 = [&](RrQueryTemplate<Resource2> &) {
+    childUnloadCnt++;
+  };
+
+  rr_agnt.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, 1));
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource2>>("srv2", loadCb2, unloadCb2, 1));
+
+  RrQueryTemplate<Resource1> query(Resource1("contextContent"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_agnt, "srv", query);
+
+  EXPECT_TRUE(QueryContext::current() == NULL);
+
+  rr_cli.unload(rr_agnt, query.id());
+  EXPECT_EQ(childUnloadCnt, 2);
+}
+
+TEST_F(RrBaseTest, ParallelCallAllTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_agnt("rr_agent");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_ref["rr_agent"] = &rr_agnt;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+  rr_agnt.setRrReferences(rr_ref);
+
+  std::atomic<int> running(0);
+  std::atomic<int> maxRunning(0);
+  std::atomic<int> childLoadCnt(0);
+  std::atomic<int> childUnloadCnt(0);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    std::vector<std::function<void()>> calls;
+    for (int i = 1; i <= 3; i++)
+    {
+      calls.push_back([&, i]() {
+        RrQueryTemplate<Resource2> childQuery(Resource2(i, 0), Resource2());
+        rr_agnt.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_srv, "srv2", childQuery);
+      });
+    }
+
+    // the sub-resource that fails is only requested by the second query
+    if (query.request().getRequest().rawMessage() == "failing")
+    {
+      calls.push_back([&]() {
+        RrQueryTemplate<Resource2> childQuery(Resource2(-1, 0), Resource2());
+        rr_agnt.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_srv, "srv2", childQuery);
+      });
+    }
+
+    rr_agnt.callAll(calls);
+  };
+
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  auto loadCb2 = [&](RrQueryTemplate<Resource2> &query) {
+    int now = ++running;
+    int prev = maxRunning;
+    while (prev < now && !maxRunning.compare_exchange_weak(prev, now))
+    {
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    running--;
+
+    if (query.request().getRequest().i_ < 0)
+      throw resource_registrar::TemotoErrorStack("sub-resource failed", "srv2");
+
+    childLoadCnt++;
+  };
+
+  auto unloadCb2 = [&](RrQueryTemplate<Resource2> &) {
+    childUnloadCnt++;
+  };
+
+  rr_agnt.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, 1));
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource2>>("srv2", loadCb2, unloadCb2, 1));
+
+  RrQueryTemplate<Resource1> query(Resource1("composite"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_agnt, "srv", query);
+
+  EXPECT_EQ(childLoadCnt, 3);
+  EXPECT_GT(maxRunning, 1);
+
+  // all parallel sub-loads are dependencies of the composite resource
+  rr_cli.unload(rr_agnt, query.id());
+  EXPECT_EQ(childUnloadCnt, 3);
+
+  childLoadCnt = 0;
+  childUnloadCnt = 0;
+  RrQueryTemplate<Resource1> failingQuery(Resource1("failing"), Resource1(""));
+  typedef RrTemplateServer<Resource1> Server1;
+  EXPECT_THROW(rr_cli.call<Server1>(rr_agnt, "srv", failingQuery), resource_registrar::TemotoErrorStack);
+
+  // the sub-loads that succeeded were rolled back
+  EXPECT_EQ(childLoadCnt, 3);
+  EXPECT_EQ(childUnloadCnt, 3);
+}
+
+TEST_F(RrBaseTest, CascadingUnloadTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_top("rr_top");
+  RrBase rr_mid("rr_mid");
+  RrBase rr_leaf("rr_leaf");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_top"] = &rr_top;
+  rr_ref["rr_mid"] = &rr_mid;
+  rr_ref["rr_leaf"] = &rr_leaf;
+  for (auto &rr : rr_ref)
+  {
+    rr.second->setRrReferences(rr_ref);
+  }
+
+  std::mutex orderMutex;
+  std::vector<std::string> unloadOrder;
+  auto recordUnload = [&](const std::string &name) {
+    std::lock_guard<std::mutex> lock(orderMutex);
+    unloadOrder.push_back(name);
+  };
+
+  auto topLoadCb = [&](RrQueryTemplate<Resource1> &) {
+    for (int i = 1; i <= 2; i++)
+    {
+      RrQueryTemplate<Resource2> midQuery(Resource2(i, 0), Resource2());
+      rr_top.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_mid, "mid", midQuery);
+    }
+  };
+  auto topUnloadCb = [&](RrQueryTemplate<Resource1> &) { recordUnload("top"); };
+
+  auto midLoadCb = [&](RrQueryTemplate<Resource2> &query) {
+    RrQueryTemplate<Resource2> leafQuery(Resource2(query.request().getRequest().i_ * 10, 0), Resource2());
+    rr_mid.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_leaf, "leaf", leafQuery);
+  };
+  auto midUnloadCb = [&](RrQueryTemplate<Resource2> &) { recordUnload("mid"); };
+
+  auto leafLoadCb = [&](RrQueryTemplate<Resource2> &) {};
+  auto leafUnloadCb = [&](RrQueryTemplate<Resource2> &) { recordUnload("leaf"); };
+
+  rr_top.registerServer(std::make_unique<RrTemplateServer<Resource1>>("top", topLoadCb, topUnloadCb, 1));
+  rr_mid.registerServer(std::make_unique<RrTemplateServer<Resource2>>("mid", midLoadCb, midUnloadCb, 1));
+  rr_leaf.registerServer(std::make_unique<RrTemplateServer<Resource2>>("leaf", leafLoadCb, leafUnloadCb, 1));
+
+  RrQueryTemplate<Resource1> query(Resource1("fleet"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_top, "top", query);
+
+  UnloadReport report = rr_top.cascadeUnload({query.id()});
+
+  EXPECT_TRUE(report.unloaded_);
+  EXPECT_EQ(report.failures_.size(), 0);
+
+  // whole tree is released, leaves first
+  std::vector<std::string> expectedOrder = {"leaf", "leaf", "mid", "mid", "top"};
+  EXPECT_EQ(unloadOrder, expectedOrder);
+}
+
+TEST_F(RrBaseTest, ServerHandleTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  int loadCnt = 0;
+  auto loadCb = [&](RrQueryTemplate<Resource1> &) { loadCnt++; };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  RrBase::ServerHandle first = rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, 1));
+  RrBase::ServerHandle second = rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv_b", loadCb, unloadCb, 1));
+  RrBase::ServerHandle duplicate = rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, 1));
+
+  EXPECT_NE(first, second);
+  EXPECT_EQ(duplicate, RrServers::INVALID_HANDLE);
+  EXPECT_EQ(rr_srv.serverHandle("srv"), first);
+  EXPECT_EQ(rr_srv.serverHandle("missing"), RrServers::INVALID_HANDLE);
+  EXPECT_EQ(rr_srv.serverCount(), 2);
+
+  RrQueryTemplate<Resource1> query(Resource1("handleContent"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, first, query);
+  EXPECT_EQ(loadCnt, 1);
+
+  // the same resource requested by name is found in the catalog
+  RrQueryTemplate<Resource1> query2(Resource1("handleContent"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", query2);
+  EXPECT_EQ(loadCnt, 1);
+  EXPECT_EQ(rr_cli.unload(rr_srv, query.id()), true);
+}
+
+class DerivedServer : public RrTemplateServer<Resource1>
+{
+public:
+  DerivedServer(const std::string &name, TypedQueryCallback load, TypedQueryCallback unload)
+      : RrTemplateServer<Resource1>(name, std::move(load), std::move(unload)){};
+};
+
+TEST_F(RrBaseTest, TypedDispatchTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  int loadCnt = 0;
+  auto loadCb = [&](RrQueryTemplate<Resource1> &) { loadCnt++; };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  // servers are dispatched by reference and can not be copied at all
+  static_assert(!std::is_copy_constructible<DerivedServer>::value, "servers must not be copyable");
+
+  rr_srv.registerServer(std::make_unique<DerivedServer>("srv", loadCb, unloadCb));
+
+  RrQueryTemplate<Resource1> query(Resource1("first"), Resource1(""));
+  rr_cli.call<DerivedServer, RrQueryTemplate<Resource1>>(rr_srv, "srv", query);
+
+  // dispatch through a base class of the registered server
+  RrQueryTemplate<Resource1> query2(Resource1("second"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", query2);
+
+  EXPECT_EQ(loadCnt, 2);
+}
+
+void countingFunction(int &counter)
+{
+  counter++;
+}
+
+TEST_F(RrBaseTest, InlineFunctionTest)
+{
+  typedef InlineFunction<void(int &)> Callback;
+  int counter = 0;
+
+  Callback empty;
+  Callback fromNull(NULL);
+  void (*nullPointer)(int &) = NULL;
+  Callback fromNullPointer(nullPointer);
+  EXPECT_FALSE(empty);
+  EXPECT_FALSE(fromNull);
+  EXPECT_FALSE(fromNullPointer);
+  EXPECT_THROW(empty(counter), std::bad_function_call);
+
+  Callback fromPointer(&countingFunction);
+  std::string captured = "captured";
+  Callback fromLambda([captured](int &c) { c += captured.size(); });
+  fromPointer(counter);
+  fromLambda(counter);
+  EXPECT_EQ(counter, 9);
+
+  // moving transfers the target and leaves the source empty
+  Callback moved(std::move(fromLambda));
+  EXPECT_FALSE(fromLambda);
+  moved(counter);
+  EXPECT_EQ(counter, 17);
+
+  moved = std::move(fromPointer);
+  moved(counter);
+  EXPECT_EQ(counter, 18);
+}
+
+TEST_F(RrBaseTest, ExecutionPolicyTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  std::mutex countMutex;
+  std::map<std::string, int> running;
+  std::map<std::string, int> maxRunning;
+
+  auto trackedLoad = [&](const std::string &server) {
+    {
+      std::lock_guard<std::mutex> lock(countMutex);
+      running[server]++;
+      maxRunning[server] = std::max(maxRunning[server], running[server]);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock(countMutex);
+    running[server]--;
+  };
+
+  auto strandLoad = [&](RrQueryTemplate<Resource1> &) { trackedLoad("strand"); };
+  auto boundedLoad = [&](RrQueryTemplate<Resource1> &) { trackedLoad("bounded"); };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  auto strandServer = std::make_unique<RrTemplateServer<Resource1>>("strand", strandLoad, unloadCb, 1);
+  strandServer->setExecutionPolicy(ExecutionPolicy::strand());
+  auto boundedServer = std::make_unique<RrTemplateServer<Resource1>>("bounded", boundedLoad, unloadCb, 1);
+  boundedServer->setExecutionPolicy(ExecutionPolicy::bounded(2));
+  rr_srv.registerServer(std::move(strandServer));
+  rr_srv.registerServer(std::move(boundedServer));
+
+  std::vector<std::thread> callers;
+  for (int i = 0; i < 4; i++)
+  {
+    for (std::string server : {"strand", "bounded"})
+    {
+      callers.emplace_back([&, i, server]() {
+        RrQueryTemplate<Resource1> query(Resource1(server + std::to_string(i)), Resource1(""));
+        rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, server, query);
+      });
+    }
+  }
+  for (auto &caller : callers)
+  {
+    caller.join();
+  }
+
+  EXPECT_EQ(maxRunning["strand"], 1);
+  EXPECT_EQ(maxRunning["bounded"], 2);
+
+  QueueMetrics strandMetrics = rr_srv.serverQueueMetrics("strand");
+  EXPECT_EQ(strandMetrics.admitted_, 4);
+  EXPECT_EQ(strandMetrics.running_, 0);
+  EXPECT_EQ(strandMetrics.queued_, 0);
+  EXPECT_GT(strandMetrics.max_queued_, 0);
+  EXPECT_GT(strandMetrics.max_wait_.count(), 0);
+}
+
+TEST_F(RrBaseTest, PriorityDeadlineTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  std::mutex orderMutex;
+  std::vector<std::string> loadOrder;
+  int inheritedPriority = -1;
+  bool inheritedDeadline = false;
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    {
+      std::lock_guard<std::mutex> lock(orderMutex);
+      loadOrder.push_back(query.request().getRequest().rawMessage());
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  auto parentLoadCb = [&](RrQueryTemplate<Resource1> &) {
+    RrQueryTemplate<Resource2> childQuery(Resource2(1, 0), Resource2());
+    rr_srv.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_srv, "child", childQuery);
+  };
+  auto childLoadCb = [&](RrQueryTemplate<Resource2> &query) {
+    inheritedPriority = query.requestMetadata().priority();
+    inheritedDeadline = query.requestMetadata().hasDeadline();
+  };
+  auto childUnloadCb = [&](RrQueryTemplate<Resource2> &) {};
+
+  auto strandServer = std::make_unique<RrTemplateServer<Resource1>>("strand", loadCb, unloadCb, 1);
+  strandServer->setExecutionPolicy(ExecutionPolicy::strand());
+  rr_srv.registerServer(std::move(strandServer));
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("parent", parentLoadCb, unloadCb, 1));
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource2>>("child", childLoadCb, childUnloadCb, 1));
+
+  auto callStrand = [&](const std::string &message, int priority, int deadlineMs) {
+    RrQueryTemplate<Resource1> query(Resource1(message), Resource1(""));
+    query.requestMetadata().setPriority(priority);
+    if (deadlineMs != 0)
+    {
+      query.requestMetadata().setDeadline(std::chrono::system_clock::now() + std::chrono::milliseconds(deadlineMs));
+    }
+    try
+    {
+      rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "strand", query);
+    }
+    catch (const resource_registrar::TemotoErrorStack &e)
+    {
+      return false;
+    }
+    return true;
+  };
+
+  // queries waiting for the busy strand are admitted by priority, expired ones give up
+  std::future<bool> holder = std::async(std::launch::async, callStrand, "holder", 0, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  std::future<bool> background = std::async(std::launch::async, callStrand, "background", 0, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  std::future<bool> critical = std::async(std::launch::async, callStrand, "critical", 10, 0);
+  std::future<bool> expiring = std::async(std::launch::async, callStrand, "expiring", 0, 30);
+
+  EXPECT_TRUE(holder.get());
+  EXPECT_TRUE(background.get());
+  EXPECT_TRUE(critical.get());
+  EXPECT_FALSE(expiring.get());
+
+  std::vector<std::string> expectedOrder = {"holder", "critical", "background"};
+  EXPECT_EQ(loadOrder, expectedOrder);
+  EXPECT_EQ(rr_srv.serverQueueMetrics("strand").expired_, 1);
+
+  // a query whose deadline has already passed is not executed at all
+  EXPECT_FALSE(callStrand("late", 0, -1));
+  EXPECT_EQ(loadOrder.size(), 3);
+
+  // dependencies inherit the scheduling constraints of their parent
+  RrQueryTemplate<Resource1> parentQuery(Resource1("parent"), Resource1(""));
+  parentQuery.requestMetadata().setPriority(5);
+  parentQuery.requestMetadata().setDeadline(std::chrono::system_clock::now() + std::chrono::seconds(10));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "parent", parentQuery);
+  EXPECT_EQ(inheritedPriority, 5);
+  EXPECT_TRUE(inheritedDeadline);
+
+  // scheduling constraints survive serialization
+  RrQueryBase restored = Serializer::deserialize<RrQueryBase>(Serializer::serialize<RrQueryBase>(parentQuery));
+  EXPECT_EQ(restored.requestMetadata().priority(), 5);
+  EXPECT_EQ(restored.requestMetadata().deadline(), parentQuery.requestMetadata().deadline());
+}
+
+TEST_F(RrBaseTest, CancellationTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  std::string parentId;
+  std::promise<void> slowChildStarted;
+  std::atomic<bool> slowChildCancelled(false);
+  int childUnloadCnt = 0;
+
+  auto parentLoadCb = [&](RrQueryTemplate<Resource1> &query) {
+    parentId = query.id();
+    RrQueryTemplate<Resource2> childQuery(Resource2(1, 0), Resource2());
+    rr_srv.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_srv, "child", childQuery);
+
+    RrQueryTemplate<Resource2> slowQuery(Resource2(2, 0), Resource2());
+    rr_srv.call<RrTemplateServer<Resource2>, RrQueryTemplate<Resource2>>(rr_srv, "slowChild", slowQuery);
+  };
+  auto slowLoadCb = [&](RrQueryTemplate<Resource2> &query) {
+    slowChildStarted.set_value();
+    for (int i = 0; i < 400 && !query.cancelled(); i++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    slowChildCancelled = query.cancelled();
+    query.cancellationToken()->throwIfCancelled();
+  };
+  auto loadCb2 = [&](RrQueryTemplate<Resource2> &) {};
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+  auto childUnloadCb = [&](RrQueryTemplate<Resource2> &) { childUnloadCnt++; };
+
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("parent", parentLoadCb, unloadCb, 1));
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource2>>("child", loadCb2, childUnloadCb, 1));
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource2>>("slowChild", slowLoadCb, childUnloadCb, 1));
+
+  std::future<bool> parent = std::async(std::launch::async, [&]() {
+    RrQueryTemplate<Resource1> query(Resource1("cancelled"), Resource1(""));
+    try
+    {
+      rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "parent", query);
+    }
+    catch (const resource_registrar::TemotoErrorStack &e)
+    {
+      return false;
+    }
+    return true;
+  });
+
+  slowChildStarted.get_future().wait();
+  EXPECT_TRUE(rr_srv.cancel(parentId));
+
+  // the cancellation reaches the running dependency, the one that already loaded is rolled back
+  EXPECT_FALSE(parent.get());
+  EXPECT_TRUE(slowChildCancelled);
+  EXPECT_EQ(childUnloadCnt, 1);
+  EXPECT_FALSE(rr_srv.cancel(parentId));
+
+  // queries with a cancelled token are not executed
+  RrQueryTemplate<Resource2> cancelledQuery(Resource2(3, 0), Resource2());
+  cancelledQuery.setCancellationToken(std::make_shared<CancellationToken>());
+  cancelledQuery.cancellationToken()->cancel();
+  typedef RrTemplateServer<Resource2> Server2;
+  EXPECT_THROW(rr_cli.call<Server2>(rr_srv, "child", cancelledQuery), resource_registrar::TemotoErrorStack);
+}
+
+TEST_F(RrBaseTest, LoadWatchdogTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  std::atomic<bool> hungLoadCancelled(false);
+  std::atomic<int> stubbornUnloadCnt(0);
+
+  auto hungLoad = [&](RrQueryTemplate<Resource1> &query) {
+    for (int i = 0; i < 200 && !query.cancelled(); i++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    hungLoadCancelled = query.cancelled();
+    query.cancellationToken()->throwIfCancelled();
+  };
+  auto stubbornLoad = [&](RrQueryTemplate<Resource1> &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  };
+  std::atomic<int> maxLoadsPerThread(0);
+  auto fastLoad = [&](RrQueryTemplate<Resource1> &query) {
+    static thread_local int loadsOnThread = 0;
+    int loads = ++loadsOnThread;
+    for (int max = maxLoadsPerThread; loads > max && !maxLoadsPerThread.compare_exchange_weak(max, loads);)
+    {
+    }
+    query.storeResponse(RrQueryResponseTemplate<Resource1>(Resource1("fast response")));
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+  auto stubbornUnload = [&](RrQueryTemplate<Resource1> &) { stubbornUnloadCnt++; };
+
+  LoadTimeouts timeouts;
+  timeouts.soft_ = std::chrono::milliseconds(20);
+  timeouts.hard_ = std::chrono::milliseconds(60);
+
+  auto hungServer = std::make_unique<RrTemplateServer<Resource1>>("hung", hungLoad, unloadCb, 1);
+  hungServer->setLoadTimeouts(timeouts);
+  auto stubbornServer = std::make_unique<RrTemplateServer<Resource1>>("stubborn", stubbornLoad, stubbornUnload, 1);
+  stubbornServer->setLoadTimeouts(timeouts);
+  auto fastServer = std::make_unique<RrTemplateServer<Resource1>>("fast", fastLoad, unloadCb, 1);
+  fastServer->setLoadTimeouts(timeouts);
+  rr_srv.registerServer(std::move(hungServer));
+  rr_srv.registerServer(std::move(stubbornServer));
+  rr_srv.registerServer(std::move(fastServer));
+
+  typedef RrTemplateServer<Resource1> Server1;
+
+  // the caller is released at the hard limit and the callback is told to give up
+  auto start = std::chrono::steady_clock::now();
+  RrQueryTemplate<Resource1> hungQuery(Resource1("hung"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<Server1>(rr_srv, "hung", hungQuery), resource_registrar::TemotoErrorStack);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+
+  // a callback that ignores the cancellation is unloaded once it completes
+  RrQueryTemplate<Resource1> stubbornQuery(Resource1("stubborn"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<Server1>(rr_srv, "stubborn", stubbornQuery), resource_registrar::TemotoErrorStack);
+  for (int i = 0; i < 100 && (stubbornUnloadCnt == 0 || !hungLoadCancelled); i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_TRUE(hungLoadCancelled);
+  EXPECT_EQ(stubbornUnloadCnt, 1);
+
+  // within the limits the result is passed back as usual
+  RrQueryTemplate<Resource1> fastQuery(Resource1("fast"), Resource1(""));
+  rr_cli.call<Server1>(rr_srv, "fast", fastQuery);
+  EXPECT_EQ(fastQuery.response().getResponse().rawMessage(), "fast response");
+
+  LoadStatistics hungStats = rr_srv.serverLoadStatistics("hung");
+  EXPECT_EQ(hungStats.soft_limit_exceeded_, 1);
+  EXPECT_EQ(hungStats.hard_limit_exceeded_, 1);
+  LoadStatistics fastStats = rr_srv.serverLoadStatistics("fast");
+  EXPECT_EQ(fastStats.count_, 1);
+  EXPECT_EQ(fastStats.soft_limit_exceeded_, 0);
+  EXPECT_EQ(std::accumulate(fastStats.buckets_.begin(), fastStats.buckets_.end(), 0), 1);
+
+  // the loads reuse the threads of a bounded pool instead of starting one each
+  for (int i = 0; i < 200; i++)
+  {
+    RrQueryTemplate<Resource1> query(Resource1("fast" + std::to_string(i)), Resource1(""));
+    rr_cli.call<Server1>(rr_srv, "fast", query);
+  }
+  EXPECT_GT(maxLoadsPerThread, 1);
+
+  // a single watchdog copes with thousands of outstanding timers
+  Watchdog watchdog(std::chrono::milliseconds(1), 64);
+  std::atomic<int> fired(0);
+  std::vector<Watchdog::TimerId> timers;
+  for (int i = 0; i < 5000; i++)
+  {
+    timers.push_back(watchdog.schedule(std::chrono::milliseconds(200 + i % 100), [&fired]() { fired++; }));
+  }
+  for (std::size_t i = 0; i < timers.size(); i += 2)
+  {
+    EXPECT_TRUE(watchdog.cancel(timers[i]));
+  }
+  for (int i = 0; i < 200 && fired < 2500; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(fired, 2500);
+  EXPECT_EQ(watchdog.pending(), 0);
+
+  // an abandoned task that never returns does not hold on to a thread of the executor
+  std::mutex blockMutex;
+  std::condition_variable blockCv;
+  bool released = false;
+  std::atomic<int> executed(0);
+  LoadExecutor executor(1);
+  LoadExecutor::TicketPtr blocked = executor.submit([&]() {
+    std::unique_lock<std::mutex> lock(blockMutex);
+    blockCv.wait(lock, [&] { return released; });
+  });
+  for (int i = 0; i < 100 && executor.threadCount() == 1; i++)
+  {
+    executor.abandon(blocked);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(executor.threadCount(), 2);
+  executor.submit([&executed]() { executed++; });
+  for (int i = 0; i < 100 && executed == 0; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(executed, 1);
+  {
+    std::lock_guard<std::mutex> lock(blockMutex);
+    released = true;
+  }
+  blockCv.notify_all();
+  for (int i = 0; i < 100 && executor.threadCount() != 1; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(executor.threadCount(), 1);
+
+  // an RR is destroyed without waiting for the callbacks of its abandoned loads
+  std::atomic<bool> lateLoadDone(false);
+  auto lateLoad = [&](RrQueryTemplate<Resource1> &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    lateLoadDone = true;
+  };
+  start = std::chrono::steady_clock::now();
+  {
+    RrBase rr_late("rr_late");
+    rr_ref["rr_late"] = &rr_late;
+    rr_cli.setRrReferences(rr_ref);
+    rr_late.setRrReferences(rr_ref);
+    auto lateServer = std::make_unique<RrTemplateServer<Resource1>>("late", lateLoad, unloadCb, 1);
+    lateServer->setLoadTimeouts(timeouts);
+    rr_late.registerServer(std::move(lateServer));
+
+    RrQueryTemplate<Resource1> lateQuery(Resource1("late"), Resource1(""));
+    EXPECT_THROW(rr_cli.call<Server1>(rr_late, "late", lateQuery), resource_registrar::TemotoErrorStack);
+    rr_ref.erase("rr_late");
+    rr_cli.setRrReferences(rr_ref);
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(300));
+  EXPECT_FALSE(lateLoadDone);
+  for (int i = 0; i < 100 && !lateLoadDone; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_TRUE(lateLoadDone);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+TEST_F(RrBaseTest, LingerTest)
+{
+  std::atomic<int> loadCnt(0);
+  std::atomic<int> unloadCnt(0);
+
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    loadCnt++;
+    query.storeResponse(RrQueryResponseTemplate<Resource1>(Resource1("warm " + query.request().getRequest().rawMessage())));
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) { unloadCnt++; };
+
+  auto server = std::make_unique<RrTemplateServer<Resource1>>("lingering", loadCb, unloadCb, 1);
+  server->setLinger(std::chrono::milliseconds(150));
+  rr_srv.registerServer(std::move(server));
+
+  typedef RrTemplateServer<Resource1> Server1;
+
+  // a released resource stays loaded and is revived by an identical request
+  RrQueryTemplate<Resource1> first(Resource1("a"), Resource1(""));
+  rr_cli.call<Server1>(rr_srv, "lingering", first);
+  EXPECT_TRUE(rr_cli.unload(rr_srv, first.id()));
+  EXPECT_EQ(unloadCnt, 0);
+  EXPECT_EQ(rr_srv.warmPoolStatistics().entries_, 1);
+
+  RrQueryTemplate<Resource1> second(Resource1("a"), Resource1(""));
+  rr_cli.call<Server1>(rr_srv, "lingering", second);
+  EXPECT_EQ(loadCnt, 1);
+  EXPECT_EQ(second.response().getResponse().rawMessage(), "warm a");
+  EXPECT_EQ(rr_srv.warmPoolStatistics().revived_, 1);
+  EXPECT_EQ(rr_srv.warmPoolStatistics().entries_, 0);
+
+  // the sweeper unloads it once the linger period is over
+  EXPECT_TRUE(rr_cli.unload(rr_srv, second.id()));
+  for (int i = 0; i < 100 && unloadCnt == 0; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(unloadCnt, 1);
+  EXPECT_EQ(rr_srv.warmPoolStatistics().expired_, 1);
+
+  RrQueryTemplate<Resource1> third(Resource1("a"), Resource1(""));
+  rr_cli.call<Server1>(rr_srv, "lingering", third);
+  EXPECT_EQ(loadCnt, 2);
+  EXPECT_TRUE(rr_cli.unload(rr_srv, third.id()));
+
+  // the least recently released resource is evicted when the pool is full
+  WarmPoolLimits limits;
+  limits.max_entries_ = 1;
+  rr_srv.setWarmPoolLimits(limits);
+
+  RrQueryTemplate<Resource1> other(Resource1("b"), Resource1(""));
+  rr_cli.call<Server1>(rr_srv, "lingering", other);
+  EXPECT_TRUE(rr_cli.unload(rr_srv, other.id()));
+  for (int i = 0; i < 100 && unloadCnt < 2; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(unloadCnt, 2);
+  EXPECT_EQ(rr_srv.warmPoolStatistics().evicted_, 1);
+  EXPECT_EQ(rr_srv.warmPoolStatistics().entries_, 1);
+
+  // whatever is left in the pool is unloaded on shutdown
+  rr_srv.releaseWarmPool();
+  EXPECT_EQ(unloadCnt, 3);
+  EXPECT_EQ(rr_srv.warmPoolStatistics().entries_, 0);
+}
+
+TEST_F(RrBaseTest, FailureBackoffTest)
+{
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  std::atomic<int> loadCnt(0);
+  std::atomic<bool> hardwarePresent(false);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &) {
+    loadCnt++;
+    if (!hardwarePresent)
+    {
+      throw resource_registrar::TemotoErrorStack("hardware missing", "FailureBackoffTest");
+    }
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+
+  FailureBackoff backoff;
+  backoff.initial_ = std::chrono::milliseconds(100);
+  backoff.max_ = std::chrono::milliseconds(400);
+
+  auto server = std::make_unique<RrTemplateServer<Resource1>>("sensor", loadCb, unloadCb, 1);
+  server->setFailureBackoff(backoff);
+  RrTemplateServer<Resource1> *sensor = server.get();
+  rr_srv.registerServer(std::move(server));
+
+  typedef RrTemplateServer<Resource1> Server1;
+
+  auto callSensor = [&]() {
+    RrQueryTemplate<Resource1> query(Resource1("camera"), Resource1(""));
+    try
+    {
+      rr_cli.call<Server1>(rr_srv, "sensor", query);
+    }
+    catch (const resource_registrar::TemotoErrorStack &e)
+    {
+      return std::string(e.getErrorStack().front().getMessage());
+    }
+    return std::string("");
+  };
+
+  // retries within the back-off get the cached error
+  for (int i = 0; i < 5; i++)
+  {
+    EXPECT_EQ(callSensor(), "hardware missing");
+  }
+  EXPECT_EQ(loadCnt, 1);
+
+  // the callback runs again once the back-off is over, and the next back-off is longer
+  std::this_thread::sleep_for(std::chrono::milliseconds(120));
+  EXPECT_EQ(callSensor(), "hardware missing");
+  EXPECT_EQ(loadCnt, 2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(120));
+  EXPECT_EQ(callSensor(), "hardware missing");
+  EXPECT_EQ(loadCnt, 2);
+
+  // other requests are not affected
+  RrQueryTemplate<Resource1> other(Resource1("lidar"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<Server1>(rr_srv, "sensor", other), resource_registrar::TemotoErrorStack);
+  EXPECT_EQ(loadCnt, 3);
+
+  // recovery drops the cached failures
+  hardwarePresent = true;
+  sensor->signalRecovery();
+  EXPECT_EQ(callSensor(), "");
+  EXPECT_EQ(loadCnt, 4);
+}
+
+TEST_F(RrBaseTest, LeaseTest)
+{
+  // leases far beyond the first level of the wheel expire on time
+  LeaseWheel::Clock::time_point start = LeaseWheel::Clock::now();
+  LeaseWheel wheel(std::chrono::milliseconds(1), start);
+  for (int i = 0; i < 1000; i++)
+  {
+    wheel.renew("lease" + std::to_string(i), std::chrono::milliseconds(10 + i * 50), start);
+  }
+  wheel.renew("lease0", std::chrono::milliseconds(100000), start);
+  EXPECT_TRUE(wheel.remove("lease1"));
+  EXPECT_EQ(wheel.size(), 999);
+
+  EXPECT_TRUE(wheel.advance(start + std::chrono::milliseconds(59)).empty());
+  EXPECT_EQ(wheel.advance(start + std::chrono::milliseconds(110)), std::vector<std::string>({"lease2"}));
+  EXPECT_EQ(wheel.advance(start + std::chrono::milliseconds(10009)).size(), 197);
+  EXPECT_EQ(wheel.advance(start + std::chrono::milliseconds(10010)), std::vector<std::string>({"lease200"}));
+  EXPECT_EQ(wheel.advance(start + std::chrono::milliseconds(60000)).size(), 799);
+  EXPECT_TRUE(wheel.contains("lease0"));
+  EXPECT_EQ(wheel.advance(start + std::chrono::milliseconds(100000)), std::vector<std::string>({"lease0"}));
+  EXPECT_EQ(wheel.size(), 0);
+
+  // resources whose lease is not renewed are unloaded
+  std::atomic<int> unloadCnt(0);
+
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &) {};
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) { unloadCnt++; };
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("leased", loadCb, unloadCb, 1));
+
+  typedef RrTemplateServer<Resource1> Server1;
+
+  RrQueryTemplate<Resource1> kept(Resource1("kept"), Resource1(""));
+  RrQueryTemplate<Resource1> orphaned(Resource1("orphaned"), Resource1(""));
+  rr_cli.call<Server1>(rr_srv, "leased", kept);
+  rr_cli.call<Server1>(rr_srv, "leased", orphaned);
+
+  std::vector<std::string> unknown = rr_cli.renewLeases(rr_srv, {kept.id(), orphaned.id(), "missing"}, std::chrono::milliseconds(300));
+  EXPECT_EQ(unknown, std::vector<std::string>({"missing"}));
+  EXPECT_EQ(rr_srv.leaseCount(), 2);
+
+  for (int i = 0; i < 5; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    rr_cli.renewLeases(rr_srv, {kept.id()}, std::chrono::milliseconds(300));
+  }
+  EXPECT_EQ(unloadCnt, 1);
+  EXPECT_EQ(rr_srv.leaseCount(), 1);
+  EXPECT_EQ(rr_cli.renewLeases(rr_srv, {orphaned.id()}, std::chrono::milliseconds(300)), std::vector<std::string>({orphaned.id()}));
+
+  // an unloaded id gives up its lease
+  EXPECT_TRUE(rr_cli.unload(rr_srv, kept.id()));
+  EXPECT_EQ(rr_srv.leaseCount(), 0);
+  EXPECT_EQ(unloadCnt, 2);
+}
+
+TEST_F(RrBaseTest, BatchedClientUnloadTest)
+{
+  std::atomic<int> unloadCnt(0);
+
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &) {};
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) { unloadCnt++; };
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("bulk", loadCb, unloadCb, 1));
+
+  typedef RrTemplateServer<Resource1> Server1;
+
+  std::string client = rr_cli.createClient<RrClientBase>("rr_server", "bulk");
+  for (int i = 0; i < 300; i++)
+  {
+    // every third query shares the resource of the first one
+    RrQueryTemplate<Resource1> query(Resource1(i % 3 == 0 ? "shared" : "resource" + std::to_string(i)), Resource1(""));
+    rr_cli.call<Server1>(rr_srv, "bulk", query);
+  }
+  EXPECT_EQ(rr_srv.handleDataFetch("rr_client", "rr_server/bulk").size(), 201);
+
+  rr_cli.unloadClient(client);
+  EXPECT_EQ(unloadCnt, 201);
+  EXPECT_THROW(rr_srv.handleDataFetch("rr_client", "rr_server/bulk"), ElementNotFoundException);
+  EXPECT_EQ(rr_cli.clientCount(), 0);
+}
+
+TEST_F(RrBaseTest, ShmTransportTest)
+{
+  class StatusCountingRr : public RrBase
+  {
+  public:
+    StatusCountingRr(const std::string &name) : RrBase(name) {}
+
+    using RrBase::getServerRrQueries;
+
+    void handleStatus(const std::string &request_id,
+                      const std::vector<std::string> &subscriber_ids,
+                      const Status &status_data)
+    {
+      batches++;
+      RrBase::handleStatus(request_id, subscriber_ids, status_data);
+    }
+
+    std::atomic<int> batches{0};
+  };
+
+  // the RRs only know each other through the shared memory transport
+  std::string suffix = "_" + std::to_string(getpid());
+  StatusCountingRr rr_cli("rr_client" + suffix);
+  RrBase rr_srv("rr_server" + suffix);
+
+  // an inbox left behind by an endpoint that never initialized it is taken over
+  int stale = shm_open(("/temoto_rr_" + rr_srv.name()).c_str(), O_CREAT | O_RDWR, 0600);
+  ASSERT_GE(stale, 0);
+  EXPECT_EQ(ftruncate(stale, 4096), 0);
+  close(stale);
+
+  auto cli_transport = std::make_shared<ShmTransport>(rr_cli.name());
+  rr_cli.setTransport(cli_transport);
+  rr_srv.setTransport(std::make_shared<ShmTransport>(rr_srv.name()));
+
+  // the inbox of a running endpoint is not taken over
+  EXPECT_THROW(ShmTransport duplicate(rr_srv.name()), resource_registrar::TemotoErrorStack);
+
+  std::atomic<int> loadCnt(0);
+  std::atomic<int> unloadCnt(0);
+  std::atomic<int> statusCbCnt(0);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    loadCnt++;
+    std::string request = query.request().getRequest().rawMessage();
+    if (request == "broken")
+    {
+      throw resource_registrar::TemotoErrorStack("broken resource", "ShmTransportTest");
+    }
+    query.storeResponse(Resource1(request + "_loaded"));
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) { unloadCnt++; };
+  auto statusCb = [&](Resource1, const Status &) { statusCbCnt++; };
+
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, statusCb));
+  rr_srv.serveRemote<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>("srv");
+
+  RrQueryTemplate<Resource1> query(Resource1("camera"), Resource1(""));
+  rr_cli.call<TransportClient>(rr_srv.name(), "srv", query);
+  EXPECT_EQ(query.response().getResponse().rawMessage(), "camera_loaded");
+  EXPECT_FALSE(query.id().empty());
+  EXPECT_EQ(loadCnt, 1);
+
+  // the queries of the client can be fetched from the server
+  EXPECT_EQ(rr_cli.getServerRrQueries(IDUtils::generateServerName(rr_srv.name(), "srv"), rr_cli.name()).size(), 1);
+
+  // payloads larger than a single frame of the previous call wrap around the ring
+  std::string large(300000, 'x');
+  for (int i = 0; i < 8; i++)
+  {
+    RrQueryTemplate<Resource1> large_query(Resource1(large + std::to_string(i)), Resource1(""));
+    rr_cli.call<TransportClient>(rr_srv.name(), "srv", large_query);
+    EXPECT_EQ(large_query.response().getResponse().rawMessage(), large + std::to_string(i) + "_loaded");
+  }
+  EXPECT_EQ(loadCnt, 9);
+
+  // errors of the load callback reach the caller
+  RrQueryTemplate<Resource1> broken(Resource1("broken"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<TransportClient>(rr_srv.name(), "srv", broken), resource_registrar::TemotoErrorStack);
+
+  // status updates are delivered over the transport
+  rr_srv.sendStatus(query.id(), {Status::State::UPDATE, query.id(), "message"});
+  EXPECT_EQ(rr_cli.batches, 1);
+  EXPECT_EQ(statusCbCnt, 1);
+
+  // responses larger than the ring are streamed through it
+  EXPECT_EQ(rr_cli.getServerRrQueries(IDUtils::generateServerName(rr_srv.name(), "srv"), rr_cli.name()).size(), 9);
+
+  // unloading the client releases the resources on the server
+  rr_cli.unloadClient(IDUtils::generateServerName(rr_srv.name(), "srv"));
+  EXPECT_EQ(unloadCnt, 9);
+
+  // a peer that crashed leaves its inbox behind, the senders move on to the inbox of its restart
+  std::string peer_name = "rr_peer" + suffix;
+  int ready[2];
+  ASSERT_EQ(pipe(ready), 0);
+  pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0)
+  {
+    close(ready[0]);
+    ShmTransport crashing(peer_name);
+    char started = 1;
+    if (write(ready[1], &started, 1) == 1)
+    {
+      pause();
+    }
+    _exit(0);
+  }
+  close(ready[1]);
+  char started;
+  ASSERT_EQ(read(ready[0], &started, 1), 1);
+  close(ready[0]);
+
+  cli_transport->setRequestTimeout(std::chrono::milliseconds(500));
+  RrQueryTemplate<Resource1> lost(Resource1("lost"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<TransportClient>(peer_name, "srv", lost), resource_registrar::TemotoErrorStack);
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+
+  RrBase rr_peer(peer_name);
+  rr_peer.setTransport(std::make_shared<ShmTransport>(peer_name));
+  rr_peer.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, statusCb));
+  rr_peer.serveRemote<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>("srv");
+
+  RrQueryTemplate<Resource1> found(Resource1("found"), Resource1(""));
+  rr_cli.call<TransportClient>(peer_name, "srv", found);
+  EXPECT_EQ(found.response().getResponse().rawMessage(), "found_loaded");
+}
+
+TEST_F(RrBaseTest, UdsTransportTest)
+{
+  std::string suffix = "_" + std::to_string(getpid());
+  RrBase rr_cli("rr_client" + suffix);
+  RrBase rr_srv("rr_server" + suffix);
+  auto cli_transport = std::make_shared<UdsTransport>(rr_cli.name());
+  auto srv_transport = std::make_shared<UdsTransport>(rr_srv.name());
+  rr_cli.setTransport(cli_transport);
+  rr_srv.setTransport(srv_transport);
+
+  std::atomic<int> loadCnt(0);
+  std::atomic<int> unloadCnt(0);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    loadCnt++;
+    std::string request = query.request().getRequest().rawMessage();
+    if (request == "broken")
+    {
+      throw resource_registrar::TemotoErrorStack("broken resource", "UdsTransportTest");
+    }
+    // keeps the calls of the threads in flight at the same time
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    query.storeResponse(Resource1(request + "_loaded"));
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) { unloadCnt++; };
+
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, 1));
+  rr_srv.serveRemote<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>("srv");
+
+  // clients are not created thread safely, so the first call happens alone
+  RrQueryTemplate<Resource1> first(Resource1("first"), Resource1(""));
+  rr_cli.call<TransportClient>(rr_srv.name(), "srv", first);
+
+  // concurrent calls are pipelined over one connection in each direction
+  std::vector<std::thread> callers;
+  std::atomic<int> correct(0);
+  for (int t = 0; t < 8; t++)
+  {
+    callers.emplace_back([&, t]() {
+      for (int i = 0; i < 25; i++)
+      {
+        std::string request = "resource" + std::to_string(t) + "_" + std::to_string(i);
+        RrQueryTemplate<Resource1> query(Resource1(request), Resource1(""));
+        rr_cli.call<TransportClient>(rr_srv.name(), "srv", query);
+        correct += query.response().getResponse().rawMessage() == request + "_loaded";
+      }
+    });
+  }
+  for (auto &caller : callers)
+  {
+    caller.join();
+  }
+  EXPECT_EQ(correct, 200);
+  EXPECT_EQ(loadCnt, 201);
+  EXPECT_EQ(cli_transport->statistics().connections_, 2);
+  EXPECT_EQ(srv_transport->statistics().connections_, 2);
+  EXPECT_EQ(cli_transport->statistics().frames_sent_, 201);
+  EXPECT_EQ(srv_transport->statistics().frames_received_, 201);
+  EXPECT_LE(cli_transport->statistics().writes_, 201);
+
+  // a frame larger than the socket buffers is written in parts
+  std::string large(1 << 20, 'x');
+  RrQueryTemplate<Resource1> large_query(Resource1(large), Resource1(""));
+  rr_cli.call<TransportClient>(rr_srv.name(), "srv", large_query);
+  EXPECT_EQ(large_query.response().getResponse().rawMessage(), large + "_loaded");
+
+  RrQueryTemplate<Resource1> broken(Resource1("broken"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<TransportClient>(rr_srv.name(), "srv", broken), resource_registrar::TemotoErrorStack);
+
+  // RRs without an endpoint cannot be reached
+  RrQueryTemplate<Resource1> unreachable(Resource1("camera"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<TransportClient>("rr_missing" + suffix, "srv", unreachable), resource_registrar::TemotoErrorStack);
+
+  rr_cli.unloadClient(IDUtils::generateServerName(rr_srv.name(), "srv"));
+  EXPECT_EQ(unloadCnt, 202);
+}
+
+TEST_F(RrBaseTest, LoopbackTransportTest)
+{
+  typedef RrTemplateServer<Resource1> Server1;
+
+  // rr_client -> rr_mid -> rr_server, where the resource of rr_mid depends on the one of rr_server
+  auto runChain = [](std::uint64_t seed, int &unloadCnt) {
+    auto network = std::make_shared<LoopbackNetwork>(seed);
+    LinkProfile profile;
+    profile.latency_ = std::chrono::microseconds(2000);
+    profile.jitter_ = std::chrono::microseconds(1000);
+    profile.bandwidth_ = 50 * 1000 * 1000;
+    network->setLinkProfile(profile);
+
+    RrBase rr_cli("rr_client");
+    RrBase rr_mid("rr_mid");
+    RrBase rr_srv("rr_server");
+    rr_cli.setTransport(std::make_shared<LoopbackTransport>(rr_cli.name(), network));
+    rr_mid.setTransport(std::make_shared<LoopbackTransport>(rr_mid.name(), network));
+    rr_srv.setTransport(std::make_shared<LoopbackTransport>(rr_srv.name(), network));
+
+    auto srvLoadCb = [&](RrQueryTemplate<Resource1> &query) {
+      query.storeResponse(Resource1(query.request().getRequest().rawMessage() + "_srv"));
+    };
+    auto srvUnloadCb = [&](RrQueryTemplate<Resource1> &) { unloadCnt++; };
+    rr_srv.registerServer(std::make_unique<Server1>("srv", srvLoadCb, srvUnloadCb, 1));
+    rr_srv.serveRemote<Server1, RrQueryTemplate<Resource1>>("srv");
+
+    auto midLoadCb = [&](RrQueryTemplate<Resource1> &query) {
+      RrQueryTemplate<Resource1> nested(query.request().getRequest(), Resource1(""));
+      rr_mid.call<TransportClient>("rr_server", "srv", nested);
+      query.storeResponse(Resource1(nested.response().getResponse().rawMessage() + "_mid"));
+    };
+    auto midUnloadCb = [&](RrQueryTemplate<Resource1> &) { unloadCnt++; };
+    rr_mid.registerServer(std::make_unique<Server1>("mid", midLoadCb, midUnloadCb, 1));
+    rr_mid.serveRemote<Server1, RrQueryTemplate<Resource1>>("mid");
+
+    RrQueryTemplate<Resource1> query(Resource1("camera"), Resource1(""));
+    rr_cli.call<TransportClient>("rr_mid", "mid", query);
+    EXPECT_EQ(query.response().getResponse().rawMessage(), "camera_srv_mid");
+
+    std::vector<HopTiming> timings = network->hopTimings();
+
+    // releasing the resource of rr_mid releases its dependency on rr_server as well
+    rr_cli.unloadClient(IDUtils::generateServerName("rr_mid", "mid"));
+    return timings;
+  };
+
+  int unloadCnt = 0;
+  std::vector<HopTiming> timings = runChain(7, unloadCnt);
+  EXPECT_EQ(unloadCnt, 2);
+
+  // the request and the response of both hops
+  ASSERT_EQ(timings.size(), 4);
+  EXPECT_EQ(timings[0].from_, "rr_client");
+  EXPECT_EQ(timings[0].to_, "rr_mid");
+  EXPECT_EQ(timings[1].from_, "rr_mid");
+  EXPECT_EQ(timings[1].to_, "rr_server");
+  EXPECT_EQ(timings[2].kind_, TransportFrame::Kind::RESPONSE);
+  EXPECT_EQ(timings[3].to_, "rr_client");
+  for (const auto &timing : timings)
+  {
+    EXPECT_EQ(timing.type_, TransportMessage::CALL);
+    EXPECT_GE(timing.injected_.count(), 2000);
+    EXPECT_LE(timing.injected_.count(), 3000 + timing.bytes_ / 50 + 1);
+    EXPECT_GE(timing.measured_.count(), timing.injected_.count());
+  }
+
+  // the same seed injects the same delays
+  std::vector<HopTiming> repeated = runChain(7, unloadCnt);
+  std::vector<HopTiming> reseeded = runChain(8, unloadCnt);
+  ASSERT_EQ(repeated.size(), 4);
+  ASSERT_EQ(reseeded.size(), 4);
+  bool same_seed_equal = true;
+  bool other_seed_equal = true;
+  for (std::size_t i = 0; i < timings.size(); i++)
+  {
+    same_seed_equal &= timings[i].injected_ == repeated[i].injected_;
+    other_seed_equal &= timings[i].injected_ == reseeded[i].injected_;
+  }
+  EXPECT_TRUE(same_seed_equal);
+  EXPECT_FALSE(other_seed_equal);
+
+  // an endpoint that serves nothing rejects a request right away, and can still be shut down afterwards
+  auto network = std::make_shared<LoopbackNetwork>();
+  RrBase rr_cli("rr_client");
+  rr_cli.setTransport(std::make_shared<LoopbackTransport>(rr_cli.name(), network));
+  auto idle = std::make_unique<LoopbackTransport>("rr_idle", network);
+  auto start = std::chrono::steady_clock::now();
+  RrQueryTemplate<Resource1> query(Resource1("camera"), Resource1(""));
+  EXPECT_THROW(rr_cli.call<TransportClient>("rr_idle", "srv", query), resource_registrar::TemotoErrorStack);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+  idle.reset();
+}
+
+TEST_F(RrBaseTest, DataFetchPagingTest)
+{
+  class FetchingRr : public RrBase
+  {
+  public:
+    FetchingRr(const std::string &name) : RrBase(name) {}
+
+    using RrBase::fetchServerRrQueries;
+  };
+
+  FetchingRr rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    query.storeResponse(Resource1(query.request().getRequest().rawMessage() + "_loaded"));
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, 1));
+
+  typedef RrTemplateServer<Resource1> Server1;
+
+  rr_cli.createClient<RrClientBase>("rr_server", "srv");
+  for (int i = 0; i < 300; i++)
+  {
+    // every third query shares the resource of the first one
+    RrQueryTemplate<Resource1> query(Resource1(i % 3 == 0 ? "shared" : "resource" + std::to_string(i)), Resource1(""));
+    rr_cli.call<Server1>(rr_srv, "srv", query);
+  }
+
+  std::map<UUID, std::pair<std::string, std::string>> all = rr_srv.handleDataFetch("rr_client", "rr_server/srv");
+  ASSERT_EQ(all.size(), 201);
+
+  // every resource shows up on exactly one page
+  std::map<UUID, std::pair<std::string, std::string>> paged;
+  std::string cursor;
+  int pages = 0;
+  do
+  {
+    DataFetchPage page = rr_srv.handleDataFetchPage("rr_client", "rr_server/srv", cursor, 50);
+    EXPECT_LE(page.entries_.size(), 50);
+    for (const auto &entry : page.entries_)
+    {
+      EXPECT_TRUE(paged.insert(entry).second);
+    }
+    cursor = page.next_cursor_;
+    pages++;
+  } while (!cursor.empty());
+  EXPECT_EQ(pages, 5);
+  EXPECT_EQ(paged, all);
+
+  // queries of other RRs are left out
+  EXPECT_TRUE(rr_srv.handleDataFetchPage("rr_other", "rr_server/srv", "", 50).entries_.empty());
+
+  // the sink receives the projected part of every query
+  int responses = 0;
+  rr_cli.fetchServerRrQueries("rr_server/srv", "rr_client", [&](const UUID &id, const std::string &request, const std::string &response) {
+    EXPECT_TRUE(request.empty());
+    EXPECT_EQ(response, all[id].second);
+    responses++;
+  },
+                              16, DataProjection::RESPONSE);
+  EXPECT_EQ(responses, 201);
+
+  int requests = 0;
+  rr_cli.fetchServerRrQueries("rr_server/srv", "rr_client", [&](const UUID &id, const std::string &request, const std::string &response) {
+    EXPECT_EQ(request, all[id].first);
+    EXPECT_TRUE(response.empty());
+    requests++;
+  },
+                              1000, DataProjection::REQUEST);
+  EXPECT_EQ(requests, 201);
+
+  // pages travel over transports as well
+  auto network = std::make_shared<LoopbackNetwork>();
+  FetchingRr rr_remote("rr_remote");
+  rr_remote.setTransport(std::make_shared<LoopbackTransport>("rr_remote", network));
+  rr_srv.setTransport(std::make_shared<LoopbackTransport>("rr_server", network));
+  rr_srv.serveRemote<Server1, RrQueryTemplate<Resource1>>("srv");
+  for (int i = 0; i < 5; i++)
+  {
+    RrQueryTemplate<Resource1> query(Resource1("remote" + std::to_string(i)), Resource1(""));
+    rr_remote.call<TransportClient>("rr_server", "srv", query);
+  }
+  std::set<std::string> remote_ids;
+  rr_remote.fetchServerRrQueries("rr_server/srv", "rr_remote", [&](const UUID &id, const std::string &, const std::string &) {
+    remote_ids.insert(id);
+  },
+                                 2);
+  EXPECT_EQ(remote_ids.size(), 5);
+}
+
+TEST_F(RrBaseTest, DataDeltaTest)
+{
+  class DeltaRr : public RrBase
+  {
+  public:
+    DeltaRr(const std::string &name) : RrBase(name) {}
+
+    using RrBase::fetchServerRrChanges;
+    using RrBase::updateQuery;
+  };
+
+  DeltaRr rr_cli("rr_client");
+  DeltaRr rr_srv("rr_server");
+  std::unordered_map<std::string, RrBase *> rr_ref;
+  rr_ref["rr_client"] = &rr_cli;
+  rr_ref["rr_server"] = &rr_srv;
+  rr_cli.setRrReferences(rr_ref);
+  rr_srv.setRrReferences(rr_ref);
+
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    query.storeResponse(Resource1(query.request().getRequest().rawMessage() + "_loaded"));
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb, 1));
+
+  typedef RrTemplateServer<Resource1> Server1;
+
+  rr_cli.createClient<RrClientBase>("rr_server", "srv");
+  std::vector<std::string> ids;
+  for (int i = 0; i < 10; i++)
+  {
+    RrQueryTemplate<Resource1> query(Resource1("resource" + std::to_string(i)), Resource1(""));
+    rr_cli.call<Server1>(rr_srv, "srv", query);
+    ids.push_back(query.id());
+  }
+
+  // the first delta carries the complete state
+  DataDelta delta = rr_cli.fetchServerRrChanges("rr_server/srv", "rr_client", 0);
+  EXPECT_TRUE(delta.reset_);
+  EXPECT_EQ(delta.changed_.size(), 10);
+  EXPECT_TRUE(delta.removed_.empty());
+  std::uint64_t since = delta.generation_;
+
+  // nothing changed in the meantime
+  delta = rr_cli.fetchServerRrChanges("rr_server/srv", "rr_client", since);
+  EXPECT_FALSE(delta.reset_);
+  EXPECT_TRUE(delta.changed_.empty());
+  EXPECT_TRUE(delta.removed_.empty());
+  EXPECT_EQ(delta.generation_, since);
+
+  // additions, response updates and removals are reported once
+  std::map<UUID, std::string> requests;
+  for (const auto &entry : rr_cli.fetchServerRrChanges("rr_server/srv", "rr_client", 0).changed_)
+  {
+    requests[entry.first] = entry.second.first;
+  }
+  RrQueryTemplate<Resource1> added(Resource1("added"), Resource1(""));
+  rr_cli.call<Server1>(rr_srv, "srv", added);
+  rr_srv.updateQuery("srv", requests[ids[0]], "updated");
+  rr_cli.unload(rr_srv, ids[1]);
+
+  delta = rr_cli.fetchServerRrChanges("rr_server/srv", "rr_client", since);
+  EXPECT_FALSE(delta.reset_);
+  EXPECT_GT(delta.generation_, since);
+  std::map<UUID, std::pair<std::string, std::string>> changed(delta.changed_.begin(), delta.changed_.end());
+  EXPECT_EQ(changed.size(), 2);
+  EXPECT_EQ(changed.count(added.id()), 1);
+  ASSERT_EQ(changed.count(ids[0]), 1);
+  EXPECT_EQ(changed[ids[0]].second, "updated");
+  EXPECT_EQ(delta.removed_, std::vector<UUID>{ids[1]});
+  since = delta.generation_;
+
+  // queries of other RRs are left out
+  EXPECT_TRUE(rr_srv.handleDataDelta("rr_other", "rr_server/srv", 0).changed_.empty());
+
+  // removals beyond the tombstone limit are forgotten, older generations get the complete state
+  rr_srv.setTombstoneLimit(2);
+  for (int i = 2; i < 6; i++)
+  {
+    rr_cli.unload(rr_srv, ids[i]);
+  }
+  delta = rr_cli.fetchServerRrChanges("rr_server/srv", "rr_client", since);
+  EXPECT_TRUE(delta.reset_);
+  EXPECT_EQ(delta.changed_.size(), 6);
+  EXPECT_TRUE(delta.removed_.empty());
+
+  // deltas travel over transports as well
+  auto network = std::make_shared<LoopbackNetwork>();
+  DeltaRr rr_remote("rr_remote");
+  rr_remote.setTransport(std::make_shared<LoopbackTransport>("rr_remote", network));
+  rr_srv.setTransport(std::make_shared<LoopbackTransport>("rr_server", network));
+  rr_srv.serveRemote<Server1, RrQueryTemplate<Resource1>>("srv");
+  RrQueryTemplate<Resource1> remote(Resource1("remote"), Resource1(""));
+  rr_remote.call<TransportClient>("rr_server", "srv", remote);
+
+  delta = rr_remote.fetchServerRrChanges("rr_server/srv", "rr_remote", 0);
+  ASSERT_EQ(delta.changed_.size(), 1);
+  EXPECT_EQ(delta.changed_[0].first, remote.id());
+  rr_remote.unload("rr_server", remote.id());
+  delta = rr_remote.fetchServerRrChanges("rr_server/srv", "rr_remote", delta.generation_);
+  EXPECT_FALSE(delta.reset_);
+  EXPECT_EQ(delta.removed_, std::vector<UUID>{remote.id()});
+}
+
+TEST_F(RrBaseTest, CatalogFeedTest)
+{
+  typedef CatalogEvent::Type Type;
+
+  RrCatalog catalog;
+  CatalogSubscription subscription = catalog.subscribe();
+
+  RrQueryBase query;
+  query.setId("queryId1");
+  query.setOrigin("originRR");
+  catalog.storeQuery("server", query, "request", "");
+
+  RrQueryBase attached;
+  attached.setId("queryId2");
+  attached.setOrigin("otherRR");
+  catalog.processExisting("server", "queryId1", attached);
+  catalog.updateResponse("server", "request", "response");
+  catalog.storeDependency("queryId1", "dependencyRR", "dependencyId");
+  catalog.unloadDependency("queryId1", "dependencyId");
+  bool unloadable = false;
+  catalog.unload("server", "queryId2", unloadable);
+  catalog = RrCatalog();
+
+  std::vector<CatalogEvent> events;
+  ASSERT_EQ(subscription.poll(events), 7);
+  std::vector<Type> types;
+  for (std::size_t i = 0; i < events.size(); i++)
+  {
+    types.push_back(events[i].type_);
+    if (i)
+    {
+      EXPECT_GT(events[i].generation_, events[i - 1].generation_);
+    }
+  }
+  EXPECT_EQ(types, (std::vector<Type>{Type::QUERY_STORED, Type::ID_ATTACHED, Type::RESPONSE_UPDATED,
+                                      Type::DEPENDENCY_ADDED, Type::DEPENDENCY_REMOVED, Type::ID_UNLOADED,
+                                      Type::CATALOG_REPLACED}));
+  EXPECT_EQ(events[1].id_, "queryId2");
+  EXPECT_EQ(events[1].related_id_, "queryId1");
+  EXPECT_EQ(events[3].server_, "dependencyRR");
+  EXPECT_EQ(events[3].related_id_, "dependencyId");
+  EXPECT_EQ(events[5].id_, "queryId2");
+  EXPECT_EQ(events[5].server_, "server");
+  EXPECT_EQ(subscription.poll(events), 0);
+
+  // a subscriber that falls behind is told so and continues with the newest events
+  RrCatalog small_catalog;
+  small_catalog.setFeedCapacity(256);
+  CatalogSubscription slow = small_catalog.subscribe();
+  CatalogSubscription paced = small_catalog.subscribe();
+  events.clear();
+  for (int i = 0; i < 20; i++)
+  {
+    small_catalog.storeDependency("query", "rr", "dependency" + std::to_string(i));
+    EXPECT_EQ(paced.poll(events), 1);
+  }
+  EXPECT_EQ(paced.overflows(), 0);
+
+  events.clear();
+  EXPECT_EQ(slow.poll(events), 1);
+  EXPECT_EQ(events[0].type_, Type::EVENTS_LOST);
+  EXPECT_EQ(slow.overflows(), 1);
+  small_catalog.unloadDependency("query", "dependency19");
+  events.clear();
+  ASSERT_EQ(slow.poll(events), 1);
+  EXPECT_EQ(events[0].type_, Type::DEPENDENCY_REMOVED);
+
+  // readers never block the writer and never see torn events
+  const int event_count = 20000;
+  std::atomic<bool> done(false);
+  auto consume = [&](CatalogSubscription subscription, std::size_t batch) {
+    std::vector<CatalogEvent> received;
+    std::uint64_t last_generation = 0;
+    int seen = 0;
+    bool finished = false;
+    while (!finished)
+    {
+      finished = done;
+      received.clear();
+      subscription.poll(received, batch);
+      for (const auto &event : received)
+      {
+        if (event.type_ == Type::EVENTS_LOST)
+        {
+          continue;
+        }
+        EXPECT_GT(event.generation_, last_generation);
+        EXPECT_EQ(event.related_id_, "dependency" + std::to_string(event.generation_));
+        last_generation = event.generation_;
+        seen++;
+      }
+      finished = finished && received.empty();
+    }
+    // a reader that only got scheduled after the writer finished still learns about the loss
+    EXPECT_TRUE(seen > 0 || subscription.overflows() > 0);
+  };
+
+  RrCatalog busy_catalog;
+  busy_catalog.setFeedCapacity(4096);
+  std::thread reader1(consume, busy_catalog.subscribe(), 0);
+  std::thread reader2(consume, busy_catalog.subscribe(), 3);
+  for (int i = 1; i <= event_count; i++)
+  {
+    busy_catalog.storeDependency("query", "rr", "dependency" + std::to_string(i));
+  }
+  done = true;
+  reader1.join();
+  reader2.join();
+}
+
+TEST_F(RrBaseTest, LoggingLevelGateTest)
+{
+  int formatted = 0;
+
+  // disabled levels do not evaluate their arguments
+  console_bridge::LogLevel level = console_bridge::getLogLevel();
+  console_bridge::setLogLevel(console_bridge::LogLevel::CONSOLE_BRIDGE_LOG_WARN);
+  TEMOTO_DEBUG_("value %d", ++formatted);
+  TEMOTO_DEBUG_STREAM_("value " << ++formatted);
+  EXPECT_EQ(formatted, 0);
+
+  console_bridge::setLogLevel(console_bridge::LogLevel::CONSOLE_BRIDGE_LOG_DEBUG);
+  TEMOTO_DEBUG_("value %d", ++formatted);
+  TEMOTO_DEBUG_STREAM_("value " << ++formatted);
+  EXPECT_EQ(formatted, 2);
+  console_bridge::setLogLevel(level);
+
+  // cached prefixes follow the subsystem name
+  temoto_logging::CallSitePrefix call_site;
+  std::string subsystem = TEMOTO_LOG_ATTR.getSubsystemName();
+  TEMOTO_LOG_ATTR.setSubsystemName("first");
+  EXPECT_EQ(call_site.get("function"), "[from " + TEMOTO_LOG_ATTR.getNsWithSlash() + "function]: ");
+  EXPECT_NE(call_site.get("function").find("first/"), std::string::npos);
+  TEMOTO_LOG_ATTR.setSubsystemName("second");
+  EXPECT_NE(call_site.get("function").find("second/"), std::string::npos);
+  TEMOTO_LOG_ATTR.setSubsystemName(subsystem);
+}
+
+TEST_F(RrBaseTest, AsyncLoggingTest)
+{
+  using temoto_logging::AsyncLogger;
+  using temoto_logging::AsyncLoggingOptions;
+  using temoto_logging::AsyncLoggingStatistics;
+
+  std::mutex output_mutex;
+  std::vector<std::string> output;
+  AsyncLoggingOptions options;
+  options.ring_capacity_ = 8;
+  options.overflow_policy_ = AsyncLoggingOptions::OverflowPolicy::BLOCK;
+  options.output_ = [&](console_bridge::LogLevel, const char *, int, const std::string &message) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    output.push_back(message);
+  };
+
+  AsyncLogger &logger = AsyncLogger::instance();
+  AsyncLoggingStatistics before = logger.statistics();
+  logger.start(options);
+
+  // blocking loses nothing, and the records of a thread stay in order
+  const int threads = 4;
+  const int records = 500;
+  std::vector<std::thread> loggers;
+  for (int t = 0; t < threads; t++)
+  {
+    loggers.emplace_back([t] {
+      for (int i = 0; i < records; i++)
+      {
+        // the argument is captured before the temporary goes away
+        TEMOTO_INFO_("thread %s record %d", std::to_string(t).c_str(), i);
+      }
+    });
+  }
+  for (auto &thread : loggers)
+  {
+    thread.join();
+  }
+  logger.flush();
+
+  {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    ASSERT_EQ(output.size(), threads * records);
+    std::vector<int> next(threads, 0);
+    for (const auto &message : output)
+    {
+      std::size_t position = message.find("thread ");
+      ASSERT_NE(position, std::string::npos);
+      int t = 0;
+      int i = 0;
+      ASSERT_EQ(sscanf(message.c_str() + position, "thread %d record %d", &t, &i), 2);
+      EXPECT_EQ(i, next[t]++);
+    }
+  }
+  AsyncLoggingStatistics statistics = logger.statistics();
+  EXPECT_EQ(statistics.written_ - before.written_, threads * records);
+  EXPECT_EQ(statistics.dropped_, before.dropped_);
+
+  // dropping never waits for a slow writer, every record is either written or counted
+  options.overflow_policy_ = AsyncLoggingOptions::OverflowPolicy::DROP;
+  options.output_ = [&](console_bridge::LogLevel, const char *, int, const std::string &) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  };
+  logger.start(options);
+  before = logger.statistics();
+  for (int i = 0; i < records; i++)
+  {
+    TEMOTO_INFO_("record %d", i);
+  }
+  logger.stop();
+  statistics = logger.statistics();
+  EXPECT_GT(statistics.dropped_ - before.dropped_, 0);
+  EXPECT_EQ(statistics.written_ - before.written_ + statistics.dropped_ - before.dropped_, records);
+
+  // a stopped logger leaves the records to console_bridge
+  EXPECT_FALSE(logger.running());
+  before = logger.statistics();
+  TEMOTO_INFO_("synchronous %d", 1);
+  EXPECT_EQ(logger.statistics().written_, before.written_);
+}
+
+TEST_F(RrBaseTest, TraceSamplingTest)
+{
+  temoto_logging::TraceSampling previous = TEMOTO_LOG_ATTR.getTraceSampling();
+  EXPECT_DOUBLE_EQ(previous.probability_, 1.0);
+
+  temoto_logging::TraceSampling sampling;
+  sampling.probability_ = 0.25;
+  sampling.latency_threshold_ = std::chrono::milliseconds(150);
+  sampling.keep_errors_ = false;
+  TEMOTO_LOG_ATTR.setTraceSampling(sampling);
+
+  temoto_logging::TraceSampling applied = TEMOTO_LOG_ATTR.getTraceSampling();
+  EXPECT_NEAR(applied.probability_, 0.25, 1e-9);
+  EXPECT_EQ(applied.latency_threshold_, std::chrono::milliseconds(150));
+  EXPECT_FALSE(applied.keep_errors_);
+
+  // probabilities are clamped
+  sampling.probability_ = 7;
+  TEMOTO_LOG_ATTR.setTraceSampling(sampling);
+  EXPECT_DOUBLE_EQ(TEMOTO_LOG_ATTR.getTraceSampling().probability_, 1.0);
+  sampling.probability_ = -1;
+  TEMOTO_LOG_ATTR.setTraceSampling(sampling);
+  EXPECT_DOUBLE_EQ(TEMOTO_LOG_ATTR.getTraceSampling().probability_, 0.0);
+
+#ifdef temoto_enable_tracing
+  // the head decision of the caller reaches the server with the request metadata
+  sampling.probability_ = 0;
+  sampling.latency_threshold_ = std::chrono::milliseconds(0);
+  sampling.keep_errors_ = false;
+  TEMOTO_LOG_ATTR.setTraceSampling(sampling);
+
+  RrBase rr_cli("rr_client");
+  RrBase rr_srv("rr_server");
+  bool loadUnsampled = false;
+  auto loadCb = [&](RrQueryTemplate<Resource1> &query) {
+    loadUnsampled = temoto_logging::TraceSampler::unsampled(query.requestMetadata().getSpanContext());
+  };
+  auto unloadCb = [&](RrQueryTemplate<Resource1> &) {};
+  rr_srv.registerServer(std::make_unique<RrTemplateServer<Resource1>>("srv", loadCb, unloadCb));
+
+  RrQueryTemplate<Resource1> tracedQuery(Resource1("traced"), Resource1(""));
+  rr_cli.call<RrTemplateServer<Resource1>, RrQueryTemplate<Resource1>>(rr_srv, "srv", tracedQuery);
+  EXPECT_TRUE(loadUnsampled);
+#endif
+
+  TEMOTO_LOG_ATTR.setTraceSampling(previous);
+
+  typedef temoto_logging::TraceSampler::Decision Decision;
+  temoto_logging::TraceSampler sampler;
+
+  // traces are sampled at the rate of the probability
+  EXPECT_EQ(sampler.decide(NULL), Decision::SAMPLED);
+  sampling.probability_ = 0.25;
+  sampling.latency_threshold_ = std::chrono::milliseconds(0);
+  sampling.keep_errors_ = false;
+  sampler.setSampling(sampling);
+  int sampled = 0;
+  for (int i = 0; i < 20000; i++)
+  {
+    sampled += sampler.headSample() ? 1 : 0;
+  }
+  EXPECT_NEAR(sampled / 20000.0, 0.25, 0.03);
+
+  // unsampled roots are only kept for the tail decision if it can report them
+  sampling.probability_ = 0;
+  sampler.setSampling(sampling);
+  EXPECT_EQ(sampler.decide(NULL), Decision::UNSAMPLED);
+  sampling.keep_errors_ = true;
+  sampler.setSampling(sampling);
+  EXPECT_EQ(sampler.decide(NULL), Decision::TAIL_CANDIDATE);
+
+  // the decision of the root travels with the span context of the queries, also to other processes
+  temoto_logging::TraceSampler::SpanContext rootContext;
+  temoto_logging::TraceSampler::markUnsampled(rootContext);
+  RrQueryTemplate<Resource1> query(Resource1("traced"), Resource1(""));
+  query.requestMetadata().setSpanContext(rootContext);
+  RrQueryBase received = Serializer::deserialize<RrQueryBase>(Serializer::serialize<RrQueryBase>(query));
+  EXPECT_EQ(received.requestMetadata().getSpanContext().at(temoto_logging::UNSAMPLED_KEY), "1");
+
+  sampling.probability_ = 1;
+  sampler.setSampling(sampling);
+  EXPECT_EQ(sampler.decide(&received.requestMetadata().getSpanContext()), Decision::UNSAMPLED);
+  temoto_logging::TraceSampler::SpanContext sampledContext = {{"uber-trace-id", "1:2:0:1"}};
+  sampling.probability_ = 0;
+  sampler.setSampling(sampling);
+  EXPECT_EQ(sampler.decide(&sampledContext), Decision::SAMPLED);
+
+  // unsampled roots are reported if they failed or took too long
+  sampling.latency_threshold_ = std::chrono::milliseconds(100);
+  sampler.setSampling(sampling);
+  EXPECT_TRUE(sampler.reportTail(true, std::chrono::milliseconds(0)));
+  EXPECT_FALSE(sampler.reportTail(false, std::chrono::milliseconds(50)));
+  EXPECT_TRUE(sampler.reportTail(false, std::chrono::milliseconds(150)));
+  sampling.keep_errors_ = false;
+  sampler.setSampling(sampling);
+  EXPECT_FALSE(sampler.reportTail(true, std::chrono::milliseconds(0)));
+
+  // spans are marked failed only by the exceptions that leave them
+  struct ScopeProbe
+  {
+    explicit ScopeProbe(bool &unwinding) : unwinding_(unwinding) {}
+    ~ScopeProbe() { unwinding_ = detector_.unwinding(); }
+    bool &unwinding_;
+    temoto_logging::UnwindingDetector detector_;
+  };
+  struct NestedScope
+  {
+    explicit NestedScope(bool &unwinding) : unwinding_(unwinding) {}
+    ~NestedScope() { ScopeProbe probe(unwinding_); }
+    bool &unwinding_;
+  };
+
+  bool leftByException = false;
+  try
+  {
+    ScopeProbe probe(leftByException);
+    throw std::runtime_error("span failed");
+  }
+  catch (const std::runtime_error &)
+  {
+  }
+  EXPECT_TRUE(leftByException);
+
+  bool nestedLeftByException = true;
+  try
+  {
+    NestedScope scope(nestedLeftByException);
+    throw std::runtime_error("outer span failed");
+  }
+  catch (const std::runtime_error &)
+  {
+  }
+  EXPECT_FALSE(nestedLeftByException);
+}